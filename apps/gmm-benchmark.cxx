@@ -0,0 +1,286 @@
+#include <itkMesh.h>
+#include <itkTimeProbe.h>
+#include <itkPointsLocator.h>
+
+#include "itkPointSetPropertiesCalculator.h"
+#include "itkInitializeTransform.h"
+#include "itkInitializeMetric.h"
+#include "itkPointsKdTreeIndex.h"
+#include "itkTaskScheduler.h"
+
+#include "itkIOutils.h"
+#include "argsCustomParsers.h"
+
+const unsigned int Dimension = 3;
+typedef itk::Mesh<float, Dimension> MeshType;
+typedef itk::PointSet<MeshType::PixelType, Dimension> PointSetType;
+typedef itk::InitializeMetric<PointSetType, PointSetType> InitializeMetricType;
+typedef InitializeMetricType::MetricType MetricType;
+typedef itk::PointsLocator<PointSetType::PointsContainer> PointsLocatorType;
+typedef itk::PointsKdTreeIndex<PointSetType::PointsContainer> PointsIndexType;
+
+struct BenchmarkResult
+{
+  double time;
+  MetricType::MeasureType value;
+  MetricType::DerivativeType derivative;
+};
+
+//! Times evaluations of the value and derivative of the metric
+BenchmarkResult benchmarkMetric(MetricType * metric, const MetricType::ParametersType & parameters, const size_t & numberOfEvaluations)
+{
+  BenchmarkResult result;
+
+  itk::TimeProbe probe;
+  for (size_t n = 0; n < numberOfEvaluations; ++n) {
+    probe.Start();
+    metric->GetValueAndDerivative(parameters, result.value, result.derivative);
+    probe.Stop();
+  }
+
+  result.time = probe.GetMean();
+  return result;
+}
+
+//! Times the radius and the closest point queries of the moving points, returns the identifiers found
+template <typename TLocator>
+std::vector<PointsIndexType::NeighborsIdentifierType> benchmarkQueries(const TLocator * locator, const PointSetType * points, const double & radius, double & searchTime, double & closestTime)
+{
+  std::vector<PointsIndexType::NeighborsIdentifierType> result(points->GetNumberOfPoints());
+
+  itk::TimeProbe searchProbe;
+  searchProbe.Start();
+  for (PointSetType::PointsContainerConstIterator it = points->GetPoints()->Begin(); it != points->GetPoints()->End(); ++it) {
+    locator->Search(it.Value(), radius, result[it.Index()]);
+  }
+  searchProbe.Stop();
+
+  itk::TimeProbe closestProbe;
+  closestProbe.Start();
+  for (PointSetType::PointsContainerConstIterator it = points->GetPoints()->Begin(); it != points->GetPoints()->End(); ++it) {
+    result[it.Index()].push_back(locator->FindClosestPoint(it.Value()));
+  }
+  closestProbe.Stop();
+
+  searchTime = searchProbe.GetTotal();
+  closestTime = closestProbe.GetTotal();
+  return result;
+}
+
+int main(int argc, char** argv) {
+
+  args::ArgumentParser parser("Benchmark of the GMM-based point set to point set metrics.", "");
+  args::HelpFlag help(parser, "help", "Display this help menu", {'h', "help"});
+
+  args::Group allRequired(parser, "Required arguments:", args::Group::Validators::All);
+
+  args::ValueFlag<std::string> argFixedFileName(allRequired, "fixed", "The fixed mesh (point-set) filename", {'f', "fixed"});
+  args::ValueFlag<std::string> argMovingFileName(allRequired, "moving", "The moving mesh (point-set) filename", {'m', "moving"});
+  args::ValueFlag<double> argScale(parser, "scale", "The scale in units of the RMS radius", {"scale"}, 0.1);
+  args::ValueFlag<size_t> argNumberOfEvaluations(parser, "evaluations", "The number of evaluations of each metric", {"evaluations"}, 10);
+  args::ValueFlag<double> argRadius(parser, "radius", "The radius of the search queries in units of scale", {"radius"}, 3);
+  args::ValueFlag<size_t> argNumberOfThreads(parser, "threads", "The number of threads of the metric evaluations (default: the number of cores)", {"threads"}, 0);
+
+  try {
+    parser.ParseCLI(argc, argv);
+  }
+  catch (args::Help) {
+    std::cout << parser;
+    return EXIT_SUCCESS;
+  }
+  catch (args::ParseError e) {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    return EXIT_FAILURE;
+  }
+  catch (args::ValidationError e) {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    return EXIT_FAILURE;
+  }
+
+  size_t numberOfEvaluations = args::get(argNumberOfEvaluations);
+
+  itk::TaskScheduler & scheduler = itk::TaskScheduler::GetInstance();
+  scheduler.SetNumberOfThreads(args::get(argNumberOfThreads));
+
+  //--------------------------------------------------------------------
+  // read meshes
+  MeshType::Pointer fixedMesh = MeshType::New();
+  if (!readMesh<MeshType>(fixedMesh, args::get(argFixedFileName))) {
+    return EXIT_FAILURE;
+  }
+
+  MeshType::Pointer movingMesh = MeshType::New();
+  if (!readMesh<MeshType>(movingMesh, args::get(argMovingFileName))) {
+    return EXIT_FAILURE;
+  }
+
+  PointSetType::Pointer fixedPointSet = PointSetType::New();
+  fixedPointSet->SetPoints(fixedMesh->GetPoints());
+
+  PointSetType::Pointer movingPointSet = PointSetType::New();
+  movingPointSet->SetPoints(movingMesh->GetPoints());
+
+  std::cout << " fixed points " << fixedPointSet->GetNumberOfPoints() << std::endl;
+  std::cout << "moving points " << movingPointSet->GetNumberOfPoints() << std::endl;
+  std::cout << std::endl;
+
+  typedef itk::PointSetPropertiesCalculator<PointSetType> PointSetPropertiesCalculatorType;
+  PointSetPropertiesCalculatorType::Pointer fixedPointSetCalculator = PointSetPropertiesCalculatorType::New();
+  fixedPointSetCalculator->SetPointSet(fixedPointSet);
+  fixedPointSetCalculator->Compute();
+
+  PointSetPropertiesCalculatorType::Pointer movingPointSetCalculator = PointSetPropertiesCalculatorType::New();
+  movingPointSetCalculator->SetPointSet(movingPointSet);
+  movingPointSetCalculator->Compute();
+
+  const double scale = args::get(argScale) * movingPointSetCalculator->GetScale();
+
+  typedef itk::InitializeTransform<double> TransformInitializerType;
+  TransformInitializerType::Pointer transformInitializer = TransformInitializerType::New();
+  transformInitializer->SetMovingLandmark(movingPointSetCalculator->GetCenter());
+  transformInitializer->SetFixedLandmark(fixedPointSetCalculator->GetCenter());
+  transformInitializer->SetTypeOfTransform(TransformInitializerType::Transform::Similarity);
+  transformInitializer->Update();
+
+  //--------------------------------------------------------------------
+  // compare the kd-tree index of the fixed points with the ITK locator
+  {
+    itk::TimeProbe locatorProbe;
+    locatorProbe.Start();
+    PointsLocatorType::Pointer locator = PointsLocatorType::New();
+    locator->SetPoints(fixedPointSet->GetPoints());
+    locator->Initialize();
+    locatorProbe.Stop();
+
+    itk::TimeProbe indexProbe;
+    indexProbe.Start();
+    PointsIndexType::Pointer index = PointsIndexType::New();
+    index->SetHashPoints(false);
+    index->Build(fixedPointSet->GetPoints());
+    indexProbe.Stop();
+
+    const double radius = args::get(argRadius) * scale;
+    double locatorSearchTime, locatorClosestTime, indexSearchTime, indexClosestTime;
+    std::vector<PointsIndexType::NeighborsIdentifierType> locatorResult = benchmarkQueries(locator.GetPointer(), movingPointSet, radius, locatorSearchTime, locatorClosestTime);
+    std::vector<PointsIndexType::NeighborsIdentifierType> indexResult = benchmarkQueries(index.GetPointer(), movingPointSet, radius, indexSearchTime, indexClosestTime);
+
+    // the points found in the radius are compared as sets, the closest points are compared by the distance
+    size_t mismatches = 0;
+    for (size_t n = 0; n < locatorResult.size(); ++n) {
+      const double locatorDistance = movingPointSet->GetPoint(n).EuclideanDistanceTo(fixedPointSet->GetPoint(locatorResult[n].back()));
+      const double indexDistance = movingPointSet->GetPoint(n).EuclideanDistanceTo(fixedPointSet->GetPoint(indexResult[n].back()));
+      locatorResult[n].pop_back();
+      indexResult[n].pop_back();
+
+      std::sort(locatorResult[n].begin(), locatorResult[n].end());
+      std::sort(indexResult[n].begin(), indexResult[n].end());
+      mismatches += locatorResult[n] != indexResult[n] || locatorDistance != indexDistance;
+    }
+
+    std::cout << "locator, build time, search time, closest point time" << std::endl;
+    std::cout << locator->GetNameOfClass() << ", " << locatorProbe.GetTotal() << ", " << locatorSearchTime << ", " << locatorClosestTime << std::endl;
+    std::cout << index->GetNameOfClass() << ", " << indexProbe.GetTotal() << ", " << indexSearchTime << ", " << indexClosestTime << std::endl;
+    std::cout << "mismatched queries " << mismatches << std::endl;
+    std::cout << std::endl;
+  }
+
+  //--------------------------------------------------------------------
+  // compare single and double precision evaluations of the metrics
+  std::cout << "metric, double time, float time, speedup, relative value error, relative derivative error" << std::endl;
+
+  for (size_t typeOfMetric = 0; typeOfMetric < 3; ++typeOfMetric) {
+    BenchmarkResult results[2];
+    std::string name;
+
+    for (size_t precision = 0; precision < 2; ++precision) {
+      InitializeMetricType::Pointer metricInitializer = InitializeMetricType::New();
+      metricInitializer->SetTypeOfMetric(typeOfMetric);
+      metricInitializer->SetUseSinglePrecision(precision == 1);
+      try {
+        metricInitializer->Initialize();
+      }
+      catch (itk::ExceptionObject& excep) {
+        std::cerr << excep << std::endl;
+        return EXIT_FAILURE;
+      }
+
+      MetricType::Pointer metric = metricInitializer->GetMetric();
+      metric->SetFixedPointSet(fixedPointSet);
+      metric->SetMovingPointSet(movingPointSet);
+      metric->SetTransform(transformInitializer->GetTransform());
+      metric->SetScale(scale);
+      try {
+        metric->Initialize();
+      }
+      catch (itk::ExceptionObject& excep) {
+        std::cerr << excep << std::endl;
+        return EXIT_FAILURE;
+      }
+
+      name = metric->GetNameOfClass();
+      results[precision] = benchmarkMetric(metric, transformInitializer->GetTransform()->GetParameters(), numberOfEvaluations);
+    }
+
+    const double valueError = std::abs(results[1].value - results[0].value) / std::abs(results[0].value);
+    const double derivativeError = (results[1].derivative - results[0].derivative).two_norm() / results[0].derivative.two_norm();
+
+    std::cout << name << ", " << results[0].time << ", " << results[1].time << ", " << results[0].time / results[1].time << ", "
+      << valueError << ", " << derivativeError << std::endl;
+  }
+  std::cout << std::endl;
+
+  //--------------------------------------------------------------------
+  // compare the ordinary and the reproducible sums of the metrics, the reproducible results are compared
+  // bit for bit between one thread and all threads
+  const size_t numberOfThreads = scheduler.GetNumberOfThreads();
+  std::cout << "metric, ordinary time, reproducible time, overhead, mismatched values with one thread" << std::endl;
+
+  for (size_t typeOfMetric = 0; typeOfMetric < 3; ++typeOfMetric) {
+    BenchmarkResult results[3];
+    std::string name;
+
+    for (size_t mode = 0; mode < 3; ++mode) {
+      InitializeMetricType::Pointer metricInitializer = InitializeMetricType::New();
+      metricInitializer->SetTypeOfMetric(typeOfMetric);
+      try {
+        metricInitializer->Initialize();
+      }
+      catch (itk::ExceptionObject& excep) {
+        std::cerr << excep << std::endl;
+        return EXIT_FAILURE;
+      }
+
+      MetricType::Pointer metric = metricInitializer->GetMetric();
+      metric->SetFixedPointSet(fixedPointSet);
+      metric->SetMovingPointSet(movingPointSet);
+      metric->SetTransform(transformInitializer->GetTransform());
+      metric->SetScale(scale);
+      metric->SetUseReproducibleSum(mode > 0);
+      try {
+        metric->Initialize();
+      }
+      catch (itk::ExceptionObject& excep) {
+        std::cerr << excep << std::endl;
+        return EXIT_FAILURE;
+      }
+
+      scheduler.SetNumberOfThreads(mode == 2 ? 1 : numberOfThreads);
+      name = metric->GetNameOfClass();
+      results[mode] = benchmarkMetric(metric, transformInitializer->GetTransform()->GetParameters(), numberOfEvaluations);
+    }
+
+    scheduler.SetNumberOfThreads(numberOfThreads);
+
+    size_t mismatches = results[1].value != results[2].value;
+    for (size_t par = 0; par < results[1].derivative.size(); ++par) {
+      mismatches += results[1].derivative[par] != results[2].derivative[par];
+    }
+
+    std::cout << name << ", " << results[0].time << ", " << results[1].time << ", " << results[1].time / results[0].time - 1 << ", "
+      << mismatches << std::endl;
+  }
+
+  return EXIT_SUCCESS;
+}
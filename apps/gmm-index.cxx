@@ -0,0 +1,97 @@
+#include <itkMesh.h>
+#include <itkPointSet.h>
+#include <itkTimeProbe.h>
+
+#include "itkPointsKdTreeIndex.h"
+#include "itkTaskScheduler.h"
+
+#include "args.hxx"
+#include "itkIOutils.h"
+
+const unsigned int Dimension = 3;
+typedef itk::Mesh<float, Dimension> MeshType;
+typedef itk::PointSet<MeshType::PixelType, Dimension> PointSetType;
+typedef itk::PointsKdTreeIndex<PointSetType::PointsContainer> PointsIndexType;
+
+int main(int argc, char** argv) {
+
+  args::ArgumentParser parser("Application to prebuild the index of the fixed point set", "");
+  args::HelpFlag help(parser, "help", "Display this help menu", {'h', "help"});
+  args::Group allRequired(parser, "Required arguments:", args::Group::Validators::All);
+  args::ValueFlag<std::string> argInputFile(allRequired, "input", "The input mesh (point-set) file name", {'i', "input"});
+  args::ValueFlag<std::string> argOutputFile(allRequired, "output", "The output index file name", {'o', "output"});
+  args::ValueFlag<size_t> argLeafSize(parser, "leaf", "The maximal number of points in the leaves of the tree", {"leaf-size"}, 8);
+  args::ValueFlag<size_t> argNumberOfThreads(parser, "threads", "The number of threads building the tree (default: the number of cores)", {"threads"}, 0);
+
+  try {
+    parser.ParseCLI(argc, argv);
+  }
+  catch (args::Help) {
+    std::cout << parser;
+    return EXIT_SUCCESS;
+  }
+  catch (args::ParseError e) {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    return EXIT_FAILURE;
+  }
+  catch (args::ValidationError e) {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    return EXIT_FAILURE;
+  }
+
+  std::string inputFile = args::get(argInputFile);
+  std::string outputFile = args::get(argOutputFile);
+
+  itk::TaskScheduler::GetInstance().SetNumberOfThreads(args::get(argNumberOfThreads));
+
+  MeshType::Pointer mesh = MeshType::New();
+  if (!readMesh<MeshType>(mesh, inputFile)) {
+    return EXIT_FAILURE;
+  }
+
+  std::cout << "input mesh " << inputFile << std::endl;
+  std::cout << "number of points " << mesh->GetNumberOfPoints() << std::endl;
+  std::cout << std::endl;
+
+  //--------------------------------------------------------------------
+  // build and write the index
+  PointsIndexType::Pointer index = PointsIndexType::New();
+  index->SetLeafSize(args::get(argLeafSize));
+
+  itk::TimeProbe probe;
+  probe.Start();
+  index->Build(mesh->GetPoints());
+  probe.Stop();
+
+  try {
+    index->Write(outputFile);
+  }
+  catch (itk::ExceptionObject& excep) {
+    std::cerr << excep << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // check the written index
+  PointsIndexType::Pointer written = PointsIndexType::New();
+  try {
+    written->Read(outputFile);
+  }
+  catch (itk::ExceptionObject& excep) {
+    std::cerr << excep << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (!written->Matches(mesh->GetPoints())) {
+    std::cerr << "The written index does not match the points" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::cout << "output index " << outputFile << std::endl;
+  std::cout << "number of points " << written->GetNumberOfPoints() << std::endl;
+  std::cout << "hash             " << std::hex << written->GetHash() << std::dec << std::endl;
+  std::cout << "build time       " << probe.GetTotal() << " sec" << std::endl;
+
+  return EXIT_SUCCESS;
+}
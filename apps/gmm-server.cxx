@@ -0,0 +1,432 @@
+#include <itkMesh.h>
+#include <itkLBFGSOptimizer.h>
+#include <itkTimeProbe.h>
+#include <itkMultiThreader.h>
+
+#include "itkGMMPointSetToPointSetRegistrationMethod.h"
+#include "itkPointSetPropertiesCalculator.h"
+#include "itkInitializeTransform.h"
+#include "itkInitializeMetric.h"
+#include "itkPointSetToPointSetMetrics.h"
+#include "itkPointsKdTreeIndex.h"
+#include "itkTaskScheduler.h"
+
+#include "itkIOutils.h"
+#include "argsCustomParsers.h"
+
+#include <cctype>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+const unsigned int Dimension = 3;
+typedef itk::Mesh<float, Dimension> MeshType;
+typedef itk::PointSet<MeshType::PixelType, Dimension> PointSetType;
+typedef itk::Transform <double, Dimension, Dimension> TransformType;
+typedef itk::PointSetPropertiesCalculator<PointSetType> PointSetPropertiesCalculatorType;
+typedef itk::PointsKdTreeIndex<PointSetType::PointsContainer> PointsIndexType;
+
+const std::string protocolDescription =
+  "The requests are read from stdin line by line, the responses are written to stdout:\n"
+  "  model <name> <mesh> [<index>]\n"
+  "    load the fixed model and its prebuilt index, the index is built if it is not given\n"
+  "    response: model <name> ok points=<n> | model <name> error <message>\n"
+  "  register <id> <model> <mesh>|inline:<n> [key=value ...]\n"
+  "    register the moving point set read from the mesh file or from the next n lines 'x y z'\n"
+  "    keys: transform, metric, iterations, scale (comma separated, in units of RMS radius),\n"
+  "          adaptive, relative-error, tree, float\n"
+  "    response: result <id> ok time=<sec> transform=<name> parameters=<p,...> value=<v>\n"
+  "              mean=<d> rmse=<d> quantile=<d> maximal=<d> | result <id> error <message>\n"
+  "  quit\n"
+  "The registrations run concurrently, the responses are written in the order of completion.\n";
+
+/** The fixed model resident in the server. */
+struct Model
+{
+  PointSetType::Pointer pointSet;
+  PointSetPropertiesCalculatorType::Pointer calculator;
+  PointsIndexType::Pointer index;
+};
+
+/** The registration request. */
+struct Request
+{
+  std::string id;
+  std::shared_ptr<const Model> model;
+  PointSetType::Pointer movingPointSet;
+  std::map<std::string, std::string> options;
+};
+
+/** Writes the responses, one line each, from the concurrent workers. */
+class ResponseWriter
+{
+public:
+  void Write(const std::string & response)
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    std::cout << response << std::endl;
+  }
+
+private:
+  std::mutex m_Mutex;
+};
+
+/** Replace the line breaks of the message to keep the framing. */
+std::string SingleLine(std::string message)
+{
+  for (size_t n = 0; n < message.size(); ++n) {
+    if (message[n] == '\n' || message[n] == '\r') {
+      message[n] = ' ';
+    }
+  }
+  return message;
+}
+
+template <typename T>
+T GetOption(const Request & request, const std::string & key, const T & value)
+{
+  std::map<std::string, std::string>::const_iterator it = request.options.find(key);
+  if (it == request.options.end()) {
+    return value;
+  }
+
+  std::istringstream stream(it->second);
+  T result = value;
+  if (!(stream >> result)) {
+    throw std::invalid_argument("invalid value of the option " + key);
+  }
+  return result;
+}
+
+/** Register the moving point set to the fixed model with the options of the request. */
+std::string Register(const Request & request)
+{
+  itk::TimeProbe probe;
+  probe.Start();
+
+  const Model & model = *request.model;
+  PointSetType::Pointer movingPointSet = request.movingPointSet;
+
+  PointSetPropertiesCalculatorType::Pointer movingPointSetCalculator = PointSetPropertiesCalculatorType::New();
+  movingPointSetCalculator->SetPointSet(movingPointSet);
+  movingPointSetCalculator->Compute();
+
+  itk::Array<double> scale;
+  if (request.options.count("scale")) {
+    std::vector<double> values;
+    std::istringstream stream(request.options.at("scale"));
+    std::string value;
+    while (std::getline(stream, value, ',')) {
+      values.push_back(std::stod(value) * movingPointSetCalculator->GetScale());
+    }
+    scale.set_size(values.size());
+    for (size_t n = 0; n < values.size(); ++n) {
+      scale[n] = values[n];
+    }
+  }
+  else {
+    scale = movingPointSetCalculator->GetScalePyramid();
+  }
+
+  const double radius = std::max(model.calculator->GetRadius(), movingPointSetCalculator->GetRadius());
+  const double spacing = std::max(model.calculator->GetSpacing(), movingPointSetCalculator->GetSpacing());
+
+  // initialize transform
+  typedef itk::VersorRigid3DTransform<double> InitialTransformType;
+  InitialTransformType::Pointer fixedInitialTransform = InitialTransformType::New();
+  fixedInitialTransform->SetCenter(model.calculator->GetCenter());
+  fixedInitialTransform->SetIdentity();
+
+  InitialTransformType::Pointer movingInitialTransform = InitialTransformType::New();
+  movingInitialTransform->SetCenter(movingPointSetCalculator->GetCenter());
+  movingInitialTransform->SetIdentity();
+
+  typedef itk::InitializeTransform<double> TransformInitializerType;
+  TransformInitializerType::Pointer transformInitializer = TransformInitializerType::New();
+  transformInitializer->SetMovingLandmark(movingPointSetCalculator->GetCenter());
+  transformInitializer->SetFixedLandmark(model.calculator->GetCenter());
+  transformInitializer->SetTypeOfTransform(GetOption<size_t>(request, "transform", 0));
+  transformInitializer->Update();
+  TransformType::Pointer transform = transformInitializer->GetTransform();
+
+  // initialize optimizer
+  typedef itk::LBFGSOptimizer OptimizerType;
+  OptimizerType::Pointer optimizer = OptimizerType::New();
+  optimizer->SetMaximumNumberOfFunctionEvaluations(GetOption<size_t>(request, "iterations", 1000));
+  optimizer->SetScales(transformInitializer->GetScales());
+  optimizer->MinimizeOn();
+
+  // metric
+  typedef itk::InitializeMetric<PointSetType, PointSetType> InitializeMetricType;
+  InitializeMetricType::Pointer metricInitializer = InitializeMetricType::New();
+  metricInitializer->SetTypeOfMetric(GetOption<size_t>(request, "metric", 0));
+  metricInitializer->SetUseSinglePrecision(GetOption<bool>(request, "float", false));
+  metricInitializer->Initialize();
+  metricInitializer->GetMetric()->SetRadius(radius);
+  metricInitializer->GetMetric()->SetRelativeError(GetOption<double>(request, "relative-error", 0));
+  metricInitializer->GetMetric()->SetUseGaussianSumTree(GetOption<bool>(request, "tree", false));
+  metricInitializer->GetMetric()->SetFixedPointsIndex(model.index);
+  metricInitializer->GetMetric()->SetPointSpacing(spacing);
+
+  // perform registration
+  typedef itk::GMMPointSetToPointSetRegistrationMethod<PointSetType, PointSetType> RegistrationType;
+  RegistrationType::Pointer registration = RegistrationType::New();
+  registration->SetFixedPointSet(model.pointSet);
+  registration->SetFixedInitialTransform(fixedInitialTransform);
+  registration->SetMovingPointSet(movingPointSet);
+  registration->SetMovingInitialTransform(movingInitialTransform);
+  registration->SetScale(scale);
+  registration->SetUseAdaptiveScale(GetOption<bool>(request, "adaptive", false));
+  registration->SetMinimalScale(spacing);
+  registration->SetOptimizer(optimizer);
+  registration->SetMetric(metricInitializer->GetMetric());
+  registration->SetTransform(transform);
+  registration->Update();
+
+  // metrics of the transformed moving points
+  PointSetType::PointsContainer::Pointer points = PointSetType::PointsContainer::New();
+  points->resize(movingPointSet->GetNumberOfPoints());
+  for (PointSetType::PointsContainer::ConstIterator it = movingPointSet->GetPoints()->Begin(); it != movingPointSet->GetPoints()->End(); ++it) {
+    points->SetElement(it.Index(), transform->TransformPoint(it.Value()));
+  }
+
+  PointSetType::Pointer outputPointSet = PointSetType::New();
+  outputPointSet->SetPoints(points);
+
+  typedef itk::PointSetToPointSetMetrics<PointSetType, PointSetType> PointSetToPointSetMetricsType;
+  PointSetToPointSetMetricsType::Pointer metrics = PointSetToPointSetMetricsType::New();
+  metrics->SetFixedPointsIndex(model.index);
+  metrics->SetFixedPointSet(model.pointSet);
+  metrics->SetMovingPointSet(outputPointSet);
+  metrics->Compute();
+
+  probe.Stop();
+
+  const RegistrationType::MetricValuesType & values = registration->GetFinalMetricValues();
+  const TransformType::ParametersType & parameters = transform->GetParameters();
+
+  std::ostringstream response;
+  response.precision(10);
+  response << "result " << request.id << " ok";
+  response << " time=" << probe.GetTotal();
+  response << " transform=" << transform->GetNameOfClass();
+  response << " parameters=";
+  for (size_t n = 0; n < parameters.size(); ++n) {
+    response << (n > 0 ? "," : "") << parameters[n];
+  }
+  response << " value=" << (values.size() > 0 ? values[values.size() - 1] : 0);
+  response << " mean=" << metrics->GetMeanValue();
+  response << " rmse=" << metrics->GetRMSEValue();
+  response << " quantile=" << metrics->GetQuantileValue();
+  response << " maximal=" << metrics->GetMaximalValue();
+
+  return response.str();
+}
+
+/** Load the fixed model, the index is read from the file or built. */
+std::shared_ptr<Model> LoadModel(const std::string & meshFileName, const std::string & indexFileName)
+{
+  MeshType::Pointer mesh = MeshType::New();
+  if (!readMesh<MeshType>(mesh, meshFileName)) {
+    throw std::runtime_error("unable to read mesh from the file " + meshFileName);
+  }
+
+  std::shared_ptr<Model> model = std::make_shared<Model>();
+  model->pointSet = PointSetType::New();
+  model->pointSet->SetPoints(mesh->GetPoints());
+
+  model->calculator = PointSetPropertiesCalculatorType::New();
+  model->calculator->SetPointSet(model->pointSet);
+  model->calculator->Compute();
+
+  model->index = PointsIndexType::New();
+  if (indexFileName.empty()) {
+    model->index->Build(model->pointSet->GetPoints());
+  }
+  else {
+    model->index->Read(indexFileName);
+    if (!model->index->Matches(model->pointSet->GetPoints())) {
+      throw std::runtime_error("the index " + indexFileName + " does not match the mesh");
+    }
+  }
+
+  return model;
+}
+
+int main(int argc, char** argv) {
+  args::ArgumentParser parser("GMM PointSet Registration server", protocolDescription);
+  args::HelpFlag help(parser, "help", "Display this help menu", {'h', "help"});
+  args::ValueFlag<size_t> argNumberOfThreads(parser, "threads", "The number of threads running the registrations (default: the number of cores)", {"threads"});
+
+  try {
+    parser.ParseCLI(argc, argv);
+  }
+  catch (args::Help) {
+    std::cout << parser;
+    return EXIT_SUCCESS;
+  }
+  catch (args::ParseError e) {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    return EXIT_FAILURE;
+  }
+  catch (args::ValidationError e) {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    return EXIT_FAILURE;
+  }
+
+  size_t numberOfThreads = std::max(std::thread::hardware_concurrency(), 1u);
+  if (argNumberOfThreads) {
+    numberOfThreads = std::max(args::get(argNumberOfThreads), size_t(1));
+  }
+
+  // the registrations and their parallel loops are the tasks of the same scheduler, the main thread reads
+  // the requests, so it is not counted
+  itk::TaskScheduler::GetInstance().SetNumberOfThreads(numberOfThreads + 1);
+
+  // the registrations run concurrently, so the ITK filters of each registration use a single thread
+  itk::MultiThreader::SetGlobalDefaultNumberOfThreads(1);
+
+  ResponseWriter writer;
+  std::map<std::string, std::shared_ptr<const Model> > models;
+
+  itk::TaskScheduler::TaskGroup registrations;
+
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    std::istringstream stream(line);
+    std::string command;
+
+    if (!(stream >> command)) {
+      continue;
+    }
+
+    if (command == "quit") {
+      break;
+    }
+
+    if (command == "model") {
+      std::string name, meshFileName, indexFileName;
+      stream >> name >> meshFileName >> indexFileName;
+
+      try {
+        std::shared_ptr<Model> model = LoadModel(meshFileName, indexFileName);
+        models[name] = model;
+        writer.Write("model " + name + " ok points=" + std::to_string(model->pointSet->GetNumberOfPoints()));
+      }
+      catch (itk::ExceptionObject & excep) {
+        writer.Write("model " + name + " error " + SingleLine(excep.GetDescription()));
+      }
+      catch (std::exception & excep) {
+        writer.Write("model " + name + " error " + SingleLine(excep.what()));
+      }
+      continue;
+    }
+
+    if (command == "register") {
+      Request request;
+      std::string name, moving;
+      stream >> request.id >> name >> moving;
+
+      std::string option;
+      while (stream >> option) {
+        const size_t position = option.find('=');
+        request.options[option.substr(0, position)] = position == std::string::npos ? "1" : option.substr(position + 1);
+      }
+
+      // the inline points are read even if the request is rejected to keep the framing
+      request.movingPointSet = PointSetType::New();
+      std::string error;
+
+      if (moving.compare(0, 7, "inline:") == 0) {
+        char * end = ITK_NULLPTR;
+        size_t numberOfPoints = std::strtoul(moving.c_str() + 7, &end, 10);
+
+        // the framing of the following lines is unknown, so none of them is read
+        if (!std::isdigit(static_cast<unsigned char>(moving.c_str()[7])) || *end != '\0') {
+          error = "invalid number of the inline points " + moving.substr(7);
+          numberOfPoints = 0;
+        }
+
+        // the container grows with the points read, so a wrong count does not allocate the memory
+        PointSetType::PointsContainer::Pointer points = PointSetType::PointsContainer::New();
+
+        size_t n = 0;
+        for (; n < numberOfPoints && std::getline(std::cin, line); ++n) {
+          std::istringstream pointStream(line);
+          PointSetType::PointType point;
+          point.Fill(0);
+
+          // each coordinate is checked, the trailing characters are not allowed
+          for (unsigned int dim = 0; dim < PointSetType::PointDimension; ++dim) {
+            if (!(pointStream >> point[dim])) {
+              break;
+            }
+          }
+
+          std::string rest;
+          if ((pointStream.fail() || pointStream >> rest) && error.empty()) {
+            error = "invalid point at the line " + std::to_string(n + 1);
+          }
+          points->InsertElement(n, point);
+        }
+
+        if (n < numberOfPoints && error.empty()) {
+          error = "the input ended after " + std::to_string(n) + " of " + std::to_string(numberOfPoints) + " points";
+        }
+        request.movingPointSet->SetPoints(points);
+      }
+      else {
+        MeshType::Pointer mesh = MeshType::New();
+        if (readMesh<MeshType>(mesh, moving)) {
+          request.movingPointSet->SetPoints(mesh->GetPoints());
+        }
+        else {
+          error = "unable to read mesh from the file " + moving;
+        }
+      }
+
+      if (error.empty()) {
+        if (models.count(name) == 0) {
+          error = "unknown model " + name;
+        }
+        else if (request.movingPointSet->GetNumberOfPoints() == 0) {
+          error = "the moving point set is empty";
+        }
+      }
+
+      if (!error.empty()) {
+        writer.Write("result " + request.id + " error " + error);
+        continue;
+      }
+
+      request.model = models[name];
+
+      registrations.Run([request, &writer]() {
+        std::string response;
+        try {
+          response = Register(request);
+        }
+        catch (itk::ExceptionObject & excep) {
+          response = "result " + request.id + " error " + SingleLine(excep.GetDescription());
+        }
+        catch (std::exception & excep) {
+          response = "result " + request.id + " error " + SingleLine(excep.what());
+        }
+
+        writer.Write(response);
+      });
+      continue;
+    }
+
+    writer.Write("error unknown command " + command);
+  }
+
+  // complete the queued registrations
+  registrations.Wait();
+
+  return EXIT_SUCCESS;
+}
@@ -1,22 +1,68 @@
 ﻿#include <itkMesh.h>
 #include <itkTransformMeshFilter.h>
+#include <itkMeshIOFactory.h>
 #include <itkLBFGSOptimizer.h>
+#include "itkStochasticGradientDescentOptimizer.h"
 
 #include "itkGMMPointSetToPointSetRegistrationMethod.h"
 #include "itkPointSetPropertiesCalculator.h"
 #include "itkInitializeTransform.h"
 #include "itkInitializeMetric.h"
 #include "itkPointSetToPointSetMetrics.h"
+#include "itkTaskScheduler.h"
 
 #include "itkIOutils.h"
 #include "argsCustomParsers.h"
 
+#include <future>
+
 const unsigned int Dimension = 3;
 typedef itk::Mesh<float, Dimension> FixedMeshType;
 typedef itk::PointSet<FixedMeshType::PixelType, Dimension> FixedPointSetType;
 typedef itk::Mesh<float, Dimension> MovingMeshType;
 typedef itk::PointSet<MovingMeshType::PixelType, Dimension> MovingPointSetType;
 typedef itk::Transform <double, Dimension, Dimension> TransformType;
+typedef itk::PointsKdTreeIndex<FixedPointSetType::PointsContainer> FixedPointsIndexType;
+
+//! The mesh read by the pipeline, its point set and the properties of the points
+template <typename TMesh, typename TPointSet>
+struct InputData
+{
+  typedef itk::PointSetPropertiesCalculator<TPointSet> CalculatorType;
+
+  bool valid;
+  typename TMesh::Pointer mesh;
+  typename TPointSet::Pointer pointSet;
+  typename CalculatorType::Pointer calculator;
+  FixedPointsIndexType::Pointer index;
+};
+
+//! Reads the mesh and computes the properties of the points, the index of the points is built on request
+template <typename TMesh, typename TPointSet>
+InputData<TMesh, TPointSet> readInput(const std::string & fileName, const bool & buildIndex)
+{
+  InputData<TMesh, TPointSet> input;
+  input.mesh = TMesh::New();
+  input.valid = readMesh<TMesh>(input.mesh, fileName);
+
+  if (!input.valid) {
+    return input;
+  }
+
+  input.pointSet = TPointSet::New();
+  input.pointSet->SetPoints(input.mesh->GetPoints());
+
+  input.calculator = InputData<TMesh, TPointSet>::CalculatorType::New();
+  input.calculator->SetPointSet(input.pointSet);
+  input.calculator->Compute();
+
+  if (buildIndex) {
+    input.index = FixedPointsIndexType::New();
+    input.index->Build(input.pointSet->GetPoints());
+  }
+
+  return input;
+}
 
 int main(int argc, char** argv) {
 
@@ -29,19 +75,48 @@ int main(int argc, char** argv) {
   args::ValueFlag<std::string> argFixedFileName(allRequired, "fixed", "The fixed mesh (point-set) filename", {'f', "fixed"});
   args::ValueFlag<std::string> argMovingFileName(allRequired, "moving", "The moving mesh (point-set) filename", {'m', "moving"});
   args::ValueFlag<std::string> argOutputFileName(parser, "output", "The output mesh (point-set) filename", {'o', "output"});
-
-  args::ValueFlag<std::vector<double>, args::DoubleVectorReader> argScale(allRequired, "scale", "The scale levels", {"scale"});
+  args::ValueFlag<std::string> argFixedIndexFileName(parser, "index", "The prebuilt index of the fixed point set (see gmm-index)", {"fixed-index"});
+
+  args::ValueFlag<std::vector<double>, args::DoubleVectorReader> argScale(parser, "scale", "The scale levels in units of the RMS radius (default: proposed from the nearest neighbour spacing)", {"scale"});
+  args::ValueFlag<double> argRadius(parser, "radius", "The truncation radius in units of scale (default: proposed from the nearest neighbour spacing)", {"radius"});
+  args::ValueFlag<double> argRelativeError(parser, "error", "The target relative error of the truncated kernel sums to derive the radius at each level", {"relative-error"}, 0);
+  args::Flag argGaussianSumTree(parser, "tree", "Approximate the kernel sums by the Gaussian sum trees instead of the truncated sums", {"gaussian-sum-tree"});
+  args::ValueFlag<double> argGaussianSumTreeError(parser, "error", "The target relative error of the kernel sums approximated by the trees", {"tree-error"}, 1.0e-03);
+  args::Flag argNeighborLists(parser, "lists", "Reuse the lists of the fixed points near each moving point between the optimizer evaluations", {"neighbor-lists"});
+  args::ValueFlag<double> argNeighborListSkin(parser, "skin", "The skin of the neighbour lists in units of scale", {"skin"}, 1);
+  args::Flag argReproducible(parser, "reproducible", "Sum the metric over the blocks of points in the fixed order, so the results do not depend on the number of threads", {"reproducible"});
   args::ValueFlag<size_t> argNumberOfIterations(parser, "iterations", "The number of iterations", {"iterations"}, 1000);
+  args::ValueFlag<size_t> argNumberOfThreads(parser, "threads", "The number of threads of the metric evaluations and the preprocessing (default: the number of cores)", {"threads"}, 0);
   args::Flag trace(parser, "trace", "Optimizer iterations tracing", {"trace"});
 
+  args::Flag argAdaptive(parser, "adaptive", "Adaptive scale schedule from the first scale down to the point spacing", {"adaptive"});
+  args::ValueFlag<double> argScaleFactor(parser, "factor", "The factor to shrink scale in the adaptive schedule", {"scale-factor"}, 0.5);
+  args::ValueFlag<double> argLevelSkipTolerance(parser, "tolerance", "The relative change of the parameters at a level below which the next level of the adaptive schedule is skipped", {"level-skip-tolerance"}, 1.0e-03);
+  args::ValueFlag<double> argValueTolerance(parser, "tolerance", "The relative tolerance of the metric value changes to stop a level (0: not checked)", {"value-tolerance"}, 0);
+  args::ValueFlag<double> argParametersTolerance(parser, "tolerance", "The relative tolerance of the parameters changes to stop a level (0: not checked)", {"parameters-tolerance"}, 0);
+  args::Flag argProgressive(parser, "progressive", "Start each level with the approximate metric evaluations, then refine with the exact ones", {"progressive"});
+  args::ValueFlag<double> argApproximationTolerance(parser, "tolerance", "The relative tolerance of the changes to stop the approximate evaluations", {"approximation-tolerance"}, 1.0e-03);
+  args::ValueFlag<double> argApproximationFraction(parser, "fraction", "The fraction of the moving points in the approximate evaluations", {"approximation-fraction"}, 0.25);
+  args::ValueFlag<double> argApproximationError(parser, "error", "The relative truncation error of the kernel sums in the approximate evaluations", {"approximation-error"}, 1.0e-02);
+  args::Flag argMortonOrder(parser, "morton", "Reorder the points along the Morton curve for the locality of the metric evaluations", {"morton"});
+  args::Flag argCrop(parser, "crop", "Crop the fixed point set at each level to the region of overlap with the transformed moving point set", {"crop"});
+  args::ValueFlag<double> argCroppingMargin(parser, "margin", "The margin of the cropping region added to the search radius in units of scale", {"crop-margin"}, 1);
+  args::Flag argReduce(parser, "reduce", "Reduce the fixed point set at each level to the weighted centroids of the points in the voxels", {"reduce"});
+  args::ValueFlag<double> argReductionFactor(parser, "reduction-factor", "The size of the voxels of the reduction in units of scale", {"reduction-factor"}, 0.25);
+
   const std::string transformDescription =
     "The type of transform (That is number):\n"
     "  0 : Translation\n"
     "  1 : Versor3D\n"
     "  2 : Similarity\n"
-    "  3 : ScaleSkewVersor3D\n";
+    "  3 : ScaleSkewVersor3D\n"
+    "  4 : ThinPlateSpline (requires control points)\n"
+    "  5 : GaussianRBF (requires control points)\n";
 
   args::ValueFlag<size_t> argTypeOfTransform(parser, "transform", transformDescription, {'t', "transform"}, 0);
+  args::ValueFlag<std::string> argControlPointsFileName(parser, "points", "The text file with the control points of the deformable transforms, one point per line", {"control-points"});
+  args::ValueFlag<double> argRBFScale(parser, "beta", "The width of the Gaussian radial basis functions", {"rbf-scale"}, 1);
+  args::ValueFlag<double> argRegularization(parser, "lambda", "The weight of the bending energy of the deformable transforms", {"lambda"}, 0);
   
   const std::string metricDescription =
     "The type of metric (That is number):\n"
@@ -50,6 +125,18 @@ int main(int argc, char** argv) {
     "  2 : KC\n";
 
   args::ValueFlag<size_t> argTypeOfMetric(parser, "metric", metricDescription, {'M', "metric"}, 0);
+  args::Flag argSinglePrecision(parser, "float", "Evaluate kernels of the metric in single precision", {"float"});
+
+  const std::string optimizerDescription =
+    "The type of optimizer (That is number):\n"
+    "  0 : LBFGS\n"
+    "  1 : Stochastic gradient descent\n";
+
+  args::ValueFlag<size_t> argTypeOfOptimizer(parser, "optimizer", optimizerDescription, {"optimizer"}, 0);
+  args::ValueFlag<double> argStepLength(parser, "length", "The first step length of the stochastic gradient descent in units of scale", {"step-length"}, 1);
+  args::ValueFlag<size_t> argMiniBatchSize(parser, "size", "The initial number of the random moving points per evaluation (0: all points)", {"mini-batch"}, 0);
+  args::ValueFlag<double> argMiniBatchGrowth(parser, "factor", "The factor to increase the number of the random moving points after each evaluation", {"mini-batch-growth"}, 1.05);
+  args::ValueFlag<unsigned int> argSeed(parser, "seed", "The seed of the random generator", {"seed"}, 0);
 
   try {
     parser.ParseCLI(argc, argv);
@@ -69,59 +156,114 @@ int main(int argc, char** argv) {
     return EXIT_FAILURE;
   }
 
+  if (argFixedIndexFileName && (argCrop || argReduce)) {
+    std::cerr << "The prebuilt index of the fixed points covers the whole set, it cannot be used with --crop or --reduce" << std::endl;
+    return EXIT_FAILURE;
+  }
+
   std::string fixedFileName = args::get(argFixedFileName);
   std::string movingFileName = args::get(argMovingFileName);
   size_t numberOfIterations = args::get(argNumberOfIterations);
   size_t typeOfTransform = args::get(argTypeOfTransform);
   size_t typeOfMetric = args::get(argTypeOfMetric);
 
+  // the library submits all parallel work to the shared scheduler
+  itk::TaskScheduler::GetInstance().SetNumberOfThreads(args::get(argNumberOfThreads));
+
   std::cout << "options" << std::endl;
   std::cout << "number of iterations " << numberOfIterations << std::endl;
+  std::cout << "number of threads " << itk::TaskScheduler::GetInstance().GetNumberOfThreads() << std::endl;
   std::cout << std::endl;
 
   //--------------------------------------------------------------------
-  // read meshes
-  FixedMeshType::Pointer fixedMesh = FixedMeshType::New();
-  if (!readMesh<FixedMeshType>(fixedMesh, fixedFileName)) {
+  // read meshes, the fixed and the moving inputs are read and preprocessed concurrently. The index of
+  // the fixed points is built while the moving mesh is read, unless it is read from the file or the
+  // registration reorders, reduces or crops the fixed points, which the index would not match. The readers
+  // block on the files, so they run on their own threads and submit the preprocessing to the scheduler.
+  const bool buildFixedIndex = !argFixedIndexFileName && !argMortonOrder && !argCrop && !argReduce;
+
+  // the mesh IO factories are registered in the main thread before the concurrent readers query them
+  itk::MeshIOFactory::CreateMeshIO(fixedFileName.c_str(), itk::MeshIOFactory::ReadMode);
+
+  std::future< InputData<FixedMeshType, FixedPointSetType> > fixedTask =
+    std::async(std::launch::async, readInput<FixedMeshType, FixedPointSetType>, fixedFileName, buildFixedIndex);
+  std::future< InputData<MovingMeshType, MovingPointSetType> > movingTask =
+    std::async(std::launch::async, readInput<MovingMeshType, MovingPointSetType>, movingFileName, false);
+
+  // read the prebuilt index of the fixed points
+  FixedPointsIndexType::Pointer fixedPointsIndex;
+  std::future<void> indexTask;
+
+  if (argFixedIndexFileName) {
+    fixedPointsIndex = FixedPointsIndexType::New();
+    indexTask = std::async(std::launch::async, [&fixedPointsIndex, &argFixedIndexFileName]() { fixedPointsIndex->Read(args::get(argFixedIndexFileName)); });
+  }
+
+  InputData<FixedMeshType, FixedPointSetType> fixedInput;
+  InputData<MovingMeshType, MovingPointSetType> movingInput;
+  try {
+    fixedInput = fixedTask.get();
+    movingInput = movingTask.get();
+    if (indexTask.valid()) {
+      indexTask.get();
+    }
+  }
+  catch (itk::ExceptionObject& excep) {
+    std::cerr << excep << std::endl;
     return EXIT_FAILURE;
   }
 
+  if (!fixedInput.valid || !movingInput.valid) {
+    return EXIT_FAILURE;
+  }
+
+  FixedMeshType::Pointer fixedMesh = fixedInput.mesh;
+  FixedPointSetType::Pointer fixedPointSet = fixedInput.pointSet;
+
   std::cout << fixedFileName << std::endl;
   std::cout << "number of points " << fixedMesh->GetNumberOfPoints() << std::endl;
   std::cout << std::endl;
 
-  MovingMeshType::Pointer movingMesh = MovingMeshType::New();
-  if (!readMesh<MovingMeshType>(movingMesh, movingFileName)) {
-    return EXIT_FAILURE;
-  }
+  MovingMeshType::Pointer movingMesh = movingInput.mesh;
+  MovingPointSetType::Pointer movingPointSet = movingInput.pointSet;
 
   std::cout << movingFileName << std::endl;
   std::cout << "number of points " << movingMesh->GetNumberOfPoints() << std::endl;
   std::cout << std::endl;
 
-  FixedPointSetType::Pointer fixedPointSet = FixedPointSetType::New();
-  fixedPointSet->SetPoints(fixedMesh->GetPoints());
+  if (buildFixedIndex) {
+    fixedPointsIndex = fixedInput.index;
+  }
 
-  MovingPointSetType::Pointer movingPointSet = MovingPointSetType::New();
-  movingPointSet->SetPoints(movingMesh->GetPoints());
+  if (argFixedIndexFileName) {
+    std::cout << "index " << args::get(argFixedIndexFileName) << std::endl;
+    std::cout << "matches the fixed point set " << fixedPointsIndex->Matches(fixedPointSet->GetPoints()) << std::endl;
+    std::cout << std::endl;
+  }
 
   //--------------------------------------------------------------------
   // initialize scales
-  typedef itk::PointSetPropertiesCalculator<FixedPointSetType> FixedPointSetPropertiesCalculatorType;
-  FixedPointSetPropertiesCalculatorType::Pointer fixedPointSetCalculator = FixedPointSetPropertiesCalculatorType::New();
-  fixedPointSetCalculator->SetPointSet(fixedPointSet);
-  fixedPointSetCalculator->Compute();
+  InputData<FixedMeshType, FixedPointSetType>::CalculatorType::Pointer fixedPointSetCalculator = fixedInput.calculator;
   fixedPointSetCalculator->PrintReport(std::cout);
 
-  typedef itk::PointSetPropertiesCalculator<MovingPointSetType> MovingPointSetPropertiesCalculatorType;
-  MovingPointSetPropertiesCalculatorType::Pointer movingPointSetCalculator = MovingPointSetPropertiesCalculatorType::New();
-  movingPointSetCalculator->SetPointSet(movingPointSet);
-  movingPointSetCalculator->Compute();
+  InputData<MovingMeshType, MovingPointSetType>::CalculatorType::Pointer movingPointSetCalculator = movingInput.calculator;
   movingPointSetCalculator->PrintReport(std::cout);
 
-  itk::Array<double> scale(args::get(argScale).size());
-  for (size_t n = 0; n < scale.size(); ++n) {
-    scale[n] = args::get(argScale)[n] * movingPointSetCalculator->GetScale();
+  itk::Array<double> scale;
+
+  if (argScale) {
+    scale.set_size(args::get(argScale).size());
+    for (size_t n = 0; n < scale.size(); ++n) {
+      scale[n] = args::get(argScale)[n] * movingPointSetCalculator->GetScale();
+    }
+  }
+  else {
+    scale = movingPointSetCalculator->GetScalePyramid();
+  }
+
+  double radius = std::max(fixedPointSetCalculator->GetRadius(), movingPointSetCalculator->GetRadius());
+  if (argRadius) {
+    radius = args::get(argRadius);
   }
 
   // initialize transform
@@ -139,26 +281,62 @@ int main(int argc, char** argv) {
   transformInitializer->SetMovingLandmark(movingPointSetCalculator->GetCenter());
   transformInitializer->SetFixedLandmark(fixedPointSetCalculator->GetCenter());
   transformInitializer->SetTypeOfTransform(typeOfTransform);
-  transformInitializer->Update();
+
+  if (argControlPointsFileName) {
+    TransformInitializerType::ControlPointsType controlPoints;
+    if (!readPoints(controlPoints, args::get(argControlPointsFileName))) {
+      return EXIT_FAILURE;
+    }
+
+    std::cout << args::get(argControlPointsFileName) << std::endl;
+    std::cout << "number of control points " << controlPoints.size() << std::endl;
+    std::cout << std::endl;
+
+    transformInitializer->SetControlPoints(controlPoints);
+    transformInitializer->SetGaussianRBFScale(args::get(argRBFScale));
+    transformInitializer->SetRegularization(args::get(argRegularization));
+  }
+
+  try {
+    transformInitializer->Update();
+  }
+  catch (itk::ExceptionObject& excep) {
+    std::cerr << excep << std::endl;
+    return EXIT_FAILURE;
+  }
   transformInitializer->PrintReport();
   TransformType::Pointer transform = transformInitializer->GetTransform();
   std::cout << " fixed " << fixedPointSetCalculator->GetCenter() << std::endl;
   std::cout << "moving " << movingPointSetCalculator->GetCenter() << std::endl;
   std::cout << " scale " << scale << std::endl;
+  std::cout << "radius " << radius << std::endl;
   //--------------------------------------------------------------------
   // initialize optimizer
-  typedef itk::LBFGSOptimizer OptimizerType;
-  OptimizerType::Pointer optimizer = OptimizerType::New();
-  optimizer->SetMaximumNumberOfFunctionEvaluations(numberOfIterations);
-  optimizer->SetScales(transformInitializer->GetScales());
-  optimizer->SetTrace(trace);
-  optimizer->MinimizeOn();
+  itk::SingleValuedNonLinearOptimizer::Pointer optimizer;
+
+  if (args::get(argTypeOfOptimizer) == 1) {
+    typedef itk::StochasticGradientDescentOptimizer StochasticOptimizerType;
+    StochasticOptimizerType::Pointer stochasticOptimizer = StochasticOptimizerType::New();
+    stochasticOptimizer->SetNumberOfIterations(numberOfIterations);
+    stochasticOptimizer->SetScales(transformInitializer->GetScales());
+    optimizer = stochasticOptimizer;
+  }
+  else {
+    typedef itk::LBFGSOptimizer OptimizerType;
+    OptimizerType::Pointer lbfgsOptimizer = OptimizerType::New();
+    lbfgsOptimizer->SetMaximumNumberOfFunctionEvaluations(numberOfIterations);
+    lbfgsOptimizer->SetScales(transformInitializer->GetScales());
+    lbfgsOptimizer->SetTrace(trace);
+    lbfgsOptimizer->MinimizeOn();
+    optimizer = lbfgsOptimizer;
+  }
 
   //--------------------------------------------------------------------
   // metric
   typedef itk::InitializeMetric<FixedPointSetType, MovingPointSetType> InitializeMetricType;
   InitializeMetricType::Pointer metricInitializer = InitializeMetricType::New();
   metricInitializer->SetTypeOfMetric(typeOfMetric);
+  metricInitializer->SetUseSinglePrecision(argSinglePrecision);
   try {
     metricInitializer->Initialize();
   }
@@ -166,6 +344,21 @@ int main(int argc, char** argv) {
     std::cerr << excep << std::endl;
     return EXIT_FAILURE;
   }
+  metricInitializer->GetMetric()->SetRadius(radius);
+  metricInitializer->GetMetric()->SetRelativeError(args::get(argRelativeError));
+  metricInitializer->GetMetric()->SetUseGaussianSumTree(argGaussianSumTree);
+  metricInitializer->GetMetric()->SetGaussianSumTreeError(args::get(argGaussianSumTreeError));
+  metricInitializer->GetMetric()->SetFixedPointsIndex(fixedPointsIndex);
+  metricInitializer->GetMetric()->SetUseNeighborLists(argNeighborLists);
+  metricInitializer->GetMetric()->SetNeighborListSkin(args::get(argNeighborListSkin));
+  metricInitializer->GetMetric()->SetUseReproducibleSum(argReproducible);
+  metricInitializer->GetMetric()->SetApproximationSamplingFraction(args::get(argApproximationFraction));
+  metricInitializer->GetMetric()->SetApproximationRelativeError(args::get(argApproximationError));
+  metricInitializer->GetMetric()->SetUseMiniBatch(args::get(argMiniBatchSize) > 0);
+  metricInitializer->GetMetric()->SetMiniBatchSize(args::get(argMiniBatchSize));
+  metricInitializer->GetMetric()->SetMiniBatchGrowthFactor(args::get(argMiniBatchGrowth));
+  metricInitializer->GetMetric()->SetRandomSeed(args::get(argSeed));
+  metricInitializer->GetMetric()->SetPointSpacing(std::max(fixedPointSetCalculator->GetSpacing(), movingPointSetCalculator->GetSpacing()));
   metricInitializer->PrintReport();
   //--------------------------------------------------------------------
   // perform registration
@@ -176,6 +369,20 @@ int main(int argc, char** argv) {
   registration->SetMovingPointSet(movingPointSet);
   registration->SetMovingInitialTransform(movingInitialTransform);
   registration->SetScale(scale);
+  registration->SetUseAdaptiveScale(argAdaptive);
+  registration->SetScaleFactor(args::get(argScaleFactor));
+  registration->SetLevelSkipTolerance(args::get(argLevelSkipTolerance));
+  registration->SetMinimalScale(std::max(fixedPointSetCalculator->GetSpacing(), movingPointSetCalculator->GetSpacing()));
+  registration->SetValueTolerance(args::get(argValueTolerance));
+  registration->SetParametersTolerance(args::get(argParametersTolerance));
+  registration->SetStepLengthFactor(args::get(argStepLength));
+  registration->SetUseMortonOrder(argMortonOrder);
+  registration->SetUseFixedPointSetCropping(argCrop);
+  registration->SetCroppingMargin(args::get(argCroppingMargin));
+  registration->SetUseFixedPointSetReduction(argReduce);
+  registration->SetReductionFactor(args::get(argReductionFactor));
+  registration->SetUseProgressiveAccuracy(argProgressive);
+  registration->SetApproximationTolerance(args::get(argApproximationTolerance));
   registration->SetOptimizer(optimizer);
   registration->SetMetric(metricInitializer->GetMetric());
   registration->SetTransform(transform);
@@ -196,6 +403,11 @@ int main(int argc, char** argv) {
   std::cout << "  Final transform parameters " << registration->GetFinalTransformParameters() << std::endl;
   std::cout << std::endl;
   std::cout << "metric " << registration->GetMetric()->GetNameOfClass() << std::endl;
+  std::cout << "            Level scales " << registration->GetLevelScales() << std::endl;
+  std::cout << "      Level search radii " << registration->GetLevelSearchRadii() << std::endl;
+  std::cout << " Level truncation errors " << registration->GetLevelTruncationErrors() << std::endl;
+  std::cout << "      Level fixed points " << registration->GetLevelNumbersOfFixedPoints() << std::endl;
+  std::cout << "     Level list rebuilds " << registration->GetLevelNumbersOfNeighborListUpdates() << std::endl;
   std::cout << "   Initial metric values " << registration->GetInitialMetricValues() << std::endl;
   std::cout << "     Final metric values " << registration->GetFinalMetricValues() << std::endl;
   std::cout << std::endl;
@@ -213,19 +425,22 @@ int main(int argc, char** argv) {
     return EXIT_FAILURE;
   }
 
+  // the output mesh is written while the metrics are computed
+  std::future<bool> writeTask;
+
   if (argOutputFileName) {
     std::string fileName = args::get(argOutputFileName);
     std::cout << "write output mesh to the file " << fileName << std::endl;
     std::cout << std::endl;
 
-    if (!writeMesh<MovingMeshType>(transformMesh->GetOutput(), fileName)) {
-      return EXIT_FAILURE;
-    }
+    MovingMeshType::Pointer outputMesh = transformMesh->GetOutput();
+    writeTask = std::async(std::launch::async, [outputMesh, fileName]() { return writeMesh<MovingMeshType>(outputMesh, fileName); });
   }
 
   // compute metrics
   typedef itk::PointSetToPointSetMetrics<FixedPointSetType, MovingPointSetType> PointSetToPointSetMetricsType;
   PointSetToPointSetMetricsType::Pointer metrics = PointSetToPointSetMetricsType::New();
+  metrics->SetFixedPointsIndex(fixedPointsIndex);
   metrics->SetFixedPointSet(fixedPointSet);
   metrics->SetMovingPointSet(movingPointSet);
   metrics->Compute();
@@ -236,5 +451,17 @@ int main(int argc, char** argv) {
   metrics->Compute();
   metrics->PrintReport(std::cout);
 
+  if (writeTask.valid()) {
+    try {
+      if (!writeTask.get()) {
+        return EXIT_FAILURE;
+      }
+    }
+    catch (itk::ExceptionObject& excep) {
+      std::cerr << excep << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
   return EXIT_SUCCESS;
 }
@@ -8,6 +8,8 @@
 #include "itkPointSetPropertiesCalculator.h"
 #include "itkInitializeTransform.h"
 #include "itkPointSetToPointSetMetrics.h"
+#include "itkICPPointSetToPointSetRegistrationMethod.h"
+#include "itkTaskScheduler.h"
 
 #include "itkIOutils.h"
 #include "argsCustomParsers.h"
@@ -26,8 +28,10 @@ int main(int argc, char** argv) {
   args::ValueFlag<std::string> argFixedFileName(allRequired, "fixed", "The fixed mesh (point-set) filename", { 'f', "fixed" });
   args::ValueFlag<std::string> argMovingFileName(allRequired, "moving", "The moving mesh (point-set) filename", { 'm', "moving" });
   args::ValueFlag<std::string> argOutputFileName(parser, "output", "The output mesh (point-set) filename", { 'o', "output" });
+  args::ValueFlag<std::string> argFixedIndexFileName(parser, "index", "The prebuilt index of the fixed point set (see gmm-index)", { "fixed-index" });
 
   args::ValueFlag<size_t> argNumberOfIterations(parser, "iterations", "The number of iterations", { 'i', "iterations" }, 1000);
+  args::ValueFlag<size_t> argNumberOfThreads(parser, "threads", "The number of threads of the correspondence searches (default: the number of cores)", { "threads" }, 0);
   args::Flag trace(parser, "trace", "Optimizer iterations tracing", {"trace"});
 
   const std::string transformDescription =
@@ -39,6 +43,18 @@ int main(int argc, char** argv) {
 
   args::ValueFlag<size_t> argTypeOfTransform(parser, "transform", transformDescription, { 't', "transform" }, 0);
 
+  const std::string solverDescription =
+    "The type of solver (That is number):\n"
+    "  0 : LevenbergMarquardt\n"
+    "  1 : closed-form SVD (Translation, Versor3D and Similarity transforms)\n";
+
+  args::ValueFlag<size_t> argTypeOfSolver(parser, "solver", solverDescription, { "solver" }, 0);
+  args::Flag argPointToPlane(parser, "point-to-plane", "Minimize point-to-plane distances by the Gauss-Newton steps in the closed-form solver", { "point-to-plane" });
+  args::ValueFlag<double> argDistanceFieldSpacing(parser, "distance-field", "The spacing of the distance field of the fixed point set used by the correspondences of the closed-form solver and to evaluate the metrics", { "distance-field" });
+  args::ValueFlag<double> argTrimmingRatio(parser, "trimming", "The ratio of the closest pairs used by the closed-form solver", { "trimming" }, 1.0);
+  args::ValueFlag<double> argValueTolerance(parser, "value-tolerance", "The relative tolerance of the RMS distance change for the closed-form solver", { "value-tolerance" }, 1.0e-06);
+  args::ValueFlag<double> argParametersTolerance(parser, "parameters-tolerance", "The relative tolerance of the parameters change for the closed-form solver", { "parameters-tolerance" }, 1.0e-06);
+
   try {
     parser.ParseCLI(argc, argv);
   }
@@ -62,9 +78,13 @@ int main(int argc, char** argv) {
 
   size_t numberOfIterations = args::get(argNumberOfIterations);
   size_t typeOfTransform = args::get(argTypeOfTransform);
+  size_t typeOfSolver = args::get(argTypeOfSolver);
+
+  itk::TaskScheduler::GetInstance().SetNumberOfThreads(args::get(argNumberOfThreads));
 
   std::cout << "options" << std::endl;
   std::cout << "number of iterations " << numberOfIterations << std::endl;
+  std::cout << "type of solver " << typeOfSolver << std::endl;
   std::cout << std::endl;
 
   //--------------------------------------------------------------------
@@ -101,6 +121,25 @@ int main(int argc, char** argv) {
   PointSetType::Pointer fixedPointSet = PointSetType::New();
   fixedPointSet->SetPoints(fixedMesh->GetPoints());
 
+  // read the prebuilt index of the fixed points
+  typedef itk::PointsKdTreeIndex<PointSetType::PointsContainer> PointsIndexType;
+  PointsIndexType::Pointer fixedPointsIndex;
+
+  if (argFixedIndexFileName) {
+    fixedPointsIndex = PointsIndexType::New();
+    try {
+      fixedPointsIndex->Read(args::get(argFixedIndexFileName));
+    }
+    catch (itk::ExceptionObject& excep) {
+      std::cerr << excep << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    std::cout << "index " << args::get(argFixedIndexFileName) << std::endl;
+    std::cout << "matches the fixed point set " << fixedPointsIndex->Matches(fixedPointSet->GetPoints()) << std::endl;
+    std::cout << std::endl;
+  }
+
   // initialize transform
   typedef itk::PointSetPropertiesCalculator<PointSetType> PointSetPropertiesCalculatorType;
   PointSetPropertiesCalculatorType::Pointer fixedPointSetCalculator = PointSetPropertiesCalculatorType::New();
@@ -127,59 +166,128 @@ int main(int argc, char** argv) {
   transformInitializer->PrintReport();
   TransformType::Pointer transform = transformInitializer->GetTransform();
 
-  //--------------------------------------------------------------------
-  // initialize optimizer
-  typedef itk::LevenbergMarquardtOptimizer OptimizerType;
-  OptimizerType::Pointer optimizer = OptimizerType::New();
-  optimizer->SetUseCostFunctionGradient(false);
-
-  OptimizerType::ScalesType scales(transform->GetNumberOfParameters());
-  scales.Fill(0.01);
+  // the distance field of the fixed points is shared by the closed-form solver and the evaluations of the metrics
+  typedef itk::PointSetDistanceField<PointSetType> DistanceFieldType;
+  DistanceFieldType::Pointer fixedDistanceField;
 
-  const double        gradientTolerance = 1e-5;    // convergence criterion
-  const double        valueTolerance = 1e-5;    // convergence criterion
-  const double        epsilonFunction = 1e-6;   // convergence criterion
+  if (argDistanceFieldSpacing) {
+    fixedDistanceField = DistanceFieldType::New();
+    fixedDistanceField->SetPointSet(fixedPointSet);
+    fixedDistanceField->SetSpacing(args::get(argDistanceFieldSpacing));
+    try {
+      fixedDistanceField->Compute();
+    }
+    catch (itk::ExceptionObject& excep) {
+      std::cerr << excep << std::endl;
+      return EXIT_FAILURE;
+    }
+    fixedDistanceField->PrintReport(std::cout);
+  }
 
-  optimizer->SetScales(scales);
-  optimizer->SetNumberOfIterations(numberOfIterations);
-  optimizer->SetValueTolerance(valueTolerance);
-  optimizer->SetGradientTolerance(gradientTolerance);
-  optimizer->SetEpsilonFunction(epsilonFunction);
-  optimizer->SetDebug(trace);
+  if (typeOfSolver == 1) {
+    //--------------------------------------------------------------------
+    // perform registration with the closed-form updates
+    typedef itk::ICPPointSetToPointSetRegistrationMethod<PointSetType> ICPRegistrationType;
+    ICPRegistrationType::Pointer registration = ICPRegistrationType::New();
+    registration->SetFixedPointSet(fixedPointSet);
+    registration->SetMovingPointSet(movingPointSet);
+    registration->SetTransform(transform);
+    registration->SetNumberOfIterations(numberOfIterations);
+    registration->GetMetric()->SetFixedPointsIndex(fixedPointsIndex);
+    registration->SetDistanceField(fixedDistanceField);
+
+    // take normals of the fixed points from the mesh cells if they are available
+    if (argPointToPlane && fixedMesh->GetNumberOfCells() > 0) {
+      typedef itk::PointSetNormalsEstimator<PointSetType> NormalsEstimatorType;
+      NormalsEstimatorType::Pointer normalsEstimator = NormalsEstimatorType::New();
+      normalsEstimator->SetPointSet(fixedPointSet);
+      try {
+        normalsEstimator->ComputeFromCells(fixedMesh.GetPointer());
+      }
+      catch (itk::ExceptionObject& excep) {
+        std::cout << excep << std::endl;
+        return EXIT_FAILURE;
+      }
+      registration->GetMetric()->SetFixedNormals(normalsEstimator->GetNormals());
+    }
 
-  //--------------------------------------------------------------------
-  // metric
-  typedef itk::EuclideanDistancePointMetric<PointSetType, PointSetType> MetricType;
-  MetricType::Pointer  metric = MetricType::New();
-  metric->SetFixedPointSet(fixedPointSet);
-  metric->SetMovingPointSet(movingPointSet);
+    registration->SetUsePointToPlane(argPointToPlane);
+    registration->SetTrimmingRatio(args::get(argTrimmingRatio));
+    registration->SetValueTolerance(args::get(argValueTolerance));
+    registration->SetParametersTolerance(args::get(argParametersTolerance));
+    try {
+      registration->Update();
+    }
+    catch (itk::ExceptionObject& excep) {
+      std::cout << excep << std::endl;
+      return EXIT_FAILURE;
+    }
 
-  //--------------------------------------------------------------------
-  // perform registration
-  typedef itk::PointSetToPointSetRegistrationMethod<PointSetType, PointSetType> RegistrationType;
-  RegistrationType::Pointer registration = RegistrationType::New();
-  registration->SetInitialTransformParameters(transform->GetParameters());
-  registration->SetFixedPointSet(fixedPointSet);
-  registration->SetMovingPointSet(movingPointSet);
-  registration->SetMetric(metric);
-  registration->SetOptimizer(optimizer);
-  registration->SetTransform(transform);
-  try {
-    registration->Update();
+    std::cout << std::endl;
+    std::cout << registration->GetNameOfClass() << std::endl;
+    std::cout << registration->GetStopConditionDescription() << std::endl;
+    std::cout << "        iterations " << registration->GetCurrentIteration() << std::endl;
+    std::cout << "initial parameters " << registration->GetInitialTransformParameters() << std::endl;
+    std::cout << "  final parameters " << registration->GetFinalTransformParameters() << std::endl;
+    std::cout << "     initial value " << registration->GetInitialValue() << std::endl;
+    std::cout << "       final value " << registration->GetFinalValue() << std::endl;
+    std::cout << std::endl;
   }
-  catch (itk::ExceptionObject& excep) {
-    std::cout << excep << std::endl;
-    return EXIT_FAILURE;
+  else {
+    //--------------------------------------------------------------------
+    // initialize optimizer
+    typedef itk::LevenbergMarquardtOptimizer OptimizerType;
+    OptimizerType::Pointer optimizer = OptimizerType::New();
+    optimizer->SetUseCostFunctionGradient(false);
+
+    OptimizerType::ScalesType scales(transform->GetNumberOfParameters());
+    scales.Fill(0.01);
+
+    const double        gradientTolerance = 1e-5;    // convergence criterion
+    const double        valueTolerance = 1e-5;    // convergence criterion
+    const double        epsilonFunction = 1e-6;   // convergence criterion
+
+    optimizer->SetScales(scales);
+    optimizer->SetNumberOfIterations(numberOfIterations);
+    optimizer->SetValueTolerance(valueTolerance);
+    optimizer->SetGradientTolerance(gradientTolerance);
+    optimizer->SetEpsilonFunction(epsilonFunction);
+    optimizer->SetDebug(trace);
+
+    //--------------------------------------------------------------------
+    // metric
+    typedef itk::EuclideanDistancePointMetric<PointSetType, PointSetType> MetricType;
+    MetricType::Pointer  metric = MetricType::New();
+    metric->SetFixedPointSet(fixedPointSet);
+    metric->SetMovingPointSet(movingPointSet);
+
+    //--------------------------------------------------------------------
+    // perform registration
+    typedef itk::PointSetToPointSetRegistrationMethod<PointSetType, PointSetType> RegistrationType;
+    RegistrationType::Pointer registration = RegistrationType::New();
+    registration->SetInitialTransformParameters(transform->GetParameters());
+    registration->SetFixedPointSet(fixedPointSet);
+    registration->SetMovingPointSet(movingPointSet);
+    registration->SetMetric(metric);
+    registration->SetOptimizer(optimizer);
+    registration->SetTransform(transform);
+    try {
+      registration->Update();
+    }
+    catch (itk::ExceptionObject& excep) {
+      std::cout << excep << std::endl;
+      return EXIT_FAILURE;
+    }
+    registration->GetTransform();
+
+    std::cout << std::endl;
+    std::cout << registration->GetMetric()->GetNameOfClass() << std::endl;
+    std::cout << optimizer->GetStopConditionDescription() << std::endl;
+    std::cout << "initial parameters " << registration->GetInitialTransformParameters() << std::endl;
+    std::cout << "  final parameters " << optimizer->GetCurrentPosition() << std::endl;
+    std::cout << "             value " << optimizer->GetValue() << std::endl;
+    std::cout << std::endl;
   }
-  registration->GetTransform();
-
-  std::cout << std::endl;
-  std::cout << registration->GetMetric()->GetNameOfClass() << std::endl;
-  std::cout << optimizer->GetStopConditionDescription() << std::endl;
-  std::cout << "initial parameters " << registration->GetInitialTransformParameters() << std::endl;
-  std::cout << "  final parameters " << optimizer->GetCurrentPosition() << std::endl;
-  std::cout << "             value " << optimizer->GetValue() << std::endl;
-  std::cout << std::endl;
 
   typedef itk::TransformMeshFilter<MeshType, MeshType, TransformType> TransformMeshFilterType;
   TransformMeshFilterType::Pointer transformMesh = TransformMeshFilterType::New();
@@ -207,6 +315,13 @@ int main(int argc, char** argv) {
 
   typedef itk::PointSetToPointSetMetrics<PointSetType> PointSetToPointSetMetricsType;
   PointSetToPointSetMetricsType::Pointer metrics = PointSetToPointSetMetricsType::New();
+  metrics->SetFixedPointsIndex(fixedPointsIndex);
+
+  // the distance field is shared by the evaluations against the fixed point set
+  if (fixedDistanceField) {
+    metrics->SetFixedDistanceField(fixedDistanceField);
+  }
+
   metrics->SetFixedPointSet(fixedPointSet);
   metrics->SetMovingPointSet(movingPointSet);
   metrics->Compute();
@@ -0,0 +1,272 @@
+#include "gmmRegistration.h"
+
+#include <itkPointSet.h>
+#include <itkLBFGSOptimizer.h>
+
+#include "itkGMMPointSetToPointSetRegistrationMethod.h"
+#include "itkPointSetPropertiesCalculator.h"
+#include "itkInitializeTransform.h"
+#include "itkInitializeMetric.h"
+#include "itkPointSetToPointSetMetrics.h"
+#include "itkPointsKdTreeIndex.h"
+
+#include <cstring>
+#include <memory>
+
+const unsigned int Dimension = 3;
+typedef itk::PointSet<float, Dimension> PointSetType;
+typedef itk::Transform <double, Dimension, Dimension> TransformType;
+typedef itk::PointSetPropertiesCalculator<PointSetType> PointSetPropertiesCalculatorType;
+typedef itk::PointsKdTreeIndex<PointSetType::PointsContainer> PointsIndexType;
+
+struct gmm_model
+{
+  PointSetType::Pointer pointSet;
+  PointSetPropertiesCalculatorType::Pointer calculator;
+  PointsIndexType::Pointer index;
+};
+
+namespace
+{
+void SetError(const std::string & message, char * error, size_t error_size)
+{
+  if (error && error_size > 0) {
+    std::strncpy(error, message.c_str(), error_size - 1);
+    error[error_size - 1] = '\0';
+  }
+}
+
+// the registration method consumes the points containers, so the host buffer is copied once in place of the file round trip
+PointSetType::Pointer MakePointSet(const float * data, size_t numberOfPoints)
+{
+  PointSetType::PointsContainer::Pointer points = PointSetType::PointsContainer::New();
+  points->resize(numberOfPoints);
+
+  for (size_t n = 0; n < numberOfPoints; ++n) {
+    PointSetType::PointType & point = points->ElementAt(n);
+    for (unsigned int d = 0; d < Dimension; ++d) {
+      point[d] = data[Dimension * n + d];
+    }
+  }
+
+  PointSetType::Pointer pointSet = PointSetType::New();
+  pointSet->SetPoints(points);
+  return pointSet;
+}
+}
+
+void gmm_registration_options_default(gmm_registration_options * options)
+{
+  options->transform = 0;
+  options->metric = 0;
+  options->iterations = 1000;
+  options->scale = NULL;
+  options->number_of_scales = 0;
+  options->adaptive = 0;
+  options->relative_error = 0;
+  options->gaussian_sum_tree = 0;
+  options->single_precision = 0;
+}
+
+int gmm_model_create(const float * points, size_t number_of_points, gmm_model ** model, char * error, size_t error_size)
+{
+  if (!points || number_of_points == 0 || !model) {
+    SetError("the fixed points are empty", error, error_size);
+    return 1;
+  }
+
+  try {
+    // the model is owned until it is complete, so it is released if the preprocessing throws
+    std::unique_ptr<gmm_model> fixed(new gmm_model);
+    fixed->pointSet = MakePointSet(points, number_of_points);
+
+    fixed->calculator = PointSetPropertiesCalculatorType::New();
+    fixed->calculator->SetPointSet(fixed->pointSet);
+    fixed->calculator->Compute();
+
+    fixed->index = PointsIndexType::New();
+    fixed->index->Build(fixed->pointSet->GetPoints());
+
+    *model = fixed.release();
+  }
+  catch (itk::ExceptionObject & excep) {
+    SetError(excep.GetDescription(), error, error_size);
+    return 1;
+  }
+  catch (std::exception & excep) {
+    SetError(excep.what(), error, error_size);
+    return 1;
+  }
+
+  return 0;
+}
+
+void gmm_model_destroy(gmm_model * model)
+{
+  delete model;
+}
+
+int gmm_register(const gmm_model * model,
+                 const float * moving, size_t number_of_moving_points,
+                 const gmm_registration_options * options,
+                 gmm_registration_result * result,
+                 float * output,
+                 char * error, size_t error_size)
+{
+  if (!model || !result) {
+    SetError("the model and the result must be given", error, error_size);
+    return 1;
+  }
+
+  if (!moving || number_of_moving_points == 0) {
+    SetError("the moving points are empty", error, error_size);
+    return 1;
+  }
+
+  gmm_registration_options defaults;
+  gmm_registration_options_default(&defaults);
+  if (!options) {
+    options = &defaults;
+  }
+
+  try {
+    PointSetType::Pointer movingPointSet = MakePointSet(moving, number_of_moving_points);
+
+    PointSetPropertiesCalculatorType::Pointer movingPointSetCalculator = PointSetPropertiesCalculatorType::New();
+    movingPointSetCalculator->SetPointSet(movingPointSet);
+    movingPointSetCalculator->Compute();
+
+    itk::Array<double> scale;
+    if (options->scale && options->number_of_scales > 0) {
+      scale.set_size(options->number_of_scales);
+      for (size_t n = 0; n < scale.size(); ++n) {
+        scale[n] = options->scale[n] * movingPointSetCalculator->GetScale();
+      }
+    }
+    else {
+      scale = movingPointSetCalculator->GetScalePyramid();
+    }
+
+    const double radius = std::max(model->calculator->GetRadius(), movingPointSetCalculator->GetRadius());
+    const double spacing = std::max(model->calculator->GetSpacing(), movingPointSetCalculator->GetSpacing());
+
+    // initialize transform
+    typedef itk::VersorRigid3DTransform<double> InitialTransformType;
+    InitialTransformType::Pointer fixedInitialTransform = InitialTransformType::New();
+    fixedInitialTransform->SetCenter(model->calculator->GetCenter());
+    fixedInitialTransform->SetIdentity();
+
+    InitialTransformType::Pointer movingInitialTransform = InitialTransformType::New();
+    movingInitialTransform->SetCenter(movingPointSetCalculator->GetCenter());
+    movingInitialTransform->SetIdentity();
+
+    typedef itk::InitializeTransform<double> TransformInitializerType;
+    TransformInitializerType::Pointer transformInitializer = TransformInitializerType::New();
+    transformInitializer->SetMovingLandmark(movingPointSetCalculator->GetCenter());
+    transformInitializer->SetFixedLandmark(model->calculator->GetCenter());
+    transformInitializer->SetTypeOfTransform(static_cast<size_t>(options->transform));
+    transformInitializer->Update();
+    TransformType::Pointer transform = transformInitializer->GetTransform();
+
+    // initialize optimizer
+    typedef itk::LBFGSOptimizer OptimizerType;
+    OptimizerType::Pointer optimizer = OptimizerType::New();
+    optimizer->SetMaximumNumberOfFunctionEvaluations(options->iterations);
+    optimizer->SetScales(transformInitializer->GetScales());
+    optimizer->MinimizeOn();
+
+    // metric
+    typedef itk::InitializeMetric<PointSetType, PointSetType> InitializeMetricType;
+    InitializeMetricType::Pointer metricInitializer = InitializeMetricType::New();
+    metricInitializer->SetTypeOfMetric(static_cast<size_t>(options->metric));
+    metricInitializer->SetUseSinglePrecision(options->single_precision != 0);
+    metricInitializer->Initialize();
+    metricInitializer->GetMetric()->SetRadius(radius);
+    metricInitializer->GetMetric()->SetRelativeError(options->relative_error);
+    metricInitializer->GetMetric()->SetUseGaussianSumTree(options->gaussian_sum_tree != 0);
+    metricInitializer->GetMetric()->SetFixedPointsIndex(model->index);
+    metricInitializer->GetMetric()->SetPointSpacing(spacing);
+
+    // perform registration
+    typedef itk::GMMPointSetToPointSetRegistrationMethod<PointSetType, PointSetType> RegistrationType;
+    RegistrationType::Pointer registration = RegistrationType::New();
+    registration->SetFixedPointSet(model->pointSet);
+    registration->SetFixedInitialTransform(fixedInitialTransform);
+    registration->SetMovingPointSet(movingPointSet);
+    registration->SetMovingInitialTransform(movingInitialTransform);
+    registration->SetScale(scale);
+    registration->SetUseAdaptiveScale(options->adaptive != 0);
+    registration->SetMinimalScale(spacing);
+    registration->SetOptimizer(optimizer);
+    registration->SetMetric(metricInitializer->GetMetric());
+    registration->SetTransform(transform);
+    registration->Update();
+
+    // transform the moving points
+    PointSetType::PointsContainer::Pointer points = PointSetType::PointsContainer::New();
+    points->resize(number_of_moving_points);
+    for (PointSetType::PointsContainer::ConstIterator it = movingPointSet->GetPoints()->Begin(); it != movingPointSet->GetPoints()->End(); ++it) {
+      points->SetElement(it.Index(), transform->TransformPoint(it.Value()));
+    }
+
+    if (output) {
+      for (size_t n = 0; n < number_of_moving_points; ++n) {
+        for (unsigned int d = 0; d < Dimension; ++d) {
+          output[Dimension * n + d] = points->ElementAt(n)[d];
+        }
+      }
+    }
+
+    PointSetType::Pointer outputPointSet = PointSetType::New();
+    outputPointSet->SetPoints(points);
+
+    typedef itk::PointSetToPointSetMetrics<PointSetType, PointSetType> PointSetToPointSetMetricsType;
+    PointSetToPointSetMetricsType::Pointer metrics = PointSetToPointSetMetricsType::New();
+    metrics->SetFixedPointsIndex(model->index);
+    metrics->SetFixedPointSet(model->pointSet);
+    metrics->SetMovingPointSet(outputPointSet);
+    metrics->Compute();
+
+    // the supported transforms are affine, the matrix and the offset are recovered from the images of the basis
+    const TransformType::ParametersType & parameters = transform->GetParameters();
+    if (parameters.size() > GMM_MAXIMAL_NUMBER_OF_PARAMETERS) {
+      itkGenericExceptionMacro(<< "The number of parameters " << parameters.size() << " exceeds " << GMM_MAXIMAL_NUMBER_OF_PARAMETERS);
+    }
+
+    result->number_of_parameters = parameters.size();
+    for (size_t n = 0; n < parameters.size(); ++n) {
+      result->parameters[n] = parameters[n];
+    }
+
+    TransformType::InputPointType point;
+    point.Fill(0);
+    const TransformType::OutputPointType offset = transform->TransformPoint(point);
+
+    for (unsigned int col = 0; col < Dimension; ++col) {
+      point.Fill(0);
+      point[col] = 1;
+      const TransformType::OutputPointType image = transform->TransformPoint(point);
+      for (unsigned int row = 0; row < Dimension; ++row) {
+        result->matrix[Dimension * row + col] = image[row] - offset[row];
+      }
+      result->offset[col] = offset[col];
+    }
+
+    const RegistrationType::MetricValuesType & values = registration->GetFinalMetricValues();
+    result->value = values.size() > 0 ? values[values.size() - 1] : 0;
+    result->mean = metrics->GetMeanValue();
+    result->rmse = metrics->GetRMSEValue();
+    result->quantile = metrics->GetQuantileValue();
+    result->maximal = metrics->GetMaximalValue();
+  }
+  catch (itk::ExceptionObject & excep) {
+    SetError(excep.GetDescription(), error, error_size);
+    return 1;
+  }
+  catch (std::exception & excep) {
+    SetError(excep.what(), error, error_size);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,79 @@
+#ifndef gmmRegistration_h
+#define gmmRegistration_h
+
+/*
+ * C interface to register the point sets held in the memory of the host application.
+ *
+ * The points are passed as the arrays of 3 * n floats (x0 y0 z0 x1 y1 z1 ...). The fixed points are
+ * loaded once into the model together with their properties and the kd-tree index, the model may be
+ * used by any number of the concurrent registrations. The functions return 0 on success, otherwise
+ * the message is written to the error buffer if it is given.
+ */
+
+#include <stddef.h>
+
+#if defined(_WIN32)
+#  if defined(GMM_CAPI_EXPORTS)
+#    define GMM_CAPI __declspec(dllexport)
+#  else
+#    define GMM_CAPI __declspec(dllimport)
+#  endif
+#else
+#  define GMM_CAPI __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GMM_MAXIMAL_NUMBER_OF_PARAMETERS 16
+
+typedef struct gmm_model gmm_model;
+
+typedef struct gmm_registration_options
+{
+  int transform;                /* 0 Translation, 1 Versor3D, 2 Similarity, 3 ScaleSkewVersor3D */
+  int metric;                   /* 0 L2Rigid, 1 L2, 2 KC */
+  int iterations;               /* the maximal number of function evaluations per level */
+  const double * scale;         /* the scale levels in units of the RMS radius, NULL to propose them */
+  size_t number_of_scales;
+  int adaptive;                 /* adaptive scale schedule down to the point spacing */
+  double relative_error;        /* the target relative error of the truncated kernel sums */
+  int gaussian_sum_tree;        /* approximate the kernel sums by the Gaussian sum trees */
+  int single_precision;         /* evaluate the kernels in single precision */
+} gmm_registration_options;
+
+typedef struct gmm_registration_result
+{
+  size_t number_of_parameters;
+  double parameters[GMM_MAXIMAL_NUMBER_OF_PARAMETERS];
+  double matrix[9];             /* row-major, y = matrix * x + offset maps the moving points to the fixed ones */
+  double offset[3];
+  double value;                 /* the final metric value at the last level */
+  double mean;                  /* the distances from the transformed moving points to the fixed points */
+  double rmse;
+  double quantile;
+  double maximal;
+} gmm_registration_result;
+
+/* Fill the options with the defaults of gmmPointSetRegistration. */
+GMM_CAPI void gmm_registration_options_default(gmm_registration_options * options);
+
+/* Load the fixed points into the model, the points are not referenced after the call. */
+GMM_CAPI int gmm_model_create(const float * points, size_t number_of_points, gmm_model ** model, char * error, size_t error_size);
+
+GMM_CAPI void gmm_model_destroy(gmm_model * model);
+
+/* Register the moving points to the model, the transformed moving points are written to the output if it is not NULL. */
+GMM_CAPI int gmm_register(const gmm_model * model,
+                          const float * moving, size_t number_of_moving_points,
+                          const gmm_registration_options * options,
+                          gmm_registration_result * result,
+                          float * output,
+                          char * error, size_t error_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
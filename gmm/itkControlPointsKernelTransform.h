@@ -0,0 +1,389 @@
+#ifndef itkControlPointsKernelTransform_h
+#define itkControlPointsKernelTransform_h
+
+#include <itkTransform.h>
+#include <vnl/vnl_matrix.h>
+#include <vnl/algo/vnl_qr.h>
+#include <cmath>
+#include <vector>
+
+namespace itk
+{
+/** \class ControlPointsKernelTransform
+ * \brief Deformable transform spanned by the kernels centred at the control points.
+ *
+ * The transform is f(x) = [1 x] A + U(x) N W, where U(x) is the row of the kernel values between x
+ * and the control points. For the thin-plate spline the kernel is U(r) = -r, and N is the null space of
+ * the affine monomials [1 c] at the control points, computed by the QR decomposition, so the non-affine
+ * part does not contain an affine component. For the Gaussian radial basis functions the kernel is
+ * U(r) = exp(-r^2 / (2 beta^2)) and N is the identity.
+ *
+ * The parameters are the rows of the coefficients C = [A; W], so the transformed point is the product of
+ * the basis row b(x) = [1 x U(x)N] and C. The basis of the fixed set of points, e.g. the moving points,
+ * does not depend on the parameters, so it can be computed once by ComputeBasis() and the points and the
+ * derivatives are the products of the matrices, see GMMPointSetToPointSetMetricBase.
+ *
+ * The regularization is the bending energy lambda * trace(W^T N^T K N W), where K is the kernel matrix
+ * of the control points, it is added to the metric value by the metric.
+ */
+template< typename TParametersValueType = double, unsigned int NDimensions = 3 >
+class ControlPointsKernelTransform : public Transform< TParametersValueType, NDimensions, NDimensions >
+{
+public:
+  /** Standard class typedefs. */
+  typedef ControlPointsKernelTransform                                 Self;
+  typedef Transform< TParametersValueType, NDimensions, NDimensions >  Superclass;
+  typedef SmartPointer< Self >                                         Pointer;
+  typedef SmartPointer< const Self >                                   ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(ControlPointsKernelTransform, Transform);
+
+  itkStaticConstMacro(SpaceDimension, unsigned int, NDimensions);
+
+  typedef typename Superclass::ParametersType             ParametersType;
+  typedef typename Superclass::FixedParametersType        FixedParametersType;
+  typedef typename Superclass::JacobianType               JacobianType;
+  typedef typename Superclass::InputPointType             InputPointType;
+  typedef typename Superclass::OutputPointType            OutputPointType;
+  typedef typename Superclass::InputVectorType            InputVectorType;
+  typedef typename Superclass::OutputVectorType           OutputVectorType;
+  typedef typename Superclass::InputVnlVectorType         InputVnlVectorType;
+  typedef typename Superclass::OutputVnlVectorType        OutputVnlVectorType;
+  typedef typename Superclass::InputCovariantVectorType   InputCovariantVectorType;
+  typedef typename Superclass::OutputCovariantVectorType  OutputCovariantVectorType;
+  typedef typename Superclass::TransformCategoryType      TransformCategoryType;
+  typedef typename Superclass::DerivativeType             DerivativeType;
+
+  typedef std::vector<InputPointType> PointsType;
+  typedef vnl_matrix<double>          MatrixType;
+
+  enum class Kernel
+  {
+    ThinPlateSpline,
+    GaussianRBF
+  };
+
+  /** Get/Set the type of the kernel. */
+  void SetKernel(const Kernel & kernel)
+  {
+    if (m_Kernel != kernel) {
+      m_Kernel = kernel;
+      this->Setup();
+    }
+  }
+  itkGetEnumMacro(Kernel, Kernel);
+
+  /** Get/Set the width beta of the Gaussian radial basis functions. */
+  void SetGaussianRBFScale(const double & scale)
+  {
+    if (m_GaussianRBFScale != scale) {
+      m_GaussianRBFScale = scale;
+      this->Setup();
+    }
+  }
+  itkGetConstMacro(GaussianRBFScale, double);
+
+  /** Get/Set the control points, the parameters are reset to the identity. */
+  void SetControlPoints(const PointsType & points)
+  {
+    m_ControlPoints = points;
+    this->Setup();
+  }
+  const PointsType & GetControlPoints() const { return m_ControlPoints; }
+
+  /** Get/Set the weight lambda of the bending energy. */
+  itkSetMacro(Regularization, double);
+  itkGetConstMacro(Regularization, double);
+
+  /** Get the number of the basis functions, i.e. the number of rows of the coefficients. */
+  size_t GetNumberOfBasisFunctions() const
+  {
+    return SpaceDimension + 1 + m_NullSpace.cols();
+  }
+
+  /** Compute the basis row b(x) = [1 x U(x)N] of the point. */
+  void ComputeBasis(const InputPointType & point, double * basis) const
+  {
+    basis[0] = 1;
+    for (unsigned int dim = 0; dim < SpaceDimension; ++dim) {
+      basis[dim + 1] = point[dim];
+    }
+
+    double * kernels = basis + SpaceDimension + 1;
+    for (size_t col = 0; col < m_NullSpace.cols(); ++col) {
+      kernels[col] = 0;
+    }
+
+    for (size_t n = 0; n < m_ControlPoints.size(); ++n) {
+      const double kernel = this->EvaluateKernel(point, m_ControlPoints[n]);
+      const double * row = m_NullSpace[n];
+      for (size_t col = 0; col < m_NullSpace.cols(); ++col) {
+        kernels[col] += kernel * row[col];
+      }
+    }
+  }
+
+  /** Get the coefficients C = [A; W] of the current parameters. */
+  MatrixType GetCoefficients() const
+  {
+    return MatrixType(this->m_Parameters.data_block(), this->GetNumberOfBasisFunctions(), SpaceDimension);
+  }
+
+  /** Compute the bending energy of the current parameters and add its derivative. */
+  double ComputeRegularization(DerivativeType * derivative) const
+  {
+    if (!(m_Regularization > 0)) {
+      return 0;
+    }
+
+    const size_t offset = (SpaceDimension + 1) * SpaceDimension;
+    const size_t size = m_BendingMatrix.rows();
+    double energy = 0;
+
+    for (unsigned int dim = 0; dim < SpaceDimension; ++dim) {
+      for (size_t row = 0; row < size; ++row) {
+        double product = 0;
+        for (size_t col = 0; col < size; ++col) {
+          product += m_BendingMatrix(row, col) * this->m_Parameters[offset + col * SpaceDimension + dim];
+        }
+
+        energy += this->m_Parameters[offset + row * SpaceDimension + dim] * product;
+
+        if (derivative) {
+          (*derivative)[offset + row * SpaceDimension + dim] += 2 * m_Regularization * product;
+        }
+      }
+    }
+
+    return m_Regularization * energy;
+  }
+
+  /** Set the identity transform. */
+  void SetIdentity()
+  {
+    this->m_Parameters.Fill(0);
+    for (unsigned int dim = 0; dim < SpaceDimension; ++dim) {
+      this->m_Parameters[(dim + 1) * SpaceDimension + dim] = 1;
+    }
+    this->Modified();
+  }
+
+  /** Set the translation of the affine part. */
+  void SetTranslation(const OutputVectorType & translation)
+  {
+    for (unsigned int dim = 0; dim < SpaceDimension; ++dim) {
+      this->m_Parameters[dim] = translation[dim];
+    }
+    this->Modified();
+  }
+
+  /** Set/Get the transformation parameters. */
+  virtual void SetParameters(const ParametersType & parameters) ITK_OVERRIDE
+  {
+    if (parameters.Size() != this->m_Parameters.Size()) {
+      itkExceptionMacro(<< "The number of parameters " << parameters.Size() << " does not match " << this->m_Parameters.Size());
+    }
+
+    if (&parameters != &this->m_Parameters) {
+      this->m_Parameters = parameters;
+    }
+    this->Modified();
+  }
+
+  virtual const ParametersType & GetParameters() const ITK_OVERRIDE
+  {
+    return this->m_Parameters;
+  }
+
+  /** The fixed parameters are the coordinates of the control points. */
+  virtual void SetFixedParameters(const FixedParametersType & parameters) ITK_OVERRIDE
+  {
+    PointsType points(parameters.Size() / SpaceDimension);
+    for (size_t n = 0; n < points.size(); ++n) {
+      for (unsigned int dim = 0; dim < SpaceDimension; ++dim) {
+        points[n][dim] = parameters[n * SpaceDimension + dim];
+      }
+    }
+    this->SetControlPoints(points);
+  }
+
+  virtual const FixedParametersType & GetFixedParameters() const ITK_OVERRIDE
+  {
+    this->m_FixedParameters.SetSize(m_ControlPoints.size() * SpaceDimension);
+    for (size_t n = 0; n < m_ControlPoints.size(); ++n) {
+      for (unsigned int dim = 0; dim < SpaceDimension; ++dim) {
+        this->m_FixedParameters[n * SpaceDimension + dim] = m_ControlPoints[n][dim];
+      }
+    }
+    return this->m_FixedParameters;
+  }
+
+  /** Transform the point. */
+  virtual OutputPointType TransformPoint(const InputPointType & point) const ITK_OVERRIDE
+  {
+    std::vector<double> basis(this->GetNumberOfBasisFunctions());
+    this->ComputeBasis(point, &basis[0]);
+
+    OutputPointType output;
+    output.Fill(0);
+
+    for (size_t row = 0; row < basis.size(); ++row) {
+      for (unsigned int dim = 0; dim < SpaceDimension; ++dim) {
+        output[dim] += basis[row] * this->m_Parameters[row * SpaceDimension + dim];
+      }
+    }
+
+    return output;
+  }
+
+  /** The vectors are not transformed by the deformable transform. */
+  using Superclass::TransformVector;
+  using Superclass::TransformCovariantVector;
+
+  virtual OutputVectorType TransformVector(const InputVectorType &) const ITK_OVERRIDE
+  {
+    itkExceptionMacro(<< "TransformVector(const InputVectorType &) is not implemented for ControlPointsKernelTransform");
+  }
+
+  virtual OutputVnlVectorType TransformVector(const InputVnlVectorType &) const ITK_OVERRIDE
+  {
+    itkExceptionMacro(<< "TransformVector(const InputVnlVectorType &) is not implemented for ControlPointsKernelTransform");
+  }
+
+  virtual OutputCovariantVectorType TransformCovariantVector(const InputCovariantVectorType &) const ITK_OVERRIDE
+  {
+    itkExceptionMacro(<< "TransformCovariantVector(const InputCovariantVectorType &) is not implemented for ControlPointsKernelTransform");
+  }
+
+  /** The Jacobian of the point with respect to the coefficient (row, dim) is b_row(x) for the dimension dim. */
+  virtual void ComputeJacobianWithRespectToParameters(const InputPointType & point, JacobianType & jacobian) const ITK_OVERRIDE
+  {
+    std::vector<double> basis(this->GetNumberOfBasisFunctions());
+    this->ComputeBasis(point, &basis[0]);
+
+    jacobian.SetSize(SpaceDimension, this->GetNumberOfParameters());
+    jacobian.Fill(0);
+
+    for (size_t row = 0; row < basis.size(); ++row) {
+      for (unsigned int dim = 0; dim < SpaceDimension; ++dim) {
+        jacobian(dim, row * SpaceDimension + dim) = basis[row];
+      }
+    }
+  }
+
+  virtual void ComputeJacobianWithRespectToParametersCachedTemporaries(const InputPointType & point, JacobianType & jacobian, JacobianType &) const ITK_OVERRIDE
+  {
+    this->ComputeJacobianWithRespectToParameters(point, jacobian);
+  }
+
+  virtual void ComputeJacobianWithRespectToPosition(const InputPointType &, JacobianType &) const ITK_OVERRIDE
+  {
+    itkExceptionMacro(<< "ComputeJacobianWithRespectToPosition is not implemented for ControlPointsKernelTransform");
+  }
+
+  virtual TransformCategoryType GetTransformCategory() const ITK_OVERRIDE
+  {
+    return Self::Spline;
+  }
+
+protected:
+  ControlPointsKernelTransform() : Superclass(0)
+  {
+    this->Setup();
+  }
+  virtual ~ControlPointsKernelTransform() {}
+
+  virtual void PrintSelf(std::ostream & os, Indent indent) const ITK_OVERRIDE
+  {
+    Superclass::PrintSelf(os, indent);
+    os << indent << "Kernel: " << (m_Kernel == Kernel::ThinPlateSpline ? "ThinPlateSpline" : "GaussianRBF") << std::endl;
+    os << indent << "GaussianRBFScale: " << m_GaussianRBFScale << std::endl;
+    os << indent << "NumberOfControlPoints: " << m_ControlPoints.size() << std::endl;
+    os << indent << "Regularization: " << m_Regularization << std::endl;
+  }
+
+  double EvaluateKernel(const InputPointType & x, const InputPointType & y) const
+  {
+    const double distance = x.SquaredEuclideanDistanceTo(y);
+
+    if (m_Kernel == Kernel::ThinPlateSpline) {
+      return -std::sqrt(distance);
+    }
+
+    return std::exp(-0.5 * distance / (m_GaussianRBFScale * m_GaussianRBFScale));
+  }
+
+  /** Compute the null space and the bending matrix of the control points. */
+  void Setup()
+  {
+    const size_t numberOfPoints = m_ControlPoints.size();
+    const size_t numberOfMonomials = SpaceDimension + 1;
+
+    if (numberOfPoints == 0) {
+      // the affine transform without the control points
+      m_NullSpace.set_size(0, 0);
+    }
+    else if (m_Kernel == Kernel::ThinPlateSpline) {
+      if (numberOfPoints <= numberOfMonomials) {
+        itkExceptionMacro(<< "The thin-plate spline requires more than " << numberOfMonomials << " control points");
+      }
+
+      MatrixType monomials(numberOfPoints, numberOfMonomials);
+      for (size_t n = 0; n < numberOfPoints; ++n) {
+        monomials(n, 0) = 1;
+        for (unsigned int dim = 0; dim < SpaceDimension; ++dim) {
+          monomials(n, dim + 1) = m_ControlPoints[n][dim];
+        }
+      }
+
+      vnl_qr<double> qr(monomials);
+      const MatrixType r = qr.R();
+      for (size_t n = 0; n < numberOfMonomials; ++n) {
+        if (std::abs(r(n, n)) < 1.0e-12 * std::abs(r(0, 0))) {
+          itkExceptionMacro(<< "The control points are degenerate, they lie in a plane");
+        }
+      }
+
+      m_NullSpace = qr.Q().extract(numberOfPoints, numberOfPoints - numberOfMonomials, 0, numberOfMonomials);
+    }
+    else {
+      if (!(m_GaussianRBFScale > 0)) {
+        itkExceptionMacro(<< "The scale of the Gaussian radial basis functions must be positive");
+      }
+
+      m_NullSpace.set_size(numberOfPoints, numberOfPoints);
+      m_NullSpace.set_identity();
+    }
+
+    MatrixType kernels(numberOfPoints, numberOfPoints);
+    for (size_t row = 0; row < numberOfPoints; ++row) {
+      for (size_t col = 0; col < numberOfPoints; ++col) {
+        kernels(row, col) = this->EvaluateKernel(m_ControlPoints[row], m_ControlPoints[col]);
+      }
+    }
+
+    m_BendingMatrix = m_NullSpace.transpose() * kernels * m_NullSpace;
+
+    this->m_Parameters.SetSize(this->GetNumberOfBasisFunctions() * SpaceDimension);
+    this->SetIdentity();
+  }
+
+  Kernel m_Kernel = Kernel::ThinPlateSpline;
+  double m_GaussianRBFScale = 1;
+  double m_Regularization = 0;
+
+  PointsType m_ControlPoints;
+  MatrixType m_NullSpace;
+  MatrixType m_BendingMatrix;
+
+private:
+  ControlPointsKernelTransform(const Self &) ITK_DELETE_FUNCTION;
+  void operator=(const Self &) ITK_DELETE_FUNCTION;
+};
+}
+
+#endif
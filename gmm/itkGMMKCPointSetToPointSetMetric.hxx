@@ -8,65 +8,84 @@ namespace itk
 /**
  * Constructor
  */
-template <typename TFixedPointSet, typename TMovingPointSet>
-GMMKCPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>::GMMKCPointSetToPointSetMetric()
+template <typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
+GMMKCPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>::GMMKCPointSetToPointSetMetric()
 {
   this->SetUseFixedPointSetKdTree(true);
   this->SetUseMovingPointSetKdTree(false);
 }
 
 /** Initialize the metric */
-template< typename TFixedPointSet, typename TMovingPointSet >
+template< typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType >
 void
-GMMKCPointSetToPointSetMetric< TFixedPointSet, TMovingPointSet >
+GMMKCPointSetToPointSetMetric< TFixedPointSet, TMovingPointSet, TInternalComputationValueType >
 ::Initialize() throw (ExceptionObject)
 {
   Superclass::Initialize();
 
-  const double factor = (double) this->m_MovingPointSet->GetNumberOfPoints() / (double) this->m_FixedPointSet->GetNumberOfPoints();
+  const double factor = (double) this->m_MovingPointSet->GetNumberOfPoints() / (double) this->m_NumberOfFixedPoints;
 
-  this->m_NormalizingValueFactor = -factor / (this->m_MovingPointSet->GetNumberOfPoints() * this->m_FixedPointSet->GetNumberOfPoints());
+  this->m_NormalizingValueFactor = -factor / (this->m_MovingPointSet->GetNumberOfPoints() * this->m_NumberOfFixedPoints);
 
   this->m_NormalizingDerivativeFactor = -4.0 * factor * this->m_NormalizingValueFactor;
 }
 
-template<typename TFixedPointSet, typename TMovingPointSet>
-typename GMMKCPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
+template<typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
+typename GMMKCPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
 ::MeasureType
-GMMKCPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
-::GetLocalNeighborhoodValue(const MovingPointType & point) const
+GMMKCPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::GetLocalValue(const MovingPointIdentifier & id, const MovingPointType & point) const
 {
-  const double scale = this->m_Scale*this->m_Scale;
+  return this->ComputeLocalValue(id, point);
+}
 
-  // compute value for the first sum
-  double value1 = 0;
+template<typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
+void
+GMMKCPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::GetLocalValueAndDerivative(const MovingPointIdentifier & id, const MovingPointType & point, MeasureType & value, LocalDerivativeType & derivative) const
+{
+  const double scale = this->m_Scale * this->m_Scale;
 
-  if (this->m_UseFixedPointSetKdTree) {
-    FixedNeighborsIdentifierType idx;
-    this->m_FixedPointsLocator->Search(point, this->m_Radius * this->m_Scale, idx);
+  this->ComputeLocalValueAndDerivative(id, point, scale, value, derivative);
+}
 
-    for (FixedNeighborsIteratorType it = idx.begin(); it != idx.end(); ++it) {
-      const double distance = point.SquaredEuclideanDistanceTo(this->m_FixedPointSet->GetPoint(*it));
-      const double expval = std::exp(-distance / scale);
-      value1 += expval;
-    }
-  }
-  else {
-    for (FixedPointIterator it = this->m_FixedPointSet->GetPoints()->Begin(); it != this->m_FixedPointSet->GetPoints()->End(); ++it) {
-      const double distance = point.SquaredEuclideanDistanceTo(it.Value());
-      const double expval = std::exp(-distance / scale);
-      value1 += expval;
-    }
-  }
+template<typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
+void
+GMMKCPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::GetLocalValues(const MovingPointIdentifier * ids, const MovingPointIdentifier & begin, const size_t & count, MeasureType * values) const
+{
+  const MovingPointsContainer * points = this->m_TransformedMovingPointSet->GetPoints();
 
-  // compute value for the second sum
-  double value2 = 0;
+  Superclass::ForEachBlockPoint(ids, begin, count, [this, points, values](const size_t & n, const MovingPointIdentifier & id) {
+    values[n] = this->ComputeLocalValue(id, points->ElementAt(id));
+  });
+}
 
-  for (MovingPointIterator it = this->m_TransformedMovingPointSet->GetPoints()->Begin(); it != this->m_TransformedMovingPointSet->GetPoints()->End(); ++it) {
-    const double distance = point.SquaredEuclideanDistanceTo(it.Value());
-    const double expval = std::exp(-distance / scale);
-    value2 += expval;
-  }
+template<typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
+void
+GMMKCPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::GetLocalValuesAndDerivatives(const MovingPointIdentifier * ids, const MovingPointIdentifier & begin, const size_t & count, MeasureType * values, LocalDerivativeType * derivatives) const
+{
+  const MovingPointsContainer * points = this->m_TransformedMovingPointSet->GetPoints();
+
+  const double scale = this->m_Scale * this->m_Scale;
+
+  Superclass::ForEachBlockPoint(ids, begin, count, [this, points, scale, values, derivatives](const size_t & n, const MovingPointIdentifier & id) {
+    this->ComputeLocalValueAndDerivative(id, points->ElementAt(id), scale, values[n], derivatives[n]);
+  });
+}
+
+template<typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
+typename GMMKCPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::MeasureType
+GMMKCPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::ComputeLocalValue(const MovingPointIdentifier & id, const MovingPointType & point) const
+{
+  // compute value for the first sum
+  const double value1 = this->template ComputeFixedKernelSum<InternalComputationValueType>(point, id);
+
+  // compute value for the second sum
+  const double value2 = this->template ComputeMovingKernelSum<InternalComputationValueType>(point);
 
   // compute local value
   const double ratio = value1 / value2;
@@ -75,61 +94,18 @@ GMMKCPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
   return value;
 }
 
-template<typename TFixedPointSet, typename TMovingPointSet>
+template<typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
 void
-GMMKCPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
-::GetLocalNeighborhoodValueAndDerivative(const MovingPointType & point, MeasureType & value, LocalDerivativeType & derivative) const
+GMMKCPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::ComputeLocalValueAndDerivative(const MovingPointIdentifier & id, const MovingPointType & point, const double & scale, MeasureType & value, LocalDerivativeType & derivative) const
 {
-  const double scale = this->m_Scale * this->m_Scale;
-
   // compute gradient for the first sum
-  double value1 = 0;
   LocalDerivativeType derivative1;
-  derivative1.Fill(0);
-
-  if (this->m_UseFixedPointSetKdTree) {
-    FixedNeighborsIdentifierType idx;
-    this->m_FixedPointsLocator->Search(point, this->m_Radius * this->m_Scale, idx);
-
-    for (FixedNeighborsIteratorType it = idx.begin(); it != idx.end(); ++it) {
-      const FixedPointType & fixedPoint = this->m_FixedPointSet->GetPoint(*it);
-      const double distance = point.SquaredEuclideanDistanceTo(fixedPoint);
-      const double expval = std::exp(-distance / scale);
-      value1 += expval;
-
-      for (size_t dim = 0; dim < this->PointDimension; ++dim) {
-        derivative1[dim] += expval * (point[dim] - fixedPoint[dim]) / scale;
-      }
-    }
-  }
-  else {
-    for (FixedPointIterator it = this->m_FixedPointSet->GetPoints()->Begin(); it != this->m_FixedPointSet->GetPoints()->End(); ++it) {
-      const FixedPointType & fixedPoint = it.Value();
-      const double distance = point.SquaredEuclideanDistanceTo(fixedPoint);
-      const double expval = std::exp(-distance / scale);
-      value1 += expval;
-
-      for (size_t dim = 0; dim < this->PointDimension; ++dim) {
-        derivative1[dim] += expval * (point[dim] - fixedPoint[dim]) / scale;
-      }
-    }
-  }
+  const double value1 = this->template ComputeFixedKernelSum<InternalComputationValueType>(point, derivative1, id);
 
   // compute gradient for the second part
-  double value2 = 0;
   LocalDerivativeType derivative2;
-  derivative2.Fill(0);
-
-  for (MovingPointIterator it = this->m_TransformedMovingPointSet->GetPoints()->Begin(); it != this->m_TransformedMovingPointSet->GetPoints()->End(); ++it) {
-    const MovingPointType & transformedPoint = it.Value();
-    const double distance = point.SquaredEuclideanDistanceTo(transformedPoint);
-    const double expval = std::exp(-distance / scale);
-    value2 += expval;
-
-    for (size_t dim = 0; dim < this->PointDimension; ++dim) {
-      derivative2[dim] += expval * (point[dim] - transformedPoint[dim]) / scale;
-    }
-  }
+  const double value2 = this->template ComputeMovingKernelSum<InternalComputationValueType>(point, derivative2);
 
   // compute local value
   const double ratio = value1 / value2;
@@ -137,9 +113,26 @@ GMMKCPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
 
   // compute local derivatives
   for (size_t dim = 0; dim < this->PointDimension; ++dim) {
-    derivative[dim] = (derivative1[dim] - derivative2[dim] * ratio) * ratio;
+    derivative[dim] = (derivative1[dim] - derivative2[dim] * ratio) * ratio / scale;
   }
 }
+
+template<typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
+typename GMMKCPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::MeasureType
+GMMKCPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::GetLocalNeighborhoodValue(const MovingPointType & point) const
+{
+  return this->GetLocalValue(Superclass::UndefinedPointIdentifier(), point);
+}
+
+template<typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
+void
+GMMKCPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::GetLocalNeighborhoodValueAndDerivative(const MovingPointType & point, MeasureType & value, LocalDerivativeType & derivative) const
+{
+  this->GetLocalValueAndDerivative(Superclass::UndefinedPointIdentifier(), point, value, derivative);
+}
 }
 
 #endif
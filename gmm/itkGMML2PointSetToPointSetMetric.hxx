@@ -8,17 +8,17 @@ namespace itk
 /**
  * Constructor
  */
-template <typename TFixedPointSet, typename TMovingPointSet>
-GMML2PointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>::GMML2PointSetToPointSetMetric()
+template <typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
+GMML2PointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>::GMML2PointSetToPointSetMetric()
 {
   this->SetUseFixedPointSetKdTree(true);
   this->SetUseMovingPointSetKdTree(false);
 }
 
 /** Initialize the metric */
-template< typename TFixedPointSet, typename TMovingPointSet >
+template< typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType >
 void
-GMML2PointSetToPointSetMetric< TFixedPointSet, TMovingPointSet >
+GMML2PointSetToPointSetMetric< TFixedPointSet, TMovingPointSet, TInternalComputationValueType >
 ::Initialize() throw (ExceptionObject)
 {
   Superclass::Initialize();
@@ -28,45 +28,70 @@ GMML2PointSetToPointSetMetric< TFixedPointSet, TMovingPointSet >
   this->m_NormalizingDerivativeFactor = -2.0 * this->m_NormalizingValueFactor / (this->m_Scale * this->m_Scale);
 }
 
-template<typename TFixedPointSet, typename TMovingPointSet>
-typename GMML2PointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
+template<typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
+typename GMML2PointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
 ::MeasureType
-GMML2PointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
-::GetLocalNeighborhoodValue(const MovingPointType & point) const
+GMML2PointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::GetLocalValue(const MovingPointIdentifier & id, const MovingPointType & point) const
 {
-  const double factor1 = this->m_TransformedMovingPointSet->GetNumberOfPoints() * this->m_FixedPointSet->GetNumberOfPoints();
+  const double factor1 = this->m_TransformedMovingPointSet->GetNumberOfPoints() * this->m_NumberOfFixedPoints;
   const double factor2 = this->m_TransformedMovingPointSet->GetNumberOfPoints() * this->m_TransformedMovingPointSet->GetNumberOfPoints();
-  const double scale = this->m_Scale * this->m_Scale;
 
-  // compute value for the first sum
-  double value1 = 0;
+  return this->ComputeLocalValue(id, point, factor1, factor2);
+}
+
+template<typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
+void
+GMML2PointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::GetLocalValueAndDerivative(const MovingPointIdentifier & id, const MovingPointType & point, MeasureType & value, LocalDerivativeType & derivative) const
+{
+  const double factor1 = this->m_NumberOfFixedPoints;
+  const double factor2 = this->m_TransformedMovingPointSet->GetNumberOfPoints();
 
-  if (this->m_UseFixedPointSetKdTree) {
-    FixedNeighborsIdentifierType idx;
-    this->m_FixedPointsLocator->Search(point, this->m_Radius * this->m_Scale, idx);
+  this->ComputeLocalValueAndDerivative(id, point, factor1, factor2, value, derivative);
+}
 
-    for (FixedNeighborsIteratorType it = idx.begin(); it != idx.end(); ++it) {
-      const double distance = point.SquaredEuclideanDistanceTo(this->m_FixedPointSet->GetPoint(*it));
-      const double expval = std::exp(-distance / scale);
-      value1 += expval;
-    }
-  }
-  else {
-    for (FixedPointIterator it = this->m_FixedPointSet->GetPoints()->Begin(); it != this->m_FixedPointSet->GetPoints()->End(); ++it) {
-      const double distance = point.SquaredEuclideanDistanceTo(it.Value());
-      const double expval = std::exp(-distance / scale);
-      value1 += expval;
-    }
-  }
+template<typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
+void
+GMML2PointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::GetLocalValues(const MovingPointIdentifier * ids, const MovingPointIdentifier & begin, const size_t & count, MeasureType * values) const
+{
+  const MovingPointsContainer * points = this->m_TransformedMovingPointSet->GetPoints();
+
+  const double factor1 = this->m_TransformedMovingPointSet->GetNumberOfPoints() * this->m_NumberOfFixedPoints;
+  const double factor2 = this->m_TransformedMovingPointSet->GetNumberOfPoints() * this->m_TransformedMovingPointSet->GetNumberOfPoints();
+
+  Superclass::ForEachBlockPoint(ids, begin, count, [this, points, factor1, factor2, values](const size_t & n, const MovingPointIdentifier & id) {
+    values[n] = this->ComputeLocalValue(id, points->ElementAt(id), factor1, factor2);
+  });
+}
+
+template<typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
+void
+GMML2PointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::GetLocalValuesAndDerivatives(const MovingPointIdentifier * ids, const MovingPointIdentifier & begin, const size_t & count, MeasureType * values, LocalDerivativeType * derivatives) const
+{
+  const MovingPointsContainer * points = this->m_TransformedMovingPointSet->GetPoints();
+
+  const double factor1 = this->m_NumberOfFixedPoints;
+  const double factor2 = this->m_TransformedMovingPointSet->GetNumberOfPoints();
+
+  Superclass::ForEachBlockPoint(ids, begin, count, [this, points, factor1, factor2, values, derivatives](const size_t & n, const MovingPointIdentifier & id) {
+    this->ComputeLocalValueAndDerivative(id, points->ElementAt(id), factor1, factor2, values[n], derivatives[n]);
+  });
+}
+
+template<typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
+typename GMML2PointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::MeasureType
+GMML2PointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::ComputeLocalValue(const MovingPointIdentifier & id, const MovingPointType & point, const double & factor1, const double & factor2) const
+{
+  // compute value for the first sum
+  const double value1 = this->template ComputeFixedKernelSum<InternalComputationValueType>(point, id);
 
   // compute value for the second sum
-  double value2 = 0;
- 
-  for (MovingPointIterator it = this->m_TransformedMovingPointSet->GetPoints()->Begin(); it != this->m_TransformedMovingPointSet->GetPoints()->End(); ++it) {
-    const double distance = point.SquaredEuclideanDistanceTo(it.Value());
-    const double expval = std::exp(-distance / scale);
-    value2 += expval;
-  }
+  const double value2 = this->template ComputeMovingKernelSum<InternalComputationValueType>(point);
 
   // local value
   const double value = value2 / factor2 - 2.0 * value1 / factor1;
@@ -74,63 +99,18 @@ GMML2PointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
   return value;
 }
 
-template<typename TFixedPointSet, typename TMovingPointSet>
+template<typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
 void
-GMML2PointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
-::GetLocalNeighborhoodValueAndDerivative(const MovingPointType & point, MeasureType & value, LocalDerivativeType & derivative) const
+GMML2PointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::ComputeLocalValueAndDerivative(const MovingPointIdentifier & id, const MovingPointType & point, const double & factor1, const double & factor2, MeasureType & value, LocalDerivativeType & derivative) const
 {
-  const double factor1 = this->m_FixedPointSet->GetNumberOfPoints();
-  const double factor2 = this->m_TransformedMovingPointSet->GetNumberOfPoints();
-  const double scale = this->m_Scale * this->m_Scale;
-
   // compute value and derivative gradient for the first sum
-  double value1 = 0;
   LocalDerivativeType derivative1;
-  derivative1.Fill(NumericTraits<DerivativeValueType>::ZeroValue());
-
-  if (this->m_UseFixedPointSetKdTree) {
-    FixedNeighborsIdentifierType idx;
-    this->m_FixedPointsLocator->Search(point, this->m_Radius * this->m_Scale, idx);
-
-    for (FixedNeighborsIteratorType it = idx.begin(); it != idx.end(); ++it) {
-      const FixedPointType & fixedPoint = this->m_FixedPointSet->GetPoint(*it);
-      const double distance = point.SquaredEuclideanDistanceTo(fixedPoint);
-      const double expval = std::exp(-distance / scale);
-      value1 += expval;
-
-      for (size_t dim = 0; dim < this->PointDimension; ++dim) {
-        derivative1[dim] += expval * (point[dim] - fixedPoint[dim]);
-      }
-    }
-  }
-  else {
-    for (FixedPointIterator it = this->m_FixedPointSet->GetPoints()->Begin(); it != this->m_FixedPointSet->GetPoints()->End(); ++it) {
-      const FixedPointType & fixedPoint = it.Value();
-      const double distance = point.SquaredEuclideanDistanceTo(fixedPoint);
-      const double expval = std::exp(-distance / scale);
-      value1 += expval;
-
-      for (size_t dim = 0; dim < this->PointDimension; ++dim) {
-        derivative1[dim] += expval * (point[dim] - fixedPoint[dim]);
-      }
-    }
-  }
+  const double value1 = this->template ComputeFixedKernelSum<InternalComputationValueType>(point, derivative1, id);
 
   // compute derivatives for the second part
-  double value2 = 0;
   LocalDerivativeType derivative2;
-  derivative2.Fill(NumericTraits<DerivativeValueType>::ZeroValue());
-
-  for (MovingPointIterator it = this->m_TransformedMovingPointSet->GetPoints()->Begin(); it != this->m_TransformedMovingPointSet->GetPoints()->End(); ++it) {
-    const MovingPointType & transformedPoint = it.Value();
-    const double distance = point.SquaredEuclideanDistanceTo(transformedPoint);
-    const double expval = std::exp(-distance / scale);
-    value2 += expval;
-
-    for (size_t dim = 0; dim < this->PointDimension; ++dim) {
-      derivative2[dim] += expval * (point[dim] - transformedPoint[dim]);
-    }
-  }
+  const double value2 = this->template ComputeMovingKernelSum<InternalComputationValueType>(point, derivative2);
 
   // local value
   value = value2 / factor2 - 2.0 * value1 / factor1;
@@ -140,6 +120,23 @@ GMML2PointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
     derivative[dim] = (derivative2[dim] / factor2 - 2.0 * derivative1[dim] / factor1);
   }
 }
+
+template<typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
+typename GMML2PointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::MeasureType
+GMML2PointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::GetLocalNeighborhoodValue(const MovingPointType & point) const
+{
+  return this->GetLocalValue(Superclass::UndefinedPointIdentifier(), point);
+}
+
+template<typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
+void
+GMML2PointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::GetLocalNeighborhoodValueAndDerivative(const MovingPointType & point, MeasureType & value, LocalDerivativeType & derivative) const
+{
+  this->GetLocalValueAndDerivative(Superclass::UndefinedPointIdentifier(), point, value, derivative);
+}
 }
 
 #endif
@@ -15,7 +15,7 @@ namespace itk
  * Spatial correspondence between both images is established through a
  * Transform.
  */
-template< typename TFixedPointSet, typename TMovingPointSet = TFixedPointSet >
+template< typename TFixedPointSet, typename TMovingPointSet = TFixedPointSet, typename TInternalComputationValueType = double >
 class GMML2RigidPointSetToPointSetMetric : public GMMPointSetToPointSetMetricBase < TFixedPointSet, TMovingPointSet >
 {
 public:
@@ -37,6 +37,8 @@ public:
   typedef typename Superclass::FixedPointIterator             FixedPointIterator;
   typedef typename Superclass::MovingPointType                MovingPointType;
   typedef typename Superclass::MovingPointIterator            MovingPointIterator;
+  typedef typename Superclass::MovingPointIdentifier          MovingPointIdentifier;
+  typedef typename Superclass::MovingPointsContainer          MovingPointsContainer;
   typedef typename Superclass::DerivativeValueType            DerivativeValueType;
   typedef typename Superclass::LocalDerivativeType            LocalDerivativeType;
   typedef typename Superclass::FixedNeighborsIdentifierType   FixedNeighborsIdentifierType;
@@ -44,12 +46,26 @@ public:
   typedef typename Superclass::FixedNeighborsIteratorType     FixedNeighborsIteratorType;
   typedef typename Superclass::MovingNeighborsIteratorType    MovingNeighborsIteratorType;
 
+  /** Type used to evaluate the kernels, the sums are accumulated in double precision. */
+  typedef TInternalComputationValueType                       InternalComputationValueType;
+
   /** Calculates the local metric value for a single point.*/
   virtual MeasureType GetLocalNeighborhoodValue(const MovingPointType & point) const ITK_OVERRIDE;
 
   /** Calculates the local value/derivative for a single point.*/
   virtual void GetLocalNeighborhoodValueAndDerivative(const MovingPointType &, MeasureType &, LocalDerivativeType &) const ITK_OVERRIDE;
 
+  /** Calculates the local value and value/derivative for the transformed moving point with the identifier,
+   * the identifier selects the neighbour list of the fixed points.*/
+  virtual MeasureType GetLocalValue(const MovingPointIdentifier & id, const MovingPointType & point) const ITK_OVERRIDE;
+
+  virtual void GetLocalValueAndDerivative(const MovingPointIdentifier & id, const MovingPointType & point, MeasureType & value, LocalDerivativeType & derivative) const ITK_OVERRIDE;
+
+  /** Calculates the local values and value/derivatives for the block of the transformed moving points.*/
+  virtual void GetLocalValues(const MovingPointIdentifier * ids, const MovingPointIdentifier & begin, const size_t & count, MeasureType * values) const ITK_OVERRIDE;
+
+  virtual void GetLocalValuesAndDerivatives(const MovingPointIdentifier * ids, const MovingPointIdentifier & begin, const size_t & count, MeasureType * values, LocalDerivativeType * derivatives) const ITK_OVERRIDE;
+
   /** Initialize the Metric by making sure that all the components are present and plugged together correctly.*/
   virtual void Initialize() throw (ExceptionObject) ITK_OVERRIDE;
 
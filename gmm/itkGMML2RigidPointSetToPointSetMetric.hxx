@@ -8,95 +8,82 @@ namespace itk
 /**
  * Constructor
  */
-template <typename TFixedPointSet, typename TMovingPointSet>
-GMML2RigidPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>::GMML2RigidPointSetToPointSetMetric()
+template <typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
+GMML2RigidPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>::GMML2RigidPointSetToPointSetMetric()
 {
   this->SetUseFixedPointSetKdTree(true);
   this->SetUseMovingPointSetKdTree(false);
 }
 
 /** Initialize the metric */
-template< typename TFixedPointSet, typename TMovingPointSet >
+template< typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType >
 void
-GMML2RigidPointSetToPointSetMetric< TFixedPointSet, TMovingPointSet >
+GMML2RigidPointSetToPointSetMetric< TFixedPointSet, TMovingPointSet, TInternalComputationValueType >
 ::Initialize() throw (ExceptionObject)
 {
   Superclass::Initialize();
 
-  this->m_NormalizingValueFactor = -2.0 / (this->m_MovingPointSet->GetNumberOfPoints() * this->m_FixedPointSet->GetNumberOfPoints());
+  this->m_NormalizingValueFactor = -2.0 / (this->m_MovingPointSet->GetNumberOfPoints() * this->m_NumberOfFixedPoints);
 
   this->m_NormalizingDerivativeFactor = -2.0 * this->m_NormalizingValueFactor / (this->m_Scale * this->m_Scale);
 }
 
-template<typename TFixedPointSet, typename TMovingPointSet>
-typename GMML2RigidPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
+template<typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
+typename GMML2RigidPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
 ::MeasureType
-GMML2RigidPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
-::GetLocalNeighborhoodValue(const MovingPointType & point) const
+GMML2RigidPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::GetLocalValue(const MovingPointIdentifier & id, const MovingPointType & point) const
 {
-  const double scale = this->m_Scale * this->m_Scale;
-
-  MeasureType value = NumericTraits<MeasureType>::ZeroValue();
-
-  if (this->m_UseFixedPointSetKdTree) {
-    FixedNeighborsIdentifierType idx;
-    this->m_FixedPointsLocator->Search(point, this->m_Radius * this->m_Scale, idx);
-
-    for (FixedNeighborsIteratorType it = idx.begin(); it != idx.end(); ++it) {
-      const double distance = point.SquaredEuclideanDistanceTo(this->m_FixedPointSet->GetPoint(*it));
-      const double expval = std::exp(-distance / scale);
-      value += expval;
-    }
-  }
-  else {
-    for (FixedPointIterator it = this->m_FixedPointSet->GetPoints()->Begin(); it != this->m_FixedPointSet->GetPoints()->End(); ++it) {
-      const double distance = point.SquaredEuclideanDistanceTo(it.Value());
-      const double expval = std::exp(-distance / scale);
-      value += expval;
-    }
-  }
-
-  return value;
+  return this->template ComputeFixedKernelSum<InternalComputationValueType>(point, id);
 }
 
-template<typename TFixedPointSet, typename TMovingPointSet>
+template<typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
 void
-GMML2RigidPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
-::GetLocalNeighborhoodValueAndDerivative(const MovingPointType & point, MeasureType & value, LocalDerivativeType & derivative) const
+GMML2RigidPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::GetLocalValueAndDerivative(const MovingPointIdentifier & id, const MovingPointType & point, MeasureType & value, LocalDerivativeType & derivative) const
 {
-  const double scale = this->m_Scale * this->m_Scale;
+  value = this->template ComputeFixedKernelSum<InternalComputationValueType>(point, derivative, id);
+}
 
-  value = NumericTraits<MeasureType>::ZeroValue();
+template<typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
+void
+GMML2RigidPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::GetLocalValues(const MovingPointIdentifier * ids, const MovingPointIdentifier & begin, const size_t & count, MeasureType * values) const
+{
+  const MovingPointsContainer * points = this->m_TransformedMovingPointSet->GetPoints();
 
-  derivative.Fill(NumericTraits<DerivativeValueType>::ZeroValue());
+  Superclass::ForEachBlockPoint(ids, begin, count, [this, points, values](const size_t & n, const MovingPointIdentifier & id) {
+    values[n] = this->template ComputeFixedKernelSum<InternalComputationValueType>(points->ElementAt(id), id);
+  });
+}
 
-  if (this->m_UseFixedPointSetKdTree) {
-    FixedNeighborsIdentifierType idx;
-    this->m_FixedPointsLocator->Search(point, this->m_Radius * this->m_Scale, idx);
+template<typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
+void
+GMML2RigidPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::GetLocalValuesAndDerivatives(const MovingPointIdentifier * ids, const MovingPointIdentifier & begin, const size_t & count, MeasureType * values, LocalDerivativeType * derivatives) const
+{
+  const MovingPointsContainer * points = this->m_TransformedMovingPointSet->GetPoints();
 
-    for (FixedNeighborsIteratorType it = idx.begin(); it != idx.end(); ++it) {
-      const FixedPointType & fixedPoint = this->m_FixedPointSet->GetPoint(*it);
-      const double distance = point.SquaredEuclideanDistanceTo(fixedPoint);
-      const double expval = std::exp(-distance / scale);
-      value += expval;
+  Superclass::ForEachBlockPoint(ids, begin, count, [this, points, values, derivatives](const size_t & n, const MovingPointIdentifier & id) {
+    values[n] = this->template ComputeFixedKernelSum<InternalComputationValueType>(points->ElementAt(id), derivatives[n], id);
+  });
+}
 
-      for (size_t dim = 0; dim < this->PointDimension; ++dim) {
-        derivative[dim] += expval * (point[dim] - fixedPoint[dim]);
-      }
-    }
-  }
-  else {
-    for (FixedPointIterator it = this->m_FixedPointSet->GetPoints()->Begin(); it != this->m_FixedPointSet->GetPoints()->End(); ++it) {
-      const FixedPointType & fixedPoint = it.Value();
-      const double distance = point.SquaredEuclideanDistanceTo(fixedPoint);
-      const double expval = std::exp(-distance / scale);
-      value += expval;
+template<typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
+typename GMML2RigidPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::MeasureType
+GMML2RigidPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::GetLocalNeighborhoodValue(const MovingPointType & point) const
+{
+  return this->GetLocalValue(Superclass::UndefinedPointIdentifier(), point);
+}
 
-      for (size_t dim = 0; dim < this->PointDimension; ++dim) {
-        derivative[dim] += expval * (point[dim] - fixedPoint[dim]);
-      }
-    }
-  }
+template<typename TFixedPointSet, typename TMovingPointSet, typename TInternalComputationValueType>
+void
+GMML2RigidPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType>
+::GetLocalNeighborhoodValueAndDerivative(const MovingPointType & point, MeasureType & value, LocalDerivativeType & derivative) const
+{
+  this->GetLocalValueAndDerivative(Superclass::UndefinedPointIdentifier(), point, value, derivative);
 }
 }
 
@@ -23,6 +23,10 @@
 #include "itkPointSet.h"
 #include "itkMacro.h"
 #include "itkPointsLocator.h"
+#include "itkGaussianSumTree.h"
+#include "itkPointsKdTreeIndex.h"
+#include "itkControlPointsKernelTransform.h"
+#include <vector>
 
 namespace itk
 {
@@ -82,11 +86,14 @@ public:
   typedef typename FixedPointSetType::PointsContainer                     FixedPointsContainer;
   typedef typename FixedPointSetType::PointsContainer::Pointer            FixedPointsPointer;
   typedef typename FixedPointsContainer::ConstIterator                    FixedPointIterator;
+  typedef typename FixedPointSetType::PointDataContainer                  FixedPointDataContainer;
   typedef typename FixedPointSetType::PointDataContainer::ConstIterator   FixedPointDataIterator;
   typedef itk::PointsLocator<FixedPointsContainer>                        FixedPointsLocatorType;
   typedef typename FixedPointsLocatorType::NeighborsIdentifierType        FixedNeighborsIdentifierType;
   typedef typename FixedNeighborsIdentifierType::const_iterator           FixedNeighborsIteratorType;
+  typedef PointsKdTreeIndex<FixedPointsContainer>                         FixedPointsIndexType;
 
+  typedef typename MovingPointSetType::PointIdentifier                    MovingPointIdentifier;
   typedef typename MovingPointSetType::PointsContainer                    MovingPointsContainer;
   typedef typename MovingPointSetType::PointsContainer::Pointer           MovingPointsPointer;
   typedef typename MovingPointsContainer::ConstIterator                   MovingPointIterator;
@@ -95,6 +102,10 @@ public:
   typedef typename MovingPointsLocatorType::NeighborsIdentifierType       MovingNeighborsIdentifierType;
   typedef typename MovingNeighborsIdentifierType::const_iterator          MovingNeighborsIteratorType;
 
+  /** Types of the trees to approximate the kernel sums. */
+  typedef GaussianSumTree<FixedPointsContainer>                           FixedGaussianSumTreeType;
+  typedef GaussianSumTree<MovingPointsContainer>                          MovingGaussianSumTreeType;
+
   /**  Type of the Transform Base class */
   typedef Transform< CoordinateRepresentationType,
                      itkGetStaticConstMacro(MovingPointSetDimension),
@@ -106,6 +117,9 @@ public:
   typedef typename TransformType::ParametersType  TransformParametersType;
   typedef typename TransformType::JacobianType    TransformJacobianType;
 
+  /** Type of the deformable transform, its basis at the moving points is cached. */
+  typedef ControlPointsKernelTransform< CoordinateRepresentationType, PointDimension > KernelTransformType;
+
   /**  Type of the measure. */
   typedef Superclass::MeasureType MeasureType;
 
@@ -136,15 +150,160 @@ public:
   itkSetMacro(UseMovingPointSetKdTree, bool);
   itkGetMacro(UseMovingPointSetKdTree, bool);
 
+  /** Get/Set the prebuilt index of the fixed points, which replaces the kd-tree. It is used if it
+   * matches the fixed point set, otherwise it is ignored and the kd-tree is built. */
+  itkSetConstObjectMacro(FixedPointsIndex, FixedPointsIndexType);
+  itkGetConstObjectMacro(FixedPointsIndex, FixedPointsIndexType);
+
   itkSetMacro(Radius, double);
   itkGetMacro(Radius, double);
 
+  /** Get/Set the target relative error of the truncated kernel sums. If it is positive, the
+   * search radius is derived from the error and the point spacing at each level instead of
+   * the Radius. */
+  itkSetMacro(RelativeError, double);
+  itkGetMacro(RelativeError, double);
+
+  /** Get/Set the spacing of the point sets, i.e. the mean distance to the nearest neighbour. */
+  itkSetMacro(PointSpacing, double);
+  itkGetMacro(PointSpacing, double);
+
+  /** Get/Set the number of the fixed points to normalize the metric. If the fixed point set is cropped
+   * to the region of overlap, it is the number of points in the whole set, so the values are comparable
+   * between the levels. Zero means the number of points in the fixed point set. */
+  itkSetMacro(TotalNumberOfFixedPoints, size_t);
+  itkGetMacro(TotalNumberOfFixedPoints, size_t);
+
+  /** Get/Set boolean flag to weight the Gaussian kernels of the fixed points by the point data, e.g. by the
+   * numbers of the points merged into the components of the reduced fixed point set. The point data must
+   * match the points. The metric is normalized by the sum of the weights, which is rounded to the number
+   * of the fixed points. The weights are not supported by the Gaussian sum tree. */
+  itkSetMacro(UseFixedPointWeights, bool);
+  itkGetMacro(UseFixedPointWeights, bool);
+  itkBooleanMacro(UseFixedPointWeights);
+
+  /** Get/Set boolean flag to approximate the kernel sums over the fixed and the transformed moving
+   * points by the Gaussian sum trees. It replaces the truncated sums, which revert to the brute force
+   * at the coarse scales. */
+  itkSetMacro(UseGaussianSumTree, bool);
+  itkGetMacro(UseGaussianSumTree, bool);
+  itkBooleanMacro(UseGaussianSumTree);
+
+  /** Get/Set the target relative error of the sums approximated by the trees. */
+  itkSetMacro(GaussianSumTreeError, double);
+  itkGetMacro(GaussianSumTreeError, double);
+
+  /** Get/Set boolean flag to evaluate the metric over the random subset of the moving points. The
+   * subset is stratified over the point identifiers, the value and the derivative are scaled by the
+   * ratio of the numbers of points, so they are unbiased estimates over the whole moving point set. */
+  itkSetMacro(UseMiniBatch, bool);
+  itkGetMacro(UseMiniBatch, bool);
+  itkBooleanMacro(UseMiniBatch);
+
+  /** Get/Set the initial number of the moving points in the subset and the factor to increase
+   * it after each evaluation. The number is not reset between levels, so the subset grows over the
+   * iterations of all levels up to the whole moving point set. */
+  itkSetMacro(MiniBatchSize, size_t);
+  itkGetMacro(MiniBatchSize, size_t);
+
+  itkSetMacro(MiniBatchGrowthFactor, double);
+  itkGetMacro(MiniBatchGrowthFactor, double);
+
+  /** Get/Set boolean flag to keep the lists of the fixed points in the search radius enlarged by the skin
+   * for each moving point. The lists are reused between evaluations and rebuilt after some transformed
+   * moving point has moved farther than the skin, so the fixed points are not searched at each evaluation.
+   * The lists are used with the kd-tree of the fixed points, the skin is given in units of scale. */
+  itkSetMacro(UseNeighborLists, bool);
+  itkGetMacro(UseNeighborLists, bool);
+  itkBooleanMacro(UseNeighborLists);
+
+  itkSetMacro(NeighborListSkin, double);
+  itkGetMacro(NeighborListSkin, double);
+
+  /** Get the number of times the neighbour lists have been rebuilt since the metric was initialized. */
+  itkGetConstMacro(NumberOfNeighborListUpdates, size_t);
+
+  /** Get/Set boolean flag to evaluate the approximate metric. The approximate evaluations use the fixed
+   * stratified subset of the moving points given by the ApproximationSamplingFraction, the search radius
+   * derived from the ApproximationRelativeError and the kernels in single precision. They are cheap
+   * enough for the first iterations at a level, which are far from the optimum. */
+  itkSetMacro(UseApproximation, bool);
+  itkGetMacro(UseApproximation, bool);
+  itkBooleanMacro(UseApproximation);
+
+  itkSetMacro(ApproximationSamplingFraction, double);
+  itkGetMacro(ApproximationSamplingFraction, double);
+
+  itkSetMacro(ApproximationRelativeError, double);
+  itkGetMacro(ApproximationRelativeError, double);
+
+  /** Get the search radius of the approximate evaluations at the current level. */
+  itkGetConstMacro(ApproximateSearchRadius, double);
+
+  /** Get/Set the number of the moving points passed to the block evaluations at once. The blocks are
+   * evaluated in parallel by the tasks of the TaskScheduler. */
+  itkSetMacro(BlockSize, size_t);
+  itkGetMacro(BlockSize, size_t);
+
+  /** Get/Set boolean flag to add the partial sums of the blocks by the pairwise summation in the order of
+   * the blocks, so the value and the derivative are reproducible bit for bit for any number of threads.
+   * Otherwise the partial sums of the tasks are added in the order the tasks finish. */
+  itkSetMacro(UseReproducibleSum, bool);
+  itkGetMacro(UseReproducibleSum, bool);
+  itkBooleanMacro(UseReproducibleSum);
+
+  /** Get/Set the seed of the random generator, the sequence of subsets is reproducible for the seed. */
+  itkSetMacro(RandomSeed, unsigned int);
+  itkGetMacro(RandomSeed, unsigned int);
+
+  /** Get the number of the moving points evaluated in the last subset. */
+  itkGetConstMacro(CurrentMiniBatchSize, size_t);
+
+  /** Get the search radius and the estimate of the relative truncation error at the current level. */
+  itkGetConstMacro(SearchRadius, double);
+  itkGetConstMacro(TruncationError, double);
+
+  /** Get/Set relative tolerances of the metric value and the transform parameters changes
+   * between two consecutive evaluations. If the changes are below the positive tolerances the
+   * evaluation is stopped by the ProcessAborted exception. A zero tolerance disables its check,
+   * the check is disabled if both tolerances are zero. */
+  itkSetMacro(ValueTolerance, double);
+  itkGetMacro(ValueTolerance, double);
+
+  itkSetMacro(ParametersTolerance, double);
+  itkGetMacro(ParametersTolerance, double);
+
+  /** Get the result of the convergence check and the parameters of the last evaluation. */
+  itkGetConstMacro(Converged, bool);
+  itkGetConstReferenceMacro(LastParameters, ParametersType);
+  itkGetConstMacro(LastValue, MeasureType);
+
+  /** Get the parameters and the value of the best evaluation since the last reset of the convergence check.
+   * The line searches evaluate the trial points, which may be rejected, so the registration returns these
+   * parameters if the optimizer is aborted. The values of the random mini-batches are not comparable, so
+   * with the mini-batches the last evaluation is kept, the stochastic optimizers accept every step. */
+  itkGetConstReferenceMacro(BestParameters, ParametersType);
+  itkGetConstMacro(BestValue, MeasureType);
+
   /** Connect the Transform. */
   itkSetObjectMacro(Transform, TransformType);
 
   /** Get a pointer to the Transform.  */
   itkGetModifiableObjectMacro(Transform, TransformType);
 
+  /** Get/Set the initial transforms of the point sets. The moving points are mapped by the Transform
+   * composed with the MovingInitialTransform. The FixedInitialTransform must be rigid, the inverse of it
+   * is applied to the transformed moving points, which preserves the distances, so the fixed points,
+   * the trees and the index are used in place instead of the transformed copy of the fixed point set. */
+  itkSetObjectMacro(MovingInitialTransform, TransformType);
+  itkGetModifiableObjectMacro(MovingInitialTransform, TransformType);
+
+  itkSetObjectMacro(FixedInitialTransform, TransformType);
+  itkGetModifiableObjectMacro(FixedInitialTransform, TransformType);
+
+  /** Check that the transform is linear and preserves the distances. */
+  static bool IsRigidTransform(const TransformType * transform);
+
   /** Get the value for single valued optimizers. */
   MeasureType GetValue(const TransformParametersType & parameters) const ITK_OVERRIDE;
 
@@ -160,10 +319,50 @@ public:
   /** Calculates the local value/derivative for a single point.*/
   virtual void GetLocalNeighborhoodValueAndDerivative(const MovingPointType &, MeasureType &, LocalDerivativeType &) const = 0;
 
+  /** Calculates the local value and value/derivative for the moving point with the identifier. The
+   * default implementation ignores the identifier, it can be used to keep data for each moving point
+   * between evaluations. */
+  virtual MeasureType GetLocalValue(const MovingPointIdentifier & id, const MovingPointType & point) const
+  {
+    return this->GetLocalNeighborhoodValue(point);
+  }
+
+  virtual void GetLocalValueAndDerivative(const MovingPointIdentifier & id, const MovingPointType & point, MeasureType & value, LocalDerivativeType & derivative) const
+  {
+    this->GetLocalNeighborhoodValueAndDerivative(point, value, derivative);
+  }
+
+  /** Calculates the local values and value/derivatives for the block of the transformed moving points with
+   * the identifiers, or with the contiguous identifiers [begin, begin + count) if ids is null. The metrics
+   * implement them with the constants computed once per block and the kernel sums called without the virtual
+   * dispatch, the default implementations call the point functions. */
+  virtual void GetLocalValues(const MovingPointIdentifier * ids, const MovingPointIdentifier & begin, const size_t & count, MeasureType * values) const;
+
+  virtual void GetLocalValuesAndDerivatives(const MovingPointIdentifier * ids, const MovingPointIdentifier & begin, const size_t & count, MeasureType * values, LocalDerivativeType * derivatives) const;
+
+  /** Call function(n, id) for the points of the block, the contiguous identifiers are looped without the indirection. */
+  template <typename TFunction>
+  static void ForEachBlockPoint(const MovingPointIdentifier * ids, const MovingPointIdentifier & begin, const size_t & count, const TFunction & function)
+  {
+    if (ids) {
+      for (size_t n = 0; n < count; ++n) {
+        function(n, ids[n]);
+      }
+    }
+    else {
+      for (size_t n = 0; n < count; ++n) {
+        function(n, static_cast<MovingPointIdentifier>(begin + n));
+      }
+    }
+  }
+
   /** Initialize to prepare for a particular iteration, generally an iteration of optimization. Distinct from Initialize()
   * which is a one-time initialization. */
   virtual void InitializeForIteration(const ParametersType & parameters) const;
 
+  /** Select the subset of the moving points evaluated in the current iteration. */
+  void SampleMiniBatch() const;
+
   /** Set the parameters defining the Transform. */
   void SetTransformParameters(const ParametersType & parameters) const;
 
@@ -176,11 +375,85 @@ public:
   virtual void Initialize(void)
   throw ( ExceptionObject );
 
+  /** Compute the search radius and the truncation error estimate for the current scale. */
+  void ComputeSearchRadius();
+
+  /** Reset the convergence check, so the next evaluation is not compared with the previous ones. */
+  void ResetConvergenceCheck();
+
 protected:
   GMMPointSetToPointSetMetricBase();
   virtual ~GMMPointSetToPointSetMetricBase() {}
   void InitializeFixedTree();
   void InitializeMovingTree();
+  void InitializeFixedGaussianSumTree();
+
+  /** Queries of the fixed points by the prebuilt index if it is used, otherwise by the kd-tree. */
+  void SearchFixedPoints(const MovingPointType & point, const double & radius, FixedNeighborsIdentifierType & idx) const;
+  typename FixedPointsLocatorType::PointIdentifier FindClosestFixedPoint(const MovingPointType & point) const;
+  void FindClosestFixedPoints(const MovingPointType & point, const size_t & numberOfNeighbors, FixedNeighborsIdentifierType & idx) const;
+
+  /** Identifier of the point which is not one of the transformed moving points, the neighbour lists are not used for it. */
+  static MovingPointIdentifier UndefinedPointIdentifier()
+  {
+    return NumericTraits<MovingPointIdentifier>::max();
+  }
+
+  /** Check the displacements of the transformed moving points and invalidate the neighbour lists if needed. */
+  void UpdateNeighborLists() const;
+
+  /** Get the neighbour list of the moving point, it is built on the first request after the update. Null is
+   * returned if the lists are not used. */
+  const FixedNeighborsIdentifierType * GetNeighborList(const MovingPointIdentifier & id) const;
+
+  /** Compute sums of the Gaussian kernel values over the fixed points in the search radius and over
+   * the transformed moving points. The kernel is evaluated in the compute value type and the values
+   * are accumulated in double precision. The gradient is the sum of kernel values times (point - x).
+   * The identifier of the transformed moving point selects the neighbour list of the fixed points. */
+  template <typename TComputeValueType>
+  double ComputeFixedKernelSum(const MovingPointType & point, const MovingPointIdentifier & id = UndefinedPointIdentifier()) const;
+
+  template <typename TComputeValueType>
+  double ComputeFixedKernelSum(const MovingPointType & point, LocalDerivativeType & gradient, const MovingPointIdentifier & id = UndefinedPointIdentifier()) const;
+
+  template <typename TComputeValueType>
+  double ComputeMovingKernelSum(const MovingPointType & point) const;
+
+  template <typename TComputeValueType>
+  double ComputeMovingKernelSum(const MovingPointType & point, LocalDerivativeType & gradient) const;
+
+  /** Relative tail of the Gaussian kernel sum over the uniformly distributed points outside the
+   * radius given in units of scale. */
+  static double ComputeTruncationError(const double & radius);
+
+  /** Minimal radius in units of scale with the relative truncation error below the given one. */
+  static double ComputeTruncationRadius(const double & relativeError);
+
+  /** The temporaries of the block evaluations, which are allocated once per task of the calling thread. */
+  struct BlockTemporariesType
+  {
+    BlockTemporariesType(const size_t & blockSize, const size_t & numberOfParameters) :
+      values(blockSize), derivatives(blockSize), jacobian(PointDimension, numberOfParameters), jacobianCache(PointDimension, PointDimension) {}
+
+    std::vector<MeasureType> values;
+    std::vector<LocalDerivativeType> derivatives;
+    TransformJacobianType jacobian;
+    TransformJacobianType jacobianCache;
+  };
+
+  /** Split the evaluated points, i.e. the moving points or the mini-batch, into the blocks of BlockSize points.
+   * The identifiers of the block are the range of the mini-batch, or null for the contiguous moving points. */
+  size_t GetNumberOfBlocks() const;
+  void GetBlockRange(const size_t & block, const MovingPointIdentifier *& ids, MovingPointIdentifier & begin, size_t & count) const;
+
+  /** Sum of the local values over the block and the sums of the local values and the derivatives with respect
+   * to the parameters added to the arrays, the temporaries are the ones of the calling thread. */
+  MeasureType ComputeBlockValue(const size_t & block, BlockTemporariesType & temporaries) const;
+  void ComputeBlockValueAndDerivative(const size_t & block, double & value, double * derivative, BlockTemporariesType & temporaries) const;
+
+  /** Compare the current evaluation with the previous one and abort evaluations if converged. */
+  void CheckConvergence(const ParametersType & parameters, const MeasureType & value) const;
+
   virtual void PrintSelf(std::ostream & os, Indent indent) const ITK_OVERRIDE;
 
   FixedPointSetConstPointer m_FixedPointSet;
@@ -190,6 +463,15 @@ protected:
   mutable TransformPointer m_Transform;
   size_t m_NumberOfParameters;
 
+  TransformPointer m_MovingInitialTransform;
+  TransformPointer m_FixedInitialTransform;
+  typename TransformType::InverseTransformBasePointer m_FixedInitialInverseTransform;
+  TransformJacobianType m_FixedInitialInverseJacobian;
+
+  /** The basis of the kernel transform at the moving points, one row per point. */
+  const KernelTransformType * m_KernelTransform;
+  vnl_matrix<double> m_KernelBasis;
+
   mutable TransformJacobianType m_Jacobian;
   mutable TransformJacobianType m_JacobianCache;
 
@@ -197,17 +479,86 @@ protected:
 
   size_t m_NumberOfFixedPoints;
   size_t m_NumberOfMovingPoints;
+  size_t m_TotalNumberOfFixedPoints;
+
+  bool m_UseFixedPointWeights;
+  const FixedPointDataContainer * m_FixedPointWeights;
 
   double m_NormalizingValueFactor;
   double m_NormalizingDerivativeFactor;
 
-  typename FixedPointsLocatorType::Pointer   m_FixedPointsLocator;
+  typename FixedPointsIndexType::Pointer     m_FixedPointsTree;
   typename MovingPointsLocatorType::Pointer  m_MovingPointsLocator;
+  typename FixedPointsIndexType::ConstPointer m_FixedPointsIndex;
+  const FixedPointsContainer * m_FixedTreesPoints;
+  bool m_UseFixedPointsIndex;
   bool m_UseFixedPointSetKdTree;
   bool m_UseMovingPointSetKdTree;
   double m_Radius;
+  double m_RelativeError;
+  double m_PointSpacing;
+  double m_SearchRadius;
+  double m_TruncationError;
+
+  typename FixedGaussianSumTreeType::Pointer          m_FixedGaussianSumTree;
+  mutable typename MovingGaussianSumTreeType::Pointer m_MovingGaussianSumTree;
+  bool m_UseGaussianSumTree;
+  double m_GaussianSumTreeError;
+
+  size_t m_BlockSize;
+  bool m_UseReproducibleSum;
+
+  bool m_UseMiniBatch;
+  size_t m_MiniBatchSize;
+  double m_MiniBatchGrowthFactor;
+  unsigned int m_RandomSeed;
+  mutable size_t m_CurrentMiniBatchSize;
+  mutable size_t m_NumberOfMiniBatches;
+  mutable double m_MiniBatchFactor;
+  mutable std::vector<MovingPointIdentifier> m_MiniBatch;
+
+  bool m_UseNeighborLists;
+  double m_NeighborListSkin;
+  mutable size_t m_NumberOfNeighborListUpdates;
+  mutable std::vector<FixedNeighborsIdentifierType> m_NeighborLists;
+  mutable std::vector<unsigned char> m_NeighborListsBuilt;
+  mutable std::vector<MovingPointType> m_NeighborListsPoints;
+
+  bool m_UseApproximation;
+  double m_ApproximationSamplingFraction;
+  double m_ApproximationRelativeError;
+  double m_ApproximateSearchRadius;
+
+  double m_ValueTolerance;
+  double m_ParametersTolerance;
+  mutable bool m_Converged;
+  mutable size_t m_NumberOfEvaluations;
+  mutable ParametersType m_LastParameters;
+  mutable MeasureType m_LastValue;
+  mutable ParametersType m_BestParameters;
+  mutable MeasureType m_BestValue;
 
 private:
+  /** Kernel value for a pair of points, the difference of the points is returned in the vector. */
+  template <typename TComputeValueType, typename TPoint>
+  static TComputeValueType EvaluateKernel(const MovingPointType & point, const TPoint & x, const TComputeValueType & scale, TComputeValueType * difference)
+  {
+    TComputeValueType distance = 0;
+
+    for (size_t dim = 0; dim < PointDimension; ++dim) {
+      difference[dim] = static_cast<TComputeValueType>(point[dim]) - static_cast<TComputeValueType>(x[dim]);
+      distance += difference[dim] * difference[dim];
+    }
+
+    return std::exp(-distance / scale);
+  }
+
+  /** Weight of the fixed point, it is one if the weights are not used. */
+  double GetFixedPointWeight(const typename FixedPointsContainer::ElementIdentifier & id) const
+  {
+    return m_FixedPointWeights ? static_cast<double>(m_FixedPointWeights->ElementAt(id)) : 1.0;
+  }
+
   GMMPointSetToPointSetMetricBase(const Self &) ITK_DELETE_FUNCTION;
   void operator=(const Self &) ITK_DELETE_FUNCTION;
 };
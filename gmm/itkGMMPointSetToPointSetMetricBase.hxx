@@ -19,6 +19,13 @@
 #define itkGMMPointSetToPointSetMetricBase_hxx
 
 #include "itkGMMPointSetToPointSetMetricBase.h"
+#include "itkMath.h"
+#include "itkPairwiseSum.h"
+#include "itkTaskScheduler.h"
+#include <cmath>
+#include <mutex>
+#include <random>
+#include <type_traits>
 
 namespace itk
 {
@@ -33,6 +40,11 @@ GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >
 
   m_TransformedMovingPointSet = ITK_NULLPTR;
 
+  m_MovingInitialTransform = ITK_NULLPTR;
+  m_FixedInitialTransform = ITK_NULLPTR;
+  m_FixedInitialInverseTransform = ITK_NULLPTR;
+  m_KernelTransform = ITK_NULLPTR;
+
   m_Jacobian.set_size(MovingPointSetDimension, m_NumberOfParameters);
   m_JacobianCache.set_size(MovingPointSetDimension, MovingPointSetDimension);
 
@@ -41,12 +53,54 @@ GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >
   m_Scale = 1;
 
   m_UseFixedPointSetKdTree = false;
-  m_FixedPointsLocator = ITK_NULLPTR;
+  m_FixedPointsTree = ITK_NULLPTR;
 
   m_UseMovingPointSetKdTree = false;
   m_MovingPointsLocator = ITK_NULLPTR;
 
+  m_FixedPointsIndex = ITK_NULLPTR;
+  m_UseFixedPointsIndex = false;
+  m_FixedTreesPoints = ITK_NULLPTR;
+  m_TotalNumberOfFixedPoints = 0;
+  m_UseFixedPointWeights = false;
+  m_FixedPointWeights = ITK_NULLPTR;
+
   m_Radius = 3;
+  m_RelativeError = 0;
+  m_PointSpacing = 0;
+  m_SearchRadius = 0;
+  m_TruncationError = 0;
+
+  m_FixedGaussianSumTree = ITK_NULLPTR;
+  m_MovingGaussianSumTree = ITK_NULLPTR;
+  m_UseGaussianSumTree = false;
+  m_GaussianSumTreeError = 1.0e-03;
+
+  m_UseMiniBatch = false;
+  m_MiniBatchSize = 1000;
+  m_MiniBatchGrowthFactor = 1.05;
+  m_RandomSeed = 0;
+  m_CurrentMiniBatchSize = 0;
+  m_NumberOfMiniBatches = 0;
+  m_MiniBatchFactor = 1;
+
+  m_UseNeighborLists = false;
+  m_NeighborListSkin = 1;
+  m_BlockSize = 256;
+  m_UseReproducibleSum = false;
+  m_NumberOfNeighborListUpdates = 0;
+
+  m_UseApproximation = false;
+  m_ApproximationSamplingFraction = 0.25;
+  m_ApproximationRelativeError = 1.0e-02;
+  m_ApproximateSearchRadius = 0;
+
+  m_ValueTolerance = 0;
+  m_ParametersTolerance = 0;
+  m_Converged = false;
+  m_NumberOfEvaluations = 0;
+  m_LastValue = NumericTraits<MeasureType>::max();
+  m_BestValue = NumericTraits<MeasureType>::max();
 }
 
 /**
@@ -60,12 +114,51 @@ GMMPointSetToPointSetMetricBase<TFixedPointSet, TMovingPointSet>::GetValue(const
 
   MeasureType value = NumericTraits<MeasureType>::ZeroValue();
 
-  for (MovingPointIterator it = m_TransformedMovingPointSet->GetPoints()->Begin(); it != m_TransformedMovingPointSet->GetPoints()->End(); ++it) 
+  const size_t numberOfBlocks = this->GetNumberOfBlocks();
+  TaskScheduler & scheduler = TaskScheduler::GetInstance();
+
+  if (m_UseReproducibleSum)
+  {
+    // the partial sums of the blocks do not depend on the threads, they are added in the fixed order
+    std::vector<double> values(numberOfBlocks);
+
+    scheduler.ParallelFor(0, numberOfBlocks, 0, [this, &values](const size_t & first, const size_t & last)
+    {
+      BlockTemporariesType temporaries(std::max(m_BlockSize, size_t(1)), m_NumberOfParameters);
+
+      for (size_t block = first; block < last; ++block)
+      {
+        values[block] = this->ComputeBlockValue(block, temporaries);
+      }
+    });
+
+    value = PairwiseSum::Sum(values.data(), values.size());
+  }
+  else
   {
-    value += GetLocalNeighborhoodValue(it.Value());
+    std::mutex mutex;
+
+    scheduler.ParallelFor(0, numberOfBlocks, 0, [this, &value, &mutex](const size_t & first, const size_t & last)
+    {
+      BlockTemporariesType temporaries(std::max(m_BlockSize, size_t(1)), m_NumberOfParameters);
+      MeasureType partial = NumericTraits<MeasureType>::ZeroValue();
+
+      for (size_t block = first; block < last; ++block)
+      {
+        partial += this->ComputeBlockValue(block, temporaries);
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      value += partial;
+    });
   }
 
-  value *= m_NormalizingValueFactor;
+  value *= m_NormalizingValueFactor * m_MiniBatchFactor;
+
+  if (m_KernelTransform)
+  {
+    value += m_KernelTransform->ComputeRegularization(ITK_NULLPTR);
+  }
 
   return value;
 }
@@ -80,57 +173,247 @@ GMMPointSetToPointSetMetricBase<TFixedPointSet, TMovingPointSet>
 {
   this->InitializeForIteration(parameters);
 
-  value = NumericTraits<MeasureType>::ZeroValue();
-  MeasureType localValue;
-
   if (derivative.size() != this->m_NumberOfParameters) 
   {
     derivative.set_size(this->m_NumberOfParameters);
   }
 
-  derivative.Fill(NumericTraits<DerivativeValueType>::ZeroValue());
-  LocalDerivativeType localDerivative;
+  // the value is the first element of the partial sums, the derivative follows it
+  const size_t length = m_NumberOfParameters + 1;
+  const size_t numberOfBlocks = this->GetNumberOfBlocks();
+  std::vector<double> sum(length, 0.0);
+
+  TaskScheduler & scheduler = TaskScheduler::GetInstance();
+
+  if (m_UseReproducibleSum)
+  {
+    // the blocks are evaluated in the chunks of the fixed size, so the memory for the partial sums is bounded
+    const size_t chunkSize = 64;
+    std::vector<double> partials(chunkSize * length);
+    PairwiseSum pairwiseSum(length);
+
+    for (size_t chunk = 0; chunk < numberOfBlocks; chunk += chunkSize)
+    {
+      const size_t count = std::min(chunkSize, numberOfBlocks - chunk);
+
+      scheduler.ParallelFor(0, count, 0, [this, &partials, chunk, length](const size_t & first, const size_t & last)
+      {
+        BlockTemporariesType temporaries(std::max(m_BlockSize, size_t(1)), m_NumberOfParameters);
+
+        for (size_t block = first; block < last; ++block)
+        {
+          double * partial = &partials[block * length];
+          std::fill(partial, partial + length, 0.0);
+          this->ComputeBlockValueAndDerivative(chunk + block, partial[0], partial + 1, temporaries);
+        }
+      });
+
+      for (size_t block = 0; block < count; ++block)
+      {
+        pairwiseSum.Add(&partials[block * length]);
+      }
+    }
+
+    pairwiseSum.GetSum(sum.data());
+  }
+  else
+  {
+    std::mutex mutex;
+
+    scheduler.ParallelFor(0, numberOfBlocks, 0, [this, &sum, &mutex, length](const size_t & first, const size_t & last)
+    {
+      BlockTemporariesType temporaries(std::max(m_BlockSize, size_t(1)), m_NumberOfParameters);
+      std::vector<double> partial(length, 0.0);
+
+      for (size_t block = first; block < last; ++block)
+      {
+        this->ComputeBlockValueAndDerivative(block, partial[0], partial.data() + 1, temporaries);
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      for (size_t n = 0; n < length; ++n)
+      {
+        sum[n] += partial[n];
+      }
+    });
+  }
+
+  value = sum[0] * m_NormalizingValueFactor * m_MiniBatchFactor;
+
+  for (size_t par = 0; par < m_NumberOfParameters; ++par) 
+  {
+    derivative[par] = sum[par + 1] * m_NormalizingDerivativeFactor * m_MiniBatchFactor;
+  }
+
+  if (m_KernelTransform)
+  {
+    value += m_KernelTransform->ComputeRegularization(&derivative);
+  }
+
+  this->CheckConvergence(parameters, value);
+}
+
+/**
+* Get the number of the blocks of the evaluated points
+*/
+template <typename TFixedPointSet, typename TMovingPointSet>
+size_t
+GMMPointSetToPointSetMetricBase<TFixedPointSet, TMovingPointSet>
+::GetNumberOfBlocks() const
+{
+  const size_t numberOfPoints = m_MiniBatch.empty() ? m_TransformedMovingPointSet->GetNumberOfPoints() : m_MiniBatch.size();
+  const size_t blockSize = std::max(m_BlockSize, size_t(1));
+
+  return (numberOfPoints + blockSize - 1) / blockSize;
+}
+
+/**
+* Get the range of the evaluated points in the block
+*/
+template <typename TFixedPointSet, typename TMovingPointSet>
+void
+GMMPointSetToPointSetMetricBase<TFixedPointSet, TMovingPointSet>
+::GetBlockRange(const size_t & block, const MovingPointIdentifier *& ids, MovingPointIdentifier & begin, size_t & count) const
+{
+  const size_t numberOfPoints = m_MiniBatch.empty() ? m_TransformedMovingPointSet->GetNumberOfPoints() : m_MiniBatch.size();
+  const size_t blockSize = std::max(m_BlockSize, size_t(1));
+  const size_t first = block * blockSize;
+
+  count = std::min(first + blockSize, numberOfPoints) - first;
 
-  for (MovingPointIterator it = m_TransformedMovingPointSet->GetPoints()->Begin(); it != m_TransformedMovingPointSet->GetPoints()->End(); ++it) 
+  // the moving points are contiguous, the mini-batch is indexed
+  ids = m_MiniBatch.empty() ? ITK_NULLPTR : m_MiniBatch.data() + first;
+  begin = m_MiniBatch.empty() ? first : 0;
+}
+
+/**
+* Get the sum of the local values over the block
+*/
+template <typename TFixedPointSet, typename TMovingPointSet>
+typename GMMPointSetToPointSetMetricBase<TFixedPointSet, TMovingPointSet>::MeasureType
+GMMPointSetToPointSetMetricBase<TFixedPointSet, TMovingPointSet>
+::ComputeBlockValue(const size_t & block, BlockTemporariesType & temporaries) const
+{
+  const MovingPointIdentifier * ids;
+  MovingPointIdentifier begin;
+  size_t count;
+  this->GetBlockRange(block, ids, begin, count);
+
+  MeasureType * values = temporaries.values.data();
+  this->GetLocalValues(ids, begin, count, values);
+
+  MeasureType value = NumericTraits<MeasureType>::ZeroValue();
+
+  for (size_t n = 0; n < count; ++n)
   {
-    // compute local value and derivatives
-    this->GetLocalNeighborhoodValueAndDerivative(it.Value(), localValue, localDerivative);
+    value += values[n];
+  }
+
+  return value;
+}
 
-    value += localValue;
-    //std::cout << it.Index() << it.Value() << std::endl;
-    //std::cout << localValue << std::endl;
-    //std::cout << localDerivative << std::endl;
+/**
+* Add the sums of the local values and the derivatives over the block
+*/
+template <typename TFixedPointSet, typename TMovingPointSet>
+void
+GMMPointSetToPointSetMetricBase<TFixedPointSet, TMovingPointSet>
+::ComputeBlockValueAndDerivative(const size_t & block, double & value, double * derivative, BlockTemporariesType & temporaries) const
+{
+  const MovingPointIdentifier * ids;
+  MovingPointIdentifier begin;
+  size_t count;
+  this->GetBlockRange(block, ids, begin, count);
+
+  MeasureType * values = temporaries.values.data();
+  LocalDerivativeType * derivatives = temporaries.derivatives.data();
+  TransformJacobianType & jacobian = temporaries.jacobian;
+  TransformJacobianType & jacobianCache = temporaries.jacobianCache;
+
+  // compute local values and derivatives
+  this->GetLocalValuesAndDerivatives(ids, begin, count, values, derivatives);
+
+  for (size_t n = 0; n < count; ++n)
+  {
+    const MovingPointIdentifier id = ids ? ids[n] : static_cast<MovingPointIdentifier>(begin + n);
+    LocalDerivativeType localDerivative = derivatives[n];
+
+    value += values[n];
+
+    // the local derivative is taken in the frame of the fixed points, it is rotated back to the frame of the transform
+    if (m_FixedInitialInverseTransform)
+    {
+      const LocalDerivativeType fixedDerivative = localDerivative;
+      for (size_t dim = 0; dim < PointDimension; ++dim)
+      {
+        localDerivative[dim] = 0;
+        for (size_t k = 0; k < PointDimension; ++k)
+        {
+          localDerivative[dim] += m_FixedInitialInverseJacobian(k, dim) * fixedDerivative[k];
+        }
+      }
+    }
+
+    // the derivatives of the kernel transform are the products of the cached basis and the local derivatives
+    if (m_KernelTransform)
+    {
+      const double * basis = m_KernelBasis[id];
+      for (size_t row = 0; row < m_KernelBasis.cols(); ++row)
+      {
+        for (size_t dim = 0; dim < PointDimension; ++dim)
+        {
+          derivative[row * PointDimension + dim] += basis[row] * localDerivative[dim];
+        }
+      }
+      continue;
+    }
 
     // compute derivatives
-    this->m_Transform->ComputeJacobianWithRespectToParametersCachedTemporaries(m_MovingPointSet->GetPoint(it.Index()), m_Jacobian, m_JacobianCache);
+    InputPointType point = m_MovingPointSet->GetPoint(id);
+    if (m_MovingInitialTransform)
+    {
+      point = m_MovingInitialTransform->TransformPoint(point);
+    }
+
+    this->m_Transform->ComputeJacobianWithRespectToParametersCachedTemporaries(point, jacobian, jacobianCache);
 
     for (size_t dim = 0; dim < PointDimension; ++dim) 
     {
       for (size_t par = 0; par < m_NumberOfParameters; ++par) 
       {
-        derivative[par] += m_Jacobian(dim, par) * localDerivative[dim];
+        derivative[par] += jacobian(dim, par) * localDerivative[dim];
       }
     }
   }
+}
 
-  std::cout << "-------------" << std::endl;
-  std::cout << value << std::endl;
-  std::cout << derivative << std::endl;
-  std::cout << std::endl;
-
-  value *= m_NormalizingValueFactor;
+/**
+* Get the local values for the block of the points
+*/
+template <typename TFixedPointSet, typename TMovingPointSet>
+void
+GMMPointSetToPointSetMetricBase<TFixedPointSet, TMovingPointSet>
+::GetLocalValues(const MovingPointIdentifier * ids, const MovingPointIdentifier & begin, const size_t & count, MeasureType * values) const
+{
+  const MovingPointsContainer * points = m_TransformedMovingPointSet->GetPoints();
 
-  for (size_t par = 0; par < m_NumberOfParameters; ++par) 
+  ForEachBlockPoint(ids, begin, count, [this, points, values](const size_t & n, const MovingPointIdentifier & id)
   {
-    derivative[par] *= m_NormalizingDerivativeFactor;
-  }
+    values[n] = this->GetLocalValue(id, points->ElementAt(id));
+  });
+}
+
+template <typename TFixedPointSet, typename TMovingPointSet>
+void
+GMMPointSetToPointSetMetricBase<TFixedPointSet, TMovingPointSet>
+::GetLocalValuesAndDerivatives(const MovingPointIdentifier * ids, const MovingPointIdentifier & begin, const size_t & count, MeasureType * values, LocalDerivativeType * derivatives) const
+{
+  const MovingPointsContainer * points = m_TransformedMovingPointSet->GetPoints();
 
-  std::cout << value << std::endl;
-  std::cout << derivative << std::endl;
-  std::cout << std::endl;
-  std::cout << m_NormalizingValueFactor << std::endl;
-  std::cout << m_NormalizingDerivativeFactor << std::endl;
-  std::cout << std::endl;
+  ForEachBlockPoint(ids, begin, count, [this, points, values, derivatives](const size_t & n, const MovingPointIdentifier & id)
+  {
+    this->GetLocalValueAndDerivative(id, points->ElementAt(id), values[n], derivatives[n]);
+  });
 }
 
 /**
@@ -142,6 +425,49 @@ void GMMPointSetToPointSetMetricBase<TFixedPointSet, TMovingPointSet>::GetDeriva
   itkExceptionMacro(<< "not implemented");
 }
 
+/** Check relative changes between consecutive evaluations */
+template< typename TFixedPointSet, typename TMovingPointSet >
+void
+GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >
+::CheckConvergence(const ParametersType & parameters, const MeasureType & value) const
+{
+  const bool check = m_NumberOfEvaluations > 0 && (m_ValueTolerance > 0 || m_ParametersTolerance > 0);
+  bool converged = check;
+
+  // the zero tolerance disables its check, so either of the changes can stop the evaluations alone
+  if (check && m_ValueTolerance > 0) {
+    const double valueNorm = std::max(std::abs(m_LastValue), std::abs(value));
+    converged &= std::abs(value - m_LastValue) <= m_ValueTolerance * valueNorm;
+  }
+
+  if (check && m_ParametersTolerance > 0) {
+    double difference = 0;
+    double norm = 0;
+    for (size_t par = 0; par < parameters.size(); ++par) {
+      difference += (parameters[par] - m_LastParameters[par]) * (parameters[par] - m_LastParameters[par]);
+      norm += m_LastParameters[par] * m_LastParameters[par];
+    }
+    converged &= std::sqrt(difference) <= m_ParametersTolerance * (1.0 + std::sqrt(norm));
+  }
+
+  ++m_NumberOfEvaluations;
+  m_LastParameters = parameters;
+  m_LastValue = value;
+
+  const bool randomMiniBatches = m_UseMiniBatch && m_MiniBatchSize > 0;
+  if (randomMiniBatches || value <= m_BestValue) {
+    m_BestParameters = parameters;
+    m_BestValue = value;
+  }
+
+  if (converged) {
+    m_Converged = true;
+    ProcessAborted excep(__FILE__, __LINE__);
+    excep.SetDescription("Relative changes of the metric value and parameters are below tolerances");
+    throw excep;
+  }
+}
+
 /** Initialize data for current iteration with the input parameters */
 template< typename TFixedPointSet, typename TMovingPointSet >
 void
@@ -156,10 +482,175 @@ GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >
     m_TransformedMovingPointSet->GetPoints()->resize(m_MovingPointSet->GetNumberOfPoints());
   }
 
+  // the kernel transform maps all points by the product of the cached basis and the coefficients
+  vnl_matrix<double> kernelPoints;
+  if (m_KernelTransform)
+  {
+    kernelPoints = m_KernelBasis * m_KernelTransform->GetCoefficients();
+  }
+
+  // the initial transforms are applied on the fly, so the input point sets are not copied
   for (MovingPointIterator it = m_MovingPointSet->GetPoints()->Begin(); it != m_MovingPointSet->GetPoints()->End(); ++it) 
   {
-    m_TransformedMovingPointSet->GetPoints()->SetElement(it.Index(), m_Transform->TransformPoint(it.Value()));
+    InputPointType point = it.Value();
+
+    if (m_KernelTransform)
+    {
+      for (size_t dim = 0; dim < PointDimension; ++dim)
+      {
+        point[dim] = kernelPoints(it.Index(), dim);
+      }
+    }
+    else
+    {
+      if (m_MovingInitialTransform)
+      {
+        point = m_MovingInitialTransform->TransformPoint(point);
+      }
+
+      point = m_Transform->TransformPoint(point);
+    }
+
+    if (m_FixedInitialInverseTransform)
+    {
+      point = m_FixedInitialInverseTransform->TransformPoint(point);
+    }
+
+    m_TransformedMovingPointSet->GetPoints()->SetElement(it.Index(), point);
+  }
+
+  // the tree of the transformed moving points is rebuilt for each evaluation
+  if (m_UseGaussianSumTree)
+  {
+    if (!m_MovingGaussianSumTree)
+    {
+      m_MovingGaussianSumTree = MovingGaussianSumTreeType::New();
+    }
+
+    m_MovingGaussianSumTree->SetRelativeError(m_GaussianSumTreeError);
+    m_MovingGaussianSumTree->Build(m_TransformedMovingPointSet->GetPoints());
   }
+
+  this->UpdateNeighborLists();
+
+  this->SampleMiniBatch();
+}
+
+/** Invalidate the neighbour lists if some point has moved farther than the skin */
+template< typename TFixedPointSet, typename TMovingPointSet >
+void
+GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >
+::UpdateNeighborLists() const
+{
+  if (!m_UseNeighborLists || !m_UseFixedPointSetKdTree || m_UseGaussianSumTree)
+  {
+    return;
+  }
+
+  const MovingPointsContainer * points = m_TransformedMovingPointSet->GetPoints();
+  const double skin = m_NeighborListSkin * m_Scale;
+
+  // the fixed points do not move, so the list of the point is valid until the point itself has moved by the skin
+  bool update = m_NeighborLists.size() != points->Size();
+
+  for (MovingPointIterator it = points->Begin(); it != points->End() && !update; ++it)
+  {
+    update = it.Value().SquaredEuclideanDistanceTo(m_NeighborListsPoints[it.Index()]) > skin * skin;
+  }
+
+  if (!update)
+  {
+    return;
+  }
+
+  // the lists are built on demand, so the points skipped by the mini-batches are not searched
+  m_NeighborLists.resize(points->Size());
+  m_NeighborListsBuilt.assign(points->Size(), 0);
+  m_NeighborListsPoints.resize(points->Size());
+
+  for (MovingPointIterator it = points->Begin(); it != points->End(); ++it)
+  {
+    m_NeighborListsPoints[it.Index()] = it.Value();
+  }
+
+  ++m_NumberOfNeighborListUpdates;
+}
+
+/** Get the neighbour list of the moving point */
+template< typename TFixedPointSet, typename TMovingPointSet >
+const typename GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >::FixedNeighborsIdentifierType *
+GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >
+::GetNeighborList(const MovingPointIdentifier & id) const
+{
+  if (id >= m_NeighborLists.size())
+  {
+    return ITK_NULLPTR;
+  }
+
+  if (!m_NeighborListsBuilt[id])
+  {
+    this->SearchFixedPoints(m_NeighborListsPoints[id], m_SearchRadius + m_NeighborListSkin * m_Scale, m_NeighborLists[id]);
+    m_NeighborListsBuilt[id] = 1;
+  }
+
+  return &m_NeighborLists[id];
+}
+
+/** Select the subset of the moving points */
+template< typename TFixedPointSet, typename TMovingPointSet >
+void
+GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >
+::SampleMiniBatch() const
+{
+  const size_t numberOfPoints = m_MovingPointSet->GetNumberOfPoints();
+
+  m_MiniBatch.clear();
+  m_MiniBatchFactor = 1;
+  m_CurrentMiniBatchSize = numberOfPoints;
+
+  if (!m_UseMiniBatch || m_MiniBatchSize == 0)
+  {
+    // the approximate evaluations use the same subset, so the consecutive values are consistent for the line search
+    if (m_UseApproximation && m_ApproximationSamplingFraction > 0 && m_ApproximationSamplingFraction < 1)
+    {
+      m_CurrentMiniBatchSize = std::max(static_cast<size_t>(m_ApproximationSamplingFraction * numberOfPoints), size_t(1));
+      m_MiniBatch.resize(m_CurrentMiniBatchSize);
+
+      for (size_t n = 0; n < m_CurrentMiniBatchSize; ++n)
+      {
+        m_MiniBatch[n] = (2 * n + 1) * numberOfPoints / (2 * m_CurrentMiniBatchSize);
+      }
+
+      m_MiniBatchFactor = static_cast<double>(numberOfPoints) / m_CurrentMiniBatchSize;
+    }
+
+    return;
+  }
+
+  const double size = m_MiniBatchSize * std::pow(m_MiniBatchGrowthFactor, static_cast<double>(m_NumberOfMiniBatches));
+
+  if (size >= numberOfPoints)
+  {
+    return;
+  }
+
+  // a single point from each of the strata of the point identifiers, the generator is seeded by the
+  // number of the subset so the sequence does not depend on the other uses of random numbers
+  m_CurrentMiniBatchSize = std::max(static_cast<size_t>(size), size_t(1));
+  m_MiniBatch.resize(m_CurrentMiniBatchSize);
+
+  std::mt19937 generator(m_RandomSeed + static_cast<unsigned int>(m_NumberOfMiniBatches));
+
+  for (size_t n = 0; n < m_CurrentMiniBatchSize; ++n)
+  {
+    const size_t begin = n * numberOfPoints / m_CurrentMiniBatchSize;
+    const size_t end = (n + 1) * numberOfPoints / m_CurrentMiniBatchSize;
+    std::uniform_int_distribution<size_t> distribution(begin, end - 1);
+    m_MiniBatch[n] = distribution(generator);
+  }
+
+  m_MiniBatchFactor = static_cast<double>(numberOfPoints) / m_CurrentMiniBatchSize;
+  ++m_NumberOfMiniBatches;
 }
 
 /** Set the parameters that define a unique transform */
@@ -210,8 +701,73 @@ throw ( ExceptionObject )
 	  m_MovingPointSet->GetSource()->Update();
     }
 
+  // the inverse of the rigid fixed initial transform maps the transformed moving points to the fixed points
+  m_FixedInitialInverseTransform = ITK_NULLPTR;
+
+  if (m_FixedInitialTransform)
+    {
+    if (!IsRigidTransform(m_FixedInitialTransform))
+      {
+      itkExceptionMacro(<< "The fixed initial transform must be rigid");
+      }
+
+    m_FixedInitialInverseTransform = m_FixedInitialTransform->GetInverseTransform();
+
+    if (!m_FixedInitialInverseTransform)
+      {
+      itkExceptionMacro(<< "The fixed initial transform is not invertible");
+      }
+
+    InputPointType origin;
+    origin.Fill(0);
+    m_FixedInitialInverseTransform->ComputeJacobianWithRespectToPosition(origin, m_FixedInitialInverseJacobian);
+    }
+
+  // the weights of the fixed points are read from the point data
+  m_FixedPointWeights = ITK_NULLPTR;
+  double totalFixedPointWeight = m_FixedPointSet->GetNumberOfPoints();
+
+  if (m_UseFixedPointWeights)
+    {
+    const FixedPointDataContainer * weights = m_FixedPointSet->GetPointData();
+
+    if (!weights || weights->Size() != m_FixedPointSet->GetNumberOfPoints())
+      {
+      itkExceptionMacro(<< "The point data of the fixed point set do not match the points, the weights are not defined");
+      }
+
+    if (m_UseGaussianSumTree)
+      {
+      itkExceptionMacro(<< "The weights of the fixed points are not supported by the Gaussian sum tree");
+      }
+
+    m_FixedPointWeights = weights;
+    totalFixedPointWeight = 0;
+
+    for (FixedPointDataIterator it = weights->Begin(); it != weights->End(); ++it)
+      {
+      totalFixedPointWeight += it.Value();
+      }
+    }
+
+  // the prebuilt index replaces the kd-tree of the fixed points
+  m_UseFixedPointsIndex = m_FixedPointsIndex && m_FixedPointsIndex->Matches(m_FixedPointSet->GetPoints());
+
+  if (m_FixedPointsIndex && !m_UseFixedPointsIndex)
+    {
+    itkWarningMacro(<< "The index of the fixed points does not match the fixed point set, it is ignored");
+    }
+
+  // the trees are rebuilt if the fixed points are replaced, e.g. cropped at the next level
+  if (m_FixedTreesPoints != m_FixedPointSet->GetPoints())
+    {
+    m_FixedPointsTree = ITK_NULLPTR;
+    m_FixedGaussianSumTree = ITK_NULLPTR;
+    m_FixedTreesPoints = m_FixedPointSet->GetPoints();
+    }
+
   // initialize KdTrees 
-  if (m_UseFixedPointSetKdTree && !m_FixedPointsLocator)
+  if (m_UseFixedPointSetKdTree && !m_FixedPointsTree && !m_UseFixedPointsIndex)
     {
     InitializeFixedTree();
     }
@@ -221,20 +777,386 @@ throw ( ExceptionObject )
     InitializeMovingTree();
   }
 
+  if (m_UseGaussianSumTree)
+    {
+    InitializeFixedGaussianSumTree();
+    }
+
   m_NumberOfParameters = m_Transform->GetNumberOfParameters();
-  m_NumberOfFixedPoints = m_FixedPointSet->GetNumberOfPoints();
+
+  // the basis of the kernel transform at the moving points does not depend on the parameters
+  m_KernelTransform = dynamic_cast<const KernelTransformType *>(m_Transform.GetPointer());
+
+  if (m_KernelTransform)
+    {
+    m_KernelBasis.set_size(m_MovingPointSet->GetNumberOfPoints(), m_KernelTransform->GetNumberOfBasisFunctions());
+
+    for (MovingPointIterator it = m_MovingPointSet->GetPoints()->Begin(); it != m_MovingPointSet->GetPoints()->End(); ++it)
+      {
+      InputPointType point = it.Value();
+      if (m_MovingInitialTransform)
+        {
+        point = m_MovingInitialTransform->TransformPoint(point);
+        }
+
+      m_KernelTransform->ComputeBasis(point, m_KernelBasis[it.Index()]);
+      }
+    }
+  else
+    {
+    m_KernelBasis.clear();
+    }
+
+  this->ComputeSearchRadius();
+
+  this->ResetConvergenceCheck();
+
+  // the search radius and the fixed points may have changed, so the neighbour lists are rebuilt
+  m_NeighborLists.clear();
+  m_NeighborListsBuilt.clear();
+  m_NeighborListsPoints.clear();
+  m_NumberOfNeighborListUpdates = 0;
+
+  m_NumberOfFixedPoints = m_TotalNumberOfFixedPoints > 0 ? m_TotalNumberOfFixedPoints : static_cast<size_t>(std::round(totalFixedPointWeight));
   m_NumberOfMovingPoints = m_MovingPointSet->GetNumberOfPoints();
 }
 
+/** Reset the convergence check */
+template< typename TFixedPointSet, typename TMovingPointSet >
+void
+GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >
+::ResetConvergenceCheck()
+{
+  m_Converged = false;
+  m_NumberOfEvaluations = 0;
+  m_LastParameters = m_Transform->GetParameters();
+  m_LastValue = NumericTraits<MeasureType>::max();
+  m_BestParameters = m_LastParameters;
+  m_BestValue = NumericTraits<MeasureType>::max();
+}
+
+/** Check that the transform is rigid */
+template< typename TFixedPointSet, typename TMovingPointSet >
+bool
+GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >
+::IsRigidTransform(const TransformType * transform)
+{
+  if (!transform || transform->GetTransformCategory() != TransformType::Linear)
+  {
+    return false;
+  }
+
+  // the Jacobian of the linear transform is constant, it must be orthogonal
+  InputPointType origin;
+  origin.Fill(0);
+  TransformJacobianType jacobian;
+  transform->ComputeJacobianWithRespectToPosition(origin, jacobian);
+
+  for (size_t row = 0; row < PointDimension; ++row)
+  {
+    for (size_t col = 0; col < PointDimension; ++col)
+    {
+      double product = 0;
+      for (size_t k = 0; k < PointDimension; ++k)
+      {
+        product += jacobian(k, row) * jacobian(k, col);
+      }
+
+      if (std::abs(product - (row == col ? 1 : 0)) > 1.0e-06)
+      {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+/** Sum of kernel values over the fixed points */
+template< typename TFixedPointSet, typename TMovingPointSet >
+template< typename TComputeValueType >
+double
+GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >
+::ComputeFixedKernelSum(const MovingPointType & point, const MovingPointIdentifier & id) const
+{
+  // the approximate evaluations use the kernels in single precision
+  if (m_UseApproximation && !std::is_same<TComputeValueType, float>::value) {
+    return this->template ComputeFixedKernelSum<float>(point, id);
+  }
+
+  if (m_UseGaussianSumTree) {
+    return m_FixedGaussianSumTree->template ComputeSum<TComputeValueType>(point, m_Scale * m_Scale, ITK_NULLPTR);
+  }
+
+  const TComputeValueType scale = m_Scale * m_Scale;
+  TComputeValueType difference[PointDimension];
+  double sum = 0;
+
+  if (m_UseFixedPointSetKdTree) {
+    // the points of the neighbour list outside the search radius are skipped, so the sum equals the sum over the search
+    const double radius = m_UseApproximation ? m_ApproximateSearchRadius : m_SearchRadius;
+    FixedNeighborsIdentifierType idx;
+    const FixedNeighborsIdentifierType * neighbors = this->GetNeighborList(id);
+    const double radius2 = neighbors ? radius * radius : NumericTraits<double>::max();
+
+    if (!neighbors) {
+      this->SearchFixedPoints(point, radius, idx);
+      neighbors = &idx;
+    }
+
+    for (FixedNeighborsIteratorType it = neighbors->begin(); it != neighbors->end(); ++it) {
+      const FixedPointType & x = m_FixedPointSet->GetPoint(*it);
+      if (point.SquaredEuclideanDistanceTo(x) <= radius2) {
+        sum += this->GetFixedPointWeight(*it) * EvaluateKernel<TComputeValueType>(point, x, scale, difference);
+      }
+    }
+  }
+  else {
+    for (FixedPointIterator it = m_FixedPointSet->GetPoints()->Begin(); it != m_FixedPointSet->GetPoints()->End(); ++it) {
+      sum += this->GetFixedPointWeight(it.Index()) * EvaluateKernel<TComputeValueType>(point, it.Value(), scale, difference);
+    }
+  }
+
+  return sum;
+}
+
+/** Sum of kernel values and gradients over the fixed points */
+template< typename TFixedPointSet, typename TMovingPointSet >
+template< typename TComputeValueType >
+double
+GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >
+::ComputeFixedKernelSum(const MovingPointType & point, LocalDerivativeType & gradient, const MovingPointIdentifier & id) const
+{
+  // the approximate evaluations use the kernels in single precision
+  if (m_UseApproximation && !std::is_same<TComputeValueType, float>::value) {
+    return this->template ComputeFixedKernelSum<float>(point, gradient, id);
+  }
+
+  if (m_UseGaussianSumTree) {
+    return m_FixedGaussianSumTree->template ComputeSum<TComputeValueType>(point, m_Scale * m_Scale, gradient.GetDataPointer());
+  }
+
+  const TComputeValueType scale = m_Scale * m_Scale;
+  TComputeValueType difference[PointDimension];
+  double sum = 0;
+
+  gradient.Fill(NumericTraits<DerivativeValueType>::ZeroValue());
+
+  if (m_UseFixedPointSetKdTree) {
+    const double radius = m_UseApproximation ? m_ApproximateSearchRadius : m_SearchRadius;
+    FixedNeighborsIdentifierType idx;
+    const FixedNeighborsIdentifierType * neighbors = this->GetNeighborList(id);
+    const double radius2 = neighbors ? radius * radius : NumericTraits<double>::max();
+
+    if (!neighbors) {
+      this->SearchFixedPoints(point, radius, idx);
+      neighbors = &idx;
+    }
+
+    for (FixedNeighborsIteratorType it = neighbors->begin(); it != neighbors->end(); ++it) {
+      const FixedPointType & x = m_FixedPointSet->GetPoint(*it);
+      if (point.SquaredEuclideanDistanceTo(x) > radius2) {
+        continue;
+      }
+
+      const TComputeValueType expval = static_cast<TComputeValueType>(this->GetFixedPointWeight(*it)) * EvaluateKernel<TComputeValueType>(point, x, scale, difference);
+      sum += expval;
+
+      for (size_t dim = 0; dim < PointDimension; ++dim) {
+        gradient[dim] += expval * difference[dim];
+      }
+    }
+  }
+  else {
+    for (FixedPointIterator it = m_FixedPointSet->GetPoints()->Begin(); it != m_FixedPointSet->GetPoints()->End(); ++it) {
+      const TComputeValueType expval = static_cast<TComputeValueType>(this->GetFixedPointWeight(it.Index())) * EvaluateKernel<TComputeValueType>(point, it.Value(), scale, difference);
+      sum += expval;
+
+      for (size_t dim = 0; dim < PointDimension; ++dim) {
+        gradient[dim] += expval * difference[dim];
+      }
+    }
+  }
+
+  return sum;
+}
+
+/** Sum of kernel values over the transformed moving points */
+template< typename TFixedPointSet, typename TMovingPointSet >
+template< typename TComputeValueType >
+double
+GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >
+::ComputeMovingKernelSum(const MovingPointType & point) const
+{
+  // the approximate evaluations use the kernels in single precision
+  if (m_UseApproximation && !std::is_same<TComputeValueType, float>::value) {
+    return this->template ComputeMovingKernelSum<float>(point);
+  }
+
+  if (m_UseGaussianSumTree) {
+    return m_MovingGaussianSumTree->template ComputeSum<TComputeValueType>(point, m_Scale * m_Scale, ITK_NULLPTR);
+  }
+
+  const TComputeValueType scale = m_Scale * m_Scale;
+  TComputeValueType difference[PointDimension];
+  double sum = 0;
+
+  for (MovingPointIterator it = m_TransformedMovingPointSet->GetPoints()->Begin(); it != m_TransformedMovingPointSet->GetPoints()->End(); ++it) {
+    sum += EvaluateKernel<TComputeValueType>(point, it.Value(), scale, difference);
+  }
+
+  return sum;
+}
+
+/** Sum of kernel values and gradients over the transformed moving points */
+template< typename TFixedPointSet, typename TMovingPointSet >
+template< typename TComputeValueType >
+double
+GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >
+::ComputeMovingKernelSum(const MovingPointType & point, LocalDerivativeType & gradient) const
+{
+  // the approximate evaluations use the kernels in single precision
+  if (m_UseApproximation && !std::is_same<TComputeValueType, float>::value) {
+    return this->template ComputeMovingKernelSum<float>(point, gradient);
+  }
+
+  if (m_UseGaussianSumTree) {
+    return m_MovingGaussianSumTree->template ComputeSum<TComputeValueType>(point, m_Scale * m_Scale, gradient.GetDataPointer());
+  }
+
+  const TComputeValueType scale = m_Scale * m_Scale;
+  TComputeValueType difference[PointDimension];
+  double sum = 0;
+
+  gradient.Fill(NumericTraits<DerivativeValueType>::ZeroValue());
+
+  for (MovingPointIterator it = m_TransformedMovingPointSet->GetPoints()->Begin(); it != m_TransformedMovingPointSet->GetPoints()->End(); ++it) {
+    const TComputeValueType expval = EvaluateKernel<TComputeValueType>(point, it.Value(), scale, difference);
+    sum += expval;
+
+    for (size_t dim = 0; dim < PointDimension; ++dim) {
+      gradient[dim] += expval * difference[dim];
+    }
+  }
+
+  return sum;
+}
+
+/** Compute the search radius for the current scale */
+template< typename TFixedPointSet, typename TMovingPointSet >
+void
+GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >
+::ComputeSearchRadius()
+{
+  // the points are distributed with the spacing, so the kernel sum outside the search radius
+  // is approximated by the integral outside the sphere shrunk by the spacing
+  if (m_RelativeError > 0) {
+    m_SearchRadius = ComputeTruncationRadius(m_RelativeError) * m_Scale + m_PointSpacing;
+  }
+  else {
+    m_SearchRadius = m_Radius * m_Scale;
+  }
+
+  m_TruncationError = ComputeTruncationError(std::max(0.0, m_SearchRadius - m_PointSpacing) / m_Scale);
+
+  // the approximate evaluations never search farther than the exact ones
+  m_ApproximateSearchRadius = m_SearchRadius;
+
+  if (m_ApproximationRelativeError > 0) {
+    m_ApproximateSearchRadius = std::min(m_SearchRadius, ComputeTruncationRadius(m_ApproximationRelativeError) * m_Scale + m_PointSpacing);
+  }
+}
+
+/** Minimal radius with the relative truncation error */
+template< typename TFixedPointSet, typename TMovingPointSet >
+double
+GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >
+::ComputeTruncationRadius(const double & relativeError)
+{
+  // find the minimal radius providing the relative error by bisection
+  double lower = 0;
+  double upper = 1;
+
+  while (ComputeTruncationError(upper) > relativeError) {
+    lower = upper;
+    upper *= 2;
+  }
+
+  for (size_t iter = 0; iter < 64 && upper - lower > 1.0e-06 * upper; ++iter) {
+    const double middle = 0.5 * (lower + upper);
+    if (ComputeTruncationError(middle) > relativeError) {
+      lower = middle;
+    }
+    else {
+      upper = middle;
+    }
+  }
+
+  return upper;
+}
+
+/** Relative truncation error of the Gaussian kernel sum */
+template< typename TFixedPointSet, typename TMovingPointSet >
+double
+GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >
+::ComputeTruncationError(const double & radius)
+{
+  // the ratio of the integral of exp(-r^2) over the 3D space outside the sphere of the radius
+  // to the integral over the whole space, it bounds the error for points sampled from surfaces
+  return std::erfc(radius) + 2.0 * radius * std::exp(-radius * radius) / std::sqrt(Math::pi);
+}
+
 /** Initialize KdTree for FixedPointSet */
 template< typename TFixedPointSet, typename TMovingPointSet >
 void
 GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >
 ::InitializeFixedTree()
 {
-  m_FixedPointsLocator = FixedPointsLocatorType::New();
-  m_FixedPointsLocator->SetPoints(const_cast<FixedPointsContainer*>(m_FixedPointSet->GetPoints()));
-  m_FixedPointsLocator->Initialize();
+  // the flat kd-tree is built in parallel, it is not saved, so the points are not hashed
+  m_FixedPointsTree = FixedPointsIndexType::New();
+  m_FixedPointsTree->SetHashPoints(false);
+  m_FixedPointsTree->Build(m_FixedPointSet->GetPoints());
+}
+
+/** Search the fixed points in the radius */
+template< typename TFixedPointSet, typename TMovingPointSet >
+void
+GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >
+::SearchFixedPoints(const MovingPointType & point, const double & radius, FixedNeighborsIdentifierType & idx) const
+{
+  if (m_UseFixedPointsIndex) {
+    m_FixedPointsIndex->Search(point, radius, idx);
+  }
+  else {
+    m_FixedPointsTree->Search(point, radius, idx);
+  }
+}
+
+/** Find the closest fixed point */
+template< typename TFixedPointSet, typename TMovingPointSet >
+typename GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >::FixedPointsLocatorType::PointIdentifier
+GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >
+::FindClosestFixedPoint(const MovingPointType & point) const
+{
+  if (m_UseFixedPointsIndex) {
+    return m_FixedPointsIndex->FindClosestPoint(point);
+  }
+
+  return m_FixedPointsTree->FindClosestPoint(point);
+}
+
+/** Find the closest fixed points */
+template< typename TFixedPointSet, typename TMovingPointSet >
+void
+GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >
+::FindClosestFixedPoints(const MovingPointType & point, const size_t & numberOfNeighbors, FixedNeighborsIdentifierType & idx) const
+{
+  if (m_UseFixedPointsIndex) {
+    m_FixedPointsIndex->FindClosestNPoints(point, numberOfNeighbors, idx);
+  }
+  else {
+    m_FixedPointsTree->FindClosestNPoints(point, numberOfNeighbors, idx);
+  }
 }
 
 /** Initialize KdTree for MovingPointSet */
@@ -248,6 +1170,21 @@ GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >
   m_MovingPointsLocator->Initialize();
 }
 
+/** Initialize the Gaussian sum tree for FixedPointSet */
+template< typename TFixedPointSet, typename TMovingPointSet >
+void
+GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >
+::InitializeFixedGaussianSumTree()
+{
+  if (!m_FixedGaussianSumTree)
+  {
+    m_FixedGaussianSumTree = FixedGaussianSumTreeType::New();
+    m_FixedGaussianSumTree->Build(m_FixedPointSet->GetPoints());
+  }
+
+  m_FixedGaussianSumTree->SetRelativeError(m_GaussianSumTreeError);
+}
+
 /** PrintSelf */
 template< typename TFixedPointSet, typename TMovingPointSet >
 void
@@ -258,6 +1195,22 @@ GMMPointSetToPointSetMetricBase< TFixedPointSet, TMovingPointSet >
   os << indent << "Moving PointSet: " << m_MovingPointSet.GetPointer()  << std::endl;
   os << indent << "Fixed  PointSet: " << m_FixedPointSet.GetPointer()   << std::endl;
   os << indent << "Transform:       " << m_Transform.GetPointer()    << std::endl;
+  os << indent << "Scale:           " << m_Scale << std::endl;
+  os << indent << "Search radius:   " << m_SearchRadius << std::endl;
+  os << indent << "Truncation error: " << m_TruncationError << std::endl;
+  os << indent << "Use fixed point weights: " << m_UseFixedPointWeights << std::endl;
+  os << indent << "Use Gaussian sum tree: " << m_UseGaussianSumTree << std::endl;
+  os << indent << "Gaussian sum tree error: " << m_GaussianSumTreeError << std::endl;
+  os << indent << "Use mini-batch:  " << m_UseMiniBatch << std::endl;
+  os << indent << "Mini-batch size: " << m_MiniBatchSize << std::endl;
+  os << indent << "Mini-batch growth factor: " << m_MiniBatchGrowthFactor << std::endl;
+  os << indent << "Use neighbor lists: " << m_UseNeighborLists << std::endl;
+  os << indent << "Neighbor list skin: " << m_NeighborListSkin << std::endl;
+  os << indent << "Block size: " << m_BlockSize << std::endl;
+  os << indent << "Use reproducible sum: " << m_UseReproducibleSum << std::endl;
+  os << indent << "Use approximation: " << m_UseApproximation << std::endl;
+  os << indent << "Approximation sampling fraction: " << m_ApproximationSamplingFraction << std::endl;
+  os << indent << "Approximation relative error: " << m_ApproximationRelativeError << std::endl;
 }
 } // end namespace itk
 
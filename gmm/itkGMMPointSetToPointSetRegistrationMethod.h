@@ -6,6 +6,9 @@
 #include "itkSingleValuedNonLinearOptimizer.h"
 #include "itkDataObjectDecorator.h"
 #include "itkGMMPointSetToPointSetMetricBase.h"
+#include "itkStochasticGradientDescentOptimizer.h"
+#include "itkMortonOrderPointSet.h"
+#include "itkReducePointSet.h"
 
 namespace itk
 {
@@ -31,6 +34,7 @@ public:
   typedef typename FixedPointSetType::ConstPointer          FixedPointSetConstPointer;
   typedef typename FixedPointSetType::PointsContainer       FixedPointsContainerType;
   typedef typename FixedPointsContainerType::ConstIterator  FixedPointConstIterator;
+  typedef typename FixedPointSetType::PointDataContainer    FixedPointDataContainerType;
 
   /**  Type of the Moving PointSet. */
   typedef          TMovingPointSet                          MovingPointSetType;
@@ -38,6 +42,7 @@ public:
   typedef typename MovingPointSetType::ConstPointer         MovingPointSetConstPointer;
   typedef typename MovingPointSetType::PointsContainer      MovingPointsContainerType;
   typedef typename MovingPointsContainerType::ConstIterator MovingPointConstIterator;
+  typedef std::vector<typename MovingPointSetType::PointIdentifier> MovingPointsPermutationType;
 
   /**  Type of the metric. */
   typedef GMMPointSetToPointSetMetricBase<FixedPointSetType, MovingPointSetType>  MetricType;
@@ -120,6 +125,99 @@ public:
   itkSetMacro(NumberOfLevels, size_t);
   itkGetMacro(NumberOfLevels, size_t);
 
+  /** Get/Set the adaptive scale schedule. The first element of Scale is used as the initial
+   * scale, which is multiplied by the ScaleFactor at each level until the MinimalScale is reached.
+   * If the relative change of the transform parameters at a level is below the LevelSkipTolerance the
+   * next level is skipped. */
+  itkSetMacro(UseAdaptiveScale, bool);
+  itkGetMacro(UseAdaptiveScale, bool);
+  itkBooleanMacro(UseAdaptiveScale);
+
+  itkSetMacro(ScaleFactor, double);
+  itkGetMacro(ScaleFactor, double);
+
+  itkSetMacro(MinimalScale, double);
+  itkGetMacro(MinimalScale, double);
+
+  itkSetMacro(LevelSkipTolerance, double);
+  itkGetMacro(LevelSkipTolerance, double);
+
+  /** Get/Set relative tolerances to stop optimization at a level, a zero tolerance is not checked. */
+  itkSetMacro(ValueTolerance, double);
+  itkGetMacro(ValueTolerance, double);
+
+  itkSetMacro(ParametersTolerance, double);
+  itkGetMacro(ParametersTolerance, double);
+
+  /** Get/Set the length of the first step of the stochastic gradient descent optimizer in units of
+   * the scale at each level. It is used if the optimizer is StochasticGradientDescentOptimizer. */
+  itkSetMacro(StepLengthFactor, double);
+  itkGetMacro(StepLengthFactor, double);
+
+  /** Get/Set boolean flag to crop the fixed point set at each level to the bounding box of the
+   * transformed moving points, which is expanded by the search radius of the metric and the
+   * CroppingMargin in units of the scale to allow the motion within the level. The fixed points out of
+   * the box do not contribute to the truncated kernel sums, the metric is still normalized by the number
+   * of points in the whole fixed point set. The cropping is not supported if the metric uses the prebuilt
+   * index of the fixed points, which covers the whole set, Initialize throws in that case. */
+  itkSetMacro(UseFixedPointSetCropping, bool);
+  itkGetMacro(UseFixedPointSetCropping, bool);
+  itkBooleanMacro(UseFixedPointSetCropping);
+
+  itkSetMacro(CroppingMargin, double);
+  itkGetMacro(CroppingMargin, double);
+
+  /** Get/Set boolean flag to reduce the fixed point set at each level to the weighted centroids of the
+   * points in the voxels of the size ReductionFactor in units of the scale. The metric weights the kernels
+   * of the centroids by the numbers of the merged points, so the kernel sums shrink by the reduction ratio
+   * at the cost of the error of the order of the squared ReductionFactor. The fixed point set is reduced
+   * before the cropping. The weights of the fixed points are used by the metric within the level, its
+   * setting is restored after the level. The reduction is not supported if the metric uses the prebuilt
+   * index of the fixed points, Initialize throws in that case. */
+  itkSetMacro(UseFixedPointSetReduction, bool);
+  itkGetMacro(UseFixedPointSetReduction, bool);
+  itkBooleanMacro(UseFixedPointSetReduction);
+
+  itkSetMacro(ReductionFactor, double);
+  itkGetMacro(ReductionFactor, double);
+
+  /** Get/Set boolean flag to reorder the points along the Morton curve in the preprocessing, so the
+   * consecutive points of the metric loops are close in space. The input point sets are not modified,
+   * the fixed points are not reordered if the metric uses the prebuilt index of the fixed points. */
+  itkSetMacro(UseMortonOrder, bool);
+  itkGetMacro(UseMortonOrder, bool);
+  itkBooleanMacro(UseMortonOrder);
+
+  /** Get the identifiers of the moving points in the order used by the metric, it is empty if the
+   * points are not reordered. */
+  const MovingPointsPermutationType & GetMovingPointsPermutation() const
+  {
+    return m_MovingPointsPermutation;
+  }
+
+  /** Get/Set boolean flag to start each level with the approximate evaluations of the metric. The
+   * approximate optimization is stopped when the relative changes of the metric value and the parameters
+   * fall below the ApproximationTolerance, then the optimization continues with the exact evaluations, so
+   * the final parameters and the reported metric values are exact. Each of the two optimizations is
+   * limited by the number of iterations of the optimizer. */
+  itkSetMacro(UseProgressiveAccuracy, bool);
+  itkGetMacro(UseProgressiveAccuracy, bool);
+  itkBooleanMacro(UseProgressiveAccuracy);
+
+  itkSetMacro(ApproximationTolerance, double);
+  itkGetMacro(ApproximationTolerance, double);
+
+  /** Get scales, search radii and truncation error estimates of the metric at the performed levels. */
+  itkGetMacro(LevelScales, ScaleType);
+  itkGetMacro(LevelSearchRadii, ScaleType);
+  itkGetMacro(LevelTruncationErrors, ScaleType);
+
+  /** Get the numbers of the fixed points used by the metric at the performed levels. */
+  itkGetMacro(LevelNumbersOfFixedPoints, ScaleType);
+
+  /** Get the numbers of the rebuilds of the neighbour lists of the metric at the performed levels. */
+  itkGetMacro(LevelNumbersOfNeighborListUpdates, ScaleType);
+
   itkGetMacro(InitialMetricValues, MetricValuesType);
   itkGetMacro(FinalMetricValues, MetricValuesType);
 
@@ -133,7 +231,11 @@ protected:
   FixedPointSetConstPointer  m_FixedPointSet;
   MovingPointSetConstPointer m_MovingPointSet;
   FixedPointSetPointer       m_FixedTransformedPointSet;
-  MovingPointSetPointer      m_MovingTransformedPointSet;
+  FixedPointSetPointer       m_FixedCroppedPointSet;
+  FixedPointSetPointer       m_FixedReducedPointSet;
+  FixedPointSetPointer       m_FixedOrderedPointSet;
+  MovingPointSetPointer      m_MovingOrderedPointSet;
+  MovingPointsPermutationType m_MovingPointsPermutation;
 
   MetricPointer m_Metric;
   OptimizerPointer m_Optimizer;
@@ -150,6 +252,72 @@ protected:
 
   size_t m_NumberOfLevels;
   ScaleType m_Scale;
+  ScaleType m_LevelScales;
+  ScaleType m_LevelSearchRadii;
+  ScaleType m_LevelTruncationErrors;
+  ScaleType m_LevelNumbersOfFixedPoints;
+  ScaleType m_LevelNumbersOfNeighborListUpdates;
+
+  bool m_UseAdaptiveScale;
+  double m_ScaleFactor;
+  double m_MinimalScale;
+  double m_LevelSkipTolerance;
+  double m_ValueTolerance;
+  double m_ParametersTolerance;
+  double m_StepLengthFactor;
+  bool m_UseFixedPointSetCropping;
+  double m_CroppingMargin;
+  bool m_UseFixedPointSetReduction;
+  double m_ReductionFactor;
+  bool m_UseMortonOrder;
+  bool m_UseProgressiveAccuracy;
+  double m_ApproximationTolerance;
+
+  /** Perform optimization at the current level, returns relative change of the parameters. */
+  double OptimizeLevel(const double & scale);
+
+  /** Run the optimizer from the initial parameters, returns the final parameters. */
+  ParametersType RunOptimizer(const ParametersType & initialParameters);
+
+  /** Get the point sets used by the metric, which may be reordered. */
+  const FixedPointSetType * GetOrderedFixedPointSet() const
+  {
+    return m_FixedOrderedPointSet ? m_FixedOrderedPointSet.GetPointer() : m_FixedPointSet.GetPointer();
+  }
+
+  const MovingPointSetType * GetOrderedMovingPointSet() const
+  {
+    return m_MovingOrderedPointSet ? m_MovingOrderedPointSet.GetPointer() : m_MovingPointSet.GetPointer();
+  }
+
+  /** Get the fixed point set of the current level before the cropping. */
+  const FixedPointSetType * GetLevelFixedPointSet() const
+  {
+    if (m_FixedReducedPointSet) {
+      return m_FixedReducedPointSet.GetPointer();
+    }
+    return m_FixedTransformedPointSet ? m_FixedTransformedPointSet.GetPointer() : this->GetOrderedFixedPointSet();
+  }
+
+  /** Reduce the fixed point set to the weighted centroids of the points in the voxels. */
+  void ReduceFixedPointSet(const double & voxelSize);
+
+  /** Crop the fixed point set to the region of overlap with the transformed moving points. */
+  void CropFixedPointSet(const double & margin);
+
+  /** Append value to the array of the level values. */
+  template <typename TArray>
+  static void AppendLevelValue(TArray & array, const typename TArray::ValueType & value)
+  {
+    TArray values = array;
+    array.set_size(values.size() + 1);
+
+    for (size_t n = 0; n < values.size(); ++n) {
+      array[n] = values[n];
+    }
+
+    array[values.size()] = value;
+  }
 
 private:
   GMMPointSetToPointSetRegistrationMethod(const Self &) ITK_DELETE_FUNCTION;
@@ -2,6 +2,7 @@
 #define itkGMMPointSetToPointSetRegistrationMethod_hxx
 
 #include "itkGMMPointSetToPointSetRegistrationMethod.h"
+#include "itkTaskScheduler.h"
 
 namespace itk
 {
@@ -15,9 +16,12 @@ GMMPointSetToPointSetRegistrationMethod< TFixedPointSet, TMovingPointSet >::GMMP
 
   m_FixedPointSet = ITK_NULLPTR;
   m_FixedTransformedPointSet = ITK_NULLPTR;
+  m_FixedCroppedPointSet = ITK_NULLPTR;
+  m_FixedReducedPointSet = ITK_NULLPTR;
+  m_FixedOrderedPointSet = ITK_NULLPTR;
+  m_MovingOrderedPointSet = ITK_NULLPTR;
   m_FixedInitialTransform = ITK_NULLPTR;
   m_MovingPointSet = ITK_NULLPTR;
-  m_MovingTransformedPointSet = ITK_NULLPTR;
   m_MovingInitialTransform = ITK_NULLPTR;
 
   m_Transform = ITK_NULLPTR;
@@ -26,6 +30,21 @@ GMMPointSetToPointSetRegistrationMethod< TFixedPointSet, TMovingPointSet >::GMMP
 
   m_NumberOfLevels = 0;
 
+  m_UseAdaptiveScale = false;
+  m_ScaleFactor = 0.5;
+  m_MinimalScale = 0;
+  m_LevelSkipTolerance = 1.0e-03;
+  m_ValueTolerance = 0;
+  m_ParametersTolerance = 0;
+  m_StepLengthFactor = 1;
+  m_UseFixedPointSetCropping = false;
+  m_CroppingMargin = 1;
+  m_UseFixedPointSetReduction = false;
+  m_ReductionFactor = 0.25;
+  m_UseMortonOrder = false;
+  m_UseProgressiveAccuracy = false;
+  m_ApproximationTolerance = 1.0e-03;
+
   m_InitialTransformParameters = ParametersType(1);
   m_FinalTransformParameters = ParametersType(1);
 
@@ -76,6 +95,15 @@ GMMPointSetToPointSetRegistrationMethod< TFixedPointSet, TMovingPointSet >
     itkExceptionMacro(<< "Transform is not present");
   }
 
+  // the prebuilt index covers the whole fixed point set
+  if (m_UseFixedPointSetCropping && m_Metric->GetFixedPointsIndex()) {
+    itkExceptionMacro(<< "The cropping of the fixed point set is not supported with the prebuilt index of the fixed points");
+  }
+
+  if (m_UseFixedPointSetReduction && m_Metric->GetFixedPointsIndex()) {
+    itkExceptionMacro(<< "The reduction of the fixed point set is not supported with the prebuilt index of the fixed points");
+  }
+
   // Validate initial transform parameters
   if (m_InitialTransformParameters.Size() != m_Transform->GetNumberOfParameters()) {
     m_InitialTransformParameters = m_Transform->GetParameters();
@@ -88,21 +116,40 @@ GMMPointSetToPointSetRegistrationMethod< TFixedPointSet, TMovingPointSet >
   // setup the transform
   m_Transform->SetParameters(m_InitialTransformParameters);
 
-  if (m_NumberOfLevels > m_Scale.size()) {
-    itkExceptionMacro(<< "The number of levels is too large");
+  if (m_Scale.size() == 0) {
+    itkExceptionMacro(<< "Scale is not present");
+  }
+
+  if (m_UseAdaptiveScale) {
+    if (m_ScaleFactor <= 0 || m_ScaleFactor >= 1) {
+      itkExceptionMacro(<< "The scale factor must be in the range (0, 1)");
+    }
+
+    if (m_MinimalScale <= 0) {
+      m_MinimalScale = m_Scale[m_Scale.size() - 1];
+    }
+
+    if (m_MinimalScale > m_Scale[0]) {
+      m_MinimalScale = m_Scale[0];
+    }
   }
+  else {
+    if (m_NumberOfLevels > m_Scale.size()) {
+      itkExceptionMacro(<< "The number of levels is too large");
+    }
 
-  if (m_NumberOfLevels == 0) {
-    m_NumberOfLevels = m_Scale.Size();
+    if (m_NumberOfLevels == 0) {
+      m_NumberOfLevels = m_Scale.Size();
+    }
   }
 
+  m_LevelScales.clear();
+  m_LevelSearchRadii.clear();
+  m_LevelTruncationErrors.clear();
+  m_LevelNumbersOfFixedPoints.clear();
+  m_LevelNumbersOfNeighborListUpdates.clear();
   m_InitialMetricValues.clear();
-  m_InitialMetricValues.set_size(m_NumberOfLevels);
-  m_InitialMetricValues.Fill(NAN);
-
   m_FinalMetricValues.clear();
-  m_FinalMetricValues.set_size(m_NumberOfLevels);
-  m_FinalMetricValues.Fill(NAN);
 }
 
 template< typename TFixedPointSet, typename TMovingPointSet >
@@ -110,28 +157,69 @@ void
 GMMPointSetToPointSetRegistrationMethod< TFixedPointSet, TMovingPointSet >
 ::Preprocessing() throw (ExceptionObject)
 {
-  if ( m_FixedInitialTransform )
+  // the initial transforms are folded into the metric, so the point sets are used in place, the fixed
+  // point set is copied only if its initial transform does not preserve the distances
+  m_FixedTransformedPointSet = ITK_NULLPTR;
+  m_FixedReducedPointSet = ITK_NULLPTR;
+  m_FixedOrderedPointSet = ITK_NULLPTR;
+  m_MovingOrderedPointSet = ITK_NULLPTR;
+  m_MovingPointsPermutation.clear();
+
+  if ( m_UseMortonOrder )
   {
-    typename FixedPointsContainerType::Pointer points = FixedPointsContainerType::New();
-    m_FixedTransformedPointSet = FixedPointSetType::New();
+    // the point sets are ordered by the concurrent tasks
+    TaskScheduler::TaskGroup group;
 
-    for (FixedPointConstIterator it = m_FixedPointSet->GetPoints()->Begin(); it != m_FixedPointSet->GetPoints()->End(); ++it) {
-      points->InsertElement(it.Index(), m_FixedInitialTransform->TransformPoint(it.Value()));
+    group.Run([this]()
+    {
+      typedef MortonOrderPointSet<MovingPointSetType> MovingOrderType;
+      typename MovingOrderType::Pointer movingOrder = MovingOrderType::New();
+      movingOrder->SetPointSet(m_MovingPointSet);
+      movingOrder->Compute();
+      m_MovingOrderedPointSet = movingOrder->GetOutput();
+      m_MovingPointsPermutation = movingOrder->GetPermutation();
+    });
+
+    // the prebuilt index is keyed by the points in their order
+    if ( !m_Metric->GetFixedPointsIndex() )
+    {
+      group.Run([this]()
+      {
+        typedef MortonOrderPointSet<FixedPointSetType> FixedOrderType;
+        typename FixedOrderType::Pointer fixedOrder = FixedOrderType::New();
+        fixedOrder->SetPointSet(m_FixedPointSet);
+        fixedOrder->Compute();
+        m_FixedOrderedPointSet = fixedOrder->GetOutput();
+      });
     }
 
-    m_FixedTransformedPointSet->SetPoints(points);
+    group.Wait();
   }
 
-  if ( m_MovingInitialTransform ) 
+  const FixedPointSetType * fixedPointSet = this->GetOrderedFixedPointSet();
+
+  if ( m_FixedInitialTransform && !MetricType::IsRigidTransform(m_FixedInitialTransform) )
   {
-    typename MovingPointsContainerType::Pointer points = MovingPointsContainerType::New();
-    m_MovingTransformedPointSet = MovingPointSetType::New();
+    typename FixedPointsContainerType::Pointer points = FixedPointsContainerType::New();
+    points->resize(fixedPointSet->GetNumberOfPoints());
+    m_FixedTransformedPointSet = FixedPointSetType::New();
 
-    for (MovingPointConstIterator it = m_MovingPointSet->GetPoints()->Begin(); it != m_MovingPointSet->GetPoints()->End(); ++it) {
-      points->InsertElement(it.Index(), m_MovingInitialTransform->TransformPoint(it.Value()));
-    }
+    TaskScheduler::GetInstance().ParallelFor(0, points->Size(), 0, [this, fixedPointSet, &points](const size_t & first, const size_t & last) {
+      // SetElement would modify the time stamp of the shared container in each task
+      for (size_t n = first; n < last; ++n) {
+        points->ElementAt(n) = m_FixedInitialTransform->TransformPoint(fixedPointSet->GetPoint(n));
+      }
+    });
+    points->Modified();
 
-    m_MovingTransformedPointSet->SetPoints(points);
+    m_FixedTransformedPointSet->SetPoints(points);
+
+    // the point data, e.g. the weights, are copied, so the input is not shared with the internal point set
+    if (const FixedPointDataContainerType * data = fixedPointSet->GetPointData()) {
+      typename FixedPointDataContainerType::Pointer copy = FixedPointDataContainerType::New();
+      copy->CastToSTLContainer() = data->CastToSTLConstContainer();
+      m_FixedTransformedPointSet->SetPointData(copy);
+    }
   }
 }
 
@@ -239,42 +327,283 @@ GMMPointSetToPointSetRegistrationMethod< TFixedPointSet, TMovingPointSet >
   // setup the metric
   if (m_FixedTransformedPointSet) {
     m_Metric->SetFixedPointSet(m_FixedTransformedPointSet);
+    m_Metric->SetFixedInitialTransform(ITK_NULLPTR);
   }
   else {
-    m_Metric->SetFixedPointSet(m_FixedPointSet);
+    m_Metric->SetFixedPointSet(this->GetOrderedFixedPointSet());
+    m_Metric->SetFixedInitialTransform(m_FixedInitialTransform);
   }
 
-  if (m_MovingTransformedPointSet) {
-    m_Metric->SetMovingPointSet(m_MovingTransformedPointSet);
-  }
-  else {
-    m_Metric->SetMovingPointSet(m_MovingPointSet);
-  }
+  m_Metric->SetMovingPointSet(this->GetOrderedMovingPointSet());
+  m_Metric->SetMovingInitialTransform(m_MovingInitialTransform);
+  m_Metric->SetTotalNumberOfFixedPoints(0);
 
   m_Metric->SetTransform(m_Transform);
+  m_Metric->SetValueTolerance(m_ValueTolerance);
+  m_Metric->SetParametersTolerance(m_ParametersTolerance);
 
   // setup the optimizer
   m_Optimizer->SetCostFunction(m_Metric);
 
-  for (size_t level = 0; level < m_NumberOfLevels; ++level) {
-    m_Metric->SetScale(m_Scale[level]);
-    m_Metric->Initialize();
+  if (m_UseAdaptiveScale) {
+    // shrink the scale geometrically until the minimal scale is reached
+    double scale = m_Scale[0];
+
+    while (true) {
+      const double change = this->OptimizeLevel(scale);
+
+      if (scale <= m_MinimalScale || m_LevelScales.size() == m_NumberOfLevels) {
+        break;
+      }
+
+      // skip the next level if the current one does not change the solution
+      double factor = m_ScaleFactor;
+      if (change <= m_LevelSkipTolerance) {
+        factor *= m_ScaleFactor;
+      }
+
+      scale = std::max(scale * factor, m_MinimalScale);
+    }
+  }
+  else {
+    for (size_t level = 0; level < m_NumberOfLevels; ++level) {
+      this->OptimizeLevel(m_Scale[level]);
+    }
+  }
+}
+
+/**
+* Perform optimization at the level with the input scale
+*/
+template< typename TFixedPointSet, typename TMovingPointSet >
+double
+GMMPointSetToPointSetRegistrationMethod< TFixedPointSet, TMovingPointSet >
+::OptimizeLevel(const double & scale)
+{
+  m_Metric->SetScale(scale);
+
+  // the reduction weights the kernels of the fixed points only within the level
+  const bool useFixedPointWeights = m_Metric->GetUseFixedPointWeights();
+
+  if (m_UseFixedPointSetReduction) {
+    this->ReduceFixedPointSet(m_ReductionFactor * scale);
+  }
+
+  if (m_UseFixedPointSetCropping) {
+    m_Metric->ComputeSearchRadius();
+    this->CropFixedPointSet(m_Metric->GetSearchRadius() + m_CroppingMargin * scale);
+  }
+
+  m_Metric->Initialize();
+
+  const ParametersType initialParameters = m_Transform->GetParameters();
+
+  // the step length of the stochastic optimizer follows the scale of the level
+  typedef StochasticGradientDescentOptimizer StochasticOptimizerType;
+  if (StochasticOptimizerType * optimizer = dynamic_cast<StochasticOptimizerType *>(m_Optimizer.GetPointer())) {
+    optimizer->SetMaximalStepLength(m_StepLengthFactor * scale);
+  }
+
+  ParametersType parameters = initialParameters;
+
+  // the approximate optimization is stopped at the looser tolerances, the exact one continues from its result
+  if (m_UseProgressiveAccuracy) {
+    m_Metric->SetUseApproximation(true);
+    m_Metric->SetValueTolerance(m_ApproximationTolerance);
+    m_Metric->SetParametersTolerance(m_ApproximationTolerance);
+
+    parameters = this->RunOptimizer(parameters);
 
-    m_Optimizer->SetInitialPosition(m_Transform->GetParameters());
-    try {
-      m_Optimizer->StartOptimization();
+    m_Metric->SetUseApproximation(false);
+    m_Metric->SetValueTolerance(m_ValueTolerance);
+    m_Metric->SetParametersTolerance(m_ParametersTolerance);
+    m_Transform->SetParameters(parameters);
+    m_Metric->ResetConvergenceCheck();
+  }
+
+  m_FinalTransformParameters = this->RunOptimizer(parameters);
+
+  // get the results
+  m_Transform->SetParameters(m_FinalTransformParameters);
+
+  AppendLevelValue(m_LevelScales, scale);
+  AppendLevelValue(m_LevelSearchRadii, m_Metric->GetSearchRadius());
+  AppendLevelValue(m_LevelTruncationErrors, m_Metric->GetTruncationError());
+  AppendLevelValue(m_LevelNumbersOfFixedPoints, m_Metric->GetFixedPointSet()->GetNumberOfPoints());
+  AppendLevelValue(m_LevelNumbersOfNeighborListUpdates, m_Metric->GetNumberOfNeighborListUpdates());
+  // the values over the whole moving point set are reported
+  const bool useMiniBatch = m_Metric->GetUseMiniBatch();
+  m_Metric->SetUseMiniBatch(false);
+  AppendLevelValue(m_InitialMetricValues, m_Metric->GetValue(initialParameters));
+  AppendLevelValue(m_FinalMetricValues, m_Metric->GetValue(m_FinalTransformParameters));
+  m_Metric->SetUseMiniBatch(useMiniBatch);
+  m_Metric->SetUseFixedPointWeights(useFixedPointWeights);
+
+  // relative change of the transform parameters
+  double difference = 0;
+  double norm = 0;
+  for (size_t par = 0; par < initialParameters.size(); ++par) {
+    difference += (m_FinalTransformParameters[par] - initialParameters[par]) * (m_FinalTransformParameters[par] - initialParameters[par]);
+    norm += initialParameters[par] * initialParameters[par];
+  }
+
+  return std::sqrt(difference) / (1.0 + std::sqrt(norm));
+}
+/**
+* Run the optimizer from the initial parameters
+*/
+template< typename TFixedPointSet, typename TMovingPointSet >
+typename GMMPointSetToPointSetRegistrationMethod< TFixedPointSet, TMovingPointSet >::ParametersType
+GMMPointSetToPointSetRegistrationMethod< TFixedPointSet, TMovingPointSet >
+::RunOptimizer(const ParametersType & initialParameters)
+{
+  m_Optimizer->SetInitialPosition(initialParameters);
+  try {
+    m_Optimizer->StartOptimization();
+    return m_Optimizer->GetCurrentPosition();
+  }
+  catch (ProcessAborted &) {
+    // optimization has been stopped by the convergence check of the metric, the last evaluation may be
+    // a rejected trial point of the line search, so the best evaluated parameters are returned
+    return m_Metric->GetBestParameters();
+  }
+  catch (ExceptionObject & excep) {
+    std::cout << excep << std::endl;
+    return m_Optimizer->GetCurrentPosition();
+  }
+}
+
+/**
+* Reduce the fixed point set to the weighted centroids of the points in the voxels
+*/
+template< typename TFixedPointSet, typename TMovingPointSet >
+void
+GMMPointSetToPointSetRegistrationMethod< TFixedPointSet, TMovingPointSet >
+::ReduceFixedPointSet(const double & voxelSize)
+{
+  // the previous level is not reused, the fixed point set is reduced from the full one
+  m_FixedReducedPointSet = ITK_NULLPTR;
+
+  typedef ReducePointSet<FixedPointSetType> ReduceType;
+  typename ReduceType::Pointer reduce = ReduceType::New();
+  reduce->SetPointSet(this->GetLevelFixedPointSet());
+  reduce->SetVoxelSize(voxelSize);
+  // the point data are the weights of the fixed points only if the metric uses them
+  reduce->SetUseInputWeights(m_Metric->GetUseFixedPointWeights());
+  reduce->Compute();
+
+  m_FixedReducedPointSet = reduce->GetOutput();
+  m_Metric->SetFixedPointSet(m_FixedReducedPointSet);
+  m_Metric->SetUseFixedPointWeights(true);
+  m_Metric->SetTotalNumberOfFixedPoints(0);
+}
+
+/**
+* Crop the fixed point set to the bounding box of the transformed moving points
+*/
+template< typename TFixedPointSet, typename TMovingPointSet >
+void
+GMMPointSetToPointSetRegistrationMethod< TFixedPointSet, TMovingPointSet >
+::CropFixedPointSet(const double & margin)
+{
+  const FixedPointSetType * fixedPointSet = this->GetLevelFixedPointSet();
+
+  // the moving points are mapped to the frame of the fixed points as in the metric
+  typename TransformType::InverseTransformBasePointer fixedInverseTransform;
+  if (m_FixedInitialTransform && !m_FixedTransformedPointSet) {
+    fixedInverseTransform = m_FixedInitialTransform->GetInverseTransform();
+  }
+
+  typedef typename TransformType::InputPointType InputPointType;
+  InputPointType lower;
+  InputPointType upper;
+  lower.Fill(NumericTraits<double>::max());
+  upper.Fill(NumericTraits<double>::NonpositiveMin());
+
+  for (MovingPointConstIterator it = m_MovingPointSet->GetPoints()->Begin(); it != m_MovingPointSet->GetPoints()->End(); ++it) {
+    InputPointType point = it.Value();
+
+    if (m_MovingInitialTransform) {
+      point = m_MovingInitialTransform->TransformPoint(point);
+    }
+
+    point = m_Transform->TransformPoint(point);
+
+    if (fixedInverseTransform) {
+      point = fixedInverseTransform->TransformPoint(point);
+    }
+
+    for (size_t dim = 0; dim < FixedPointSetType::PointDimension; ++dim) {
+      lower[dim] = std::min(lower[dim], point[dim]);
+      upper[dim] = std::max(upper[dim], point[dim]);
+    }
+  }
+
+  for (size_t dim = 0; dim < FixedPointSetType::PointDimension; ++dim) {
+    lower[dim] -= margin;
+    upper[dim] += margin;
+  }
+
+  // the points are counted first, so the cropped set is allocated once
+  size_t numberOfPoints = 0;
+  for (FixedPointConstIterator it = fixedPointSet->GetPoints()->Begin(); it != fixedPointSet->GetPoints()->End(); ++it) {
+    bool inside = true;
+    for (size_t dim = 0; dim < FixedPointSetType::PointDimension; ++dim) {
+      inside &= it.Value()[dim] >= lower[dim] && it.Value()[dim] <= upper[dim];
     }
-    catch (ExceptionObject & excep) {
-      std::cout << excep << std::endl;
+    numberOfPoints += inside;
+  }
+
+  // the point data are cropped together with the points, they may hold the weights of the points
+  const FixedPointDataContainerType * data = fixedPointSet->GetPointData();
+  const bool cropData = data && data->Size() == fixedPointSet->GetNumberOfPoints();
+
+  double totalWeight = fixedPointSet->GetNumberOfPoints();
+  if (cropData && m_Metric->GetUseFixedPointWeights()) {
+    totalWeight = 0;
+    for (typename FixedPointDataContainerType::ConstIterator it = data->Begin(); it != data->End(); ++it) {
+      totalWeight += it.Value();
     }
+  }
+
+  m_Metric->SetTotalNumberOfFixedPoints(static_cast<size_t>(std::round(totalWeight)));
+
+  if (numberOfPoints == fixedPointSet->GetNumberOfPoints() || numberOfPoints == 0) {
+    m_FixedCroppedPointSet = ITK_NULLPTR;
+    m_Metric->SetFixedPointSet(fixedPointSet);
+    return;
+  }
+
+  typename FixedPointsContainerType::Pointer points = FixedPointsContainerType::New();
+  points->reserve(numberOfPoints);
 
-    // get the results
-    m_FinalTransformParameters = m_Optimizer->GetCurrentPosition();
-    m_Transform->SetParameters(m_FinalTransformParameters);
+  typename FixedPointDataContainerType::Pointer croppedData;
+  if (cropData) {
+    croppedData = FixedPointDataContainerType::New();
+    croppedData->reserve(numberOfPoints);
+  }
+
+  for (FixedPointConstIterator it = fixedPointSet->GetPoints()->Begin(); it != fixedPointSet->GetPoints()->End(); ++it) {
+    bool inside = true;
+    for (size_t dim = 0; dim < FixedPointSetType::PointDimension; ++dim) {
+      inside &= it.Value()[dim] >= lower[dim] && it.Value()[dim] <= upper[dim];
+    }
+
+    if (inside) {
+      points->push_back(it.Value());
+
+      if (croppedData) {
+        croppedData->push_back(data->ElementAt(it.Index()));
+      }
+    }
+  }
 
-    m_InitialMetricValues[level] = m_Metric->GetValue(m_Optimizer->GetInitialPosition());
-    m_FinalMetricValues[level] = m_Metric->GetValue(m_Optimizer->GetCurrentPosition());
+  m_FixedCroppedPointSet = FixedPointSetType::New();
+  m_FixedCroppedPointSet->SetPoints(points);
+  if (croppedData) {
+    m_FixedCroppedPointSet->SetPointData(croppedData);
   }
+  m_Metric->SetFixedPointSet(m_FixedCroppedPointSet);
 }
 } // end namespace itk
 #endif
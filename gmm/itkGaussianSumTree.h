@@ -0,0 +1,395 @@
+#ifndef itkGaussianSumTree_h
+#define itkGaussianSumTree_h
+
+#include <itkObject.h>
+#include <itkObjectFactory.h>
+#include <itkNumericTraits.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace itk
+{
+/** \class GaussianSumTree
+ * \brief Barnes-Hut approximation of sums of Gaussian kernels centred at the points.
+ *
+ * The points are stored in the octree, each node keeps the number of points, the centroid, the
+ * covariance matrix, the radius and the mean cubed distance of the points to the centroid. The sum
+ * of exp(-|x - y|^2 / scale) over the points y is computed by the traversal of the tree from the
+ * nearest nodes. The contribution of a node is approximated by the second order expansion of the
+ * kernel at the centroid, the first order terms vanish. The remainder is bounded by the third moment
+ * of the node and the maximal third derivative of the kernel over the ball of the node.
+ *
+ * A node is approximated if its error bound is below the half of the relative error times either
+ * the lower bound of its contribution or its share of points times the lower bound of the whole
+ * sum, so the error of the sum is below the relative error. Otherwise the node is opened, the
+ * leaves are summed exactly.
+ */
+template< typename TPointsContainer >
+class GaussianSumTree : public Object
+{
+public:
+  /** Standard class typedefs. */
+  typedef GaussianSumTree                  Self;
+  typedef Object                           Superclass;
+  typedef SmartPointer< Self >             Pointer;
+  typedef SmartPointer< const Self >       ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(GaussianSumTree, Object);
+
+  /** Extract the dimension of the points. */
+  itkStaticConstMacro(Dimension, unsigned int, TPointsContainer::Element::PointDimension);
+  itkStaticConstMacro(NumberOfChildren, unsigned int, 1u << TPointsContainer::Element::PointDimension);
+
+  typedef TPointsContainer PointsContainerType;
+
+  /** Get/Set the target relative error of the sums. */
+  itkSetMacro(RelativeError, double);
+  itkGetConstMacro(RelativeError, double);
+
+  /** Get/Set the maximal number of points in the leaves. */
+  itkSetMacro(LeafSize, size_t);
+  itkGetConstMacro(LeafSize, size_t);
+
+  /** Get the number of nodes. */
+  size_t GetNumberOfNodes() const
+  {
+    return m_Nodes.size();
+  }
+
+  /** Build the tree for the points. */
+  void Build(const PointsContainerType * points)
+  {
+    const size_t numberOfPoints = points->Size();
+
+    m_Points.resize(numberOfPoints * Dimension);
+    size_t n = 0;
+    for (typename PointsContainerType::ConstIterator it = points->Begin(); it != points->End(); ++it, ++n) {
+      for (unsigned int dim = 0; dim < Dimension; ++dim) {
+        m_Points[n * Dimension + dim] = it.Value()[dim];
+      }
+    }
+
+    m_Buffer.resize(m_Points.size());
+    m_Nodes.clear();
+    m_Frontier.clear();
+
+    if (numberOfPoints == 0) {
+      return;
+    }
+
+    m_Nodes.push_back(NodeType());
+    this->BuildNode(0, 0, numberOfPoints, 0);
+
+    std::vector<double>().swap(m_Buffer);
+  }
+
+  /** Compute the sum of the kernels and optionally the sum of kernels times (point - y). The exact sums
+   * over the leaves are evaluated in the compute value type and accumulated in double precision. */
+  template< typename TComputeValueType, typename TPoint >
+  double ComputeSum(const TPoint & point, const double & scale, double * gradient) const
+  {
+    double sum = 0;
+
+    if (gradient) {
+      for (unsigned int dim = 0; dim < Dimension; ++dim) {
+        gradient[dim] = 0;
+      }
+    }
+
+    if (m_Nodes.empty()) {
+      return sum;
+    }
+
+    double x[Dimension];
+    for (unsigned int dim = 0; dim < Dimension; ++dim) {
+      x[dim] = point[dim];
+    }
+
+    const double numberOfPoints = m_Nodes[0].count;
+
+    // lower bound of the sum over the coarse nodes
+    double frontierBound = 0;
+    for (size_t n = 0; n < m_Frontier.size(); ++n) {
+      const NodeType & node = m_Nodes[m_Frontier[n]];
+      const double distance = std::sqrt(this->SquaredDistance(x, node.center)) + node.radius;
+      frontierBound += node.count * std::exp(-distance * distance / scale);
+    }
+
+    double lowerBound = 0;
+
+    size_t stack[MaximalDepth * NumberOfChildren + 1];
+    size_t stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0) {
+      const NodeType & node = m_Nodes[stack[--stackSize]];
+
+      // exact sum over the leaf
+      if (node.numberOfChildren == 0) {
+        const TComputeValueType kernelScale = scale;
+        double leafSum = 0;
+
+        for (size_t n = node.begin; n < node.end; ++n) {
+          const double * y = &m_Points[n * Dimension];
+          TComputeValueType difference[Dimension];
+          TComputeValueType distance = 0;
+
+          for (unsigned int dim = 0; dim < Dimension; ++dim) {
+            difference[dim] = static_cast<TComputeValueType>(x[dim]) - static_cast<TComputeValueType>(y[dim]);
+            distance += difference[dim] * difference[dim];
+          }
+
+          const TComputeValueType kernel = std::exp(-distance / kernelScale);
+          leafSum += kernel;
+
+          if (gradient) {
+            for (unsigned int dim = 0; dim < Dimension; ++dim) {
+              gradient[dim] += kernel * difference[dim];
+            }
+          }
+        }
+
+        sum += leafSum;
+        lowerBound += leafSum;
+        continue;
+      }
+
+      // error bound of the second order expansion at the centroid by the third derivatives of the kernel
+      const double squaredDistance = this->SquaredDistance(x, node.center);
+      const double distance = std::sqrt(squaredDistance);
+      const double minimalDistance = std::max(0.0, distance - node.radius);
+      const double maximalDistance = distance + node.radius;
+      const double maximalKernel = std::exp(-minimalDistance * minimalDistance / scale);
+      const double minimalKernel = std::exp(-maximalDistance * maximalDistance / scale);
+      const double ratio = maximalDistance / std::sqrt(scale);
+      const double error = node.count * node.moment * maximalKernel * (8 * ratio * ratio * ratio + 12 * ratio) / (6 * scale * std::sqrt(scale));
+
+      if (error <= 0.5 * m_RelativeError * std::max(node.count * minimalKernel, node.count / numberOfPoints * std::max(lowerBound, frontierBound))) {
+        double w[Dimension];
+        double cw[Dimension];
+        double trace = 0;
+        double quadratic = 0;
+
+        for (unsigned int i = 0; i < Dimension; ++i) {
+          w[i] = x[i] - node.center[i];
+          trace += node.covariance[i * Dimension + i];
+        }
+
+        for (unsigned int i = 0; i < Dimension; ++i) {
+          cw[i] = 0;
+          for (unsigned int j = 0; j < Dimension; ++j) {
+            cw[i] += node.covariance[i * Dimension + j] * w[j];
+          }
+          quadratic += w[i] * cw[i];
+        }
+
+        const double kernel = node.count * std::exp(-squaredDistance / scale);
+        const double factor = 1 + 2 * quadratic / (scale * scale) - trace / scale;
+        sum += kernel * factor;
+
+        if (gradient) {
+          for (unsigned int dim = 0; dim < Dimension; ++dim) {
+            gradient[dim] += kernel * (w[dim] * factor - 2 * cw[dim] / scale);
+          }
+        }
+
+        lowerBound += std::max(0.0, kernel * factor - error);
+        continue;
+      }
+
+      // open the node, the nearest child is processed first
+      std::pair<double, size_t> children[NumberOfChildren];
+      for (unsigned int child = 0; child < node.numberOfChildren; ++child) {
+        const size_t index = node.firstChild + child;
+        children[child] = std::make_pair(this->SquaredDistance(x, m_Nodes[index].center), index);
+      }
+
+      std::sort(children, children + node.numberOfChildren);
+
+      for (unsigned int child = node.numberOfChildren; child > 0; --child) {
+        stack[stackSize++] = children[child - 1].second;
+      }
+    }
+
+    return sum;
+  }
+
+protected:
+  GaussianSumTree() {}
+  virtual ~GaussianSumTree() {}
+
+  virtual void PrintSelf(std::ostream & os, itk::Indent indent) const ITK_OVERRIDE
+  {
+    Superclass::PrintSelf(os, indent);
+    os << indent << "RelativeError: " << m_RelativeError << std::endl;
+    os << indent << "LeafSize: " << m_LeafSize << std::endl;
+    os << indent << "NumberOfNodes: " << m_Nodes.size() << std::endl;
+  }
+
+  /** The depth of the coarse nodes, which provide the lower bound of the sum, and the maximal depth. */
+  static const size_t FrontierDepth = 2;
+  static const size_t MaximalDepth = 32;
+
+  struct NodeType
+  {
+    double center[Dimension];
+    double covariance[Dimension * Dimension];
+    double radius;
+    double moment;
+    double count;
+    size_t begin;
+    size_t end;
+    size_t firstChild;
+    unsigned int numberOfChildren;
+  };
+
+  double SquaredDistance(const double * x, const double * y) const
+  {
+    double distance = 0;
+    for (unsigned int dim = 0; dim < Dimension; ++dim) {
+      distance += (x[dim] - y[dim]) * (x[dim] - y[dim]);
+    }
+    return distance;
+  }
+
+  /** Compute the moments of the node and split it into the octants of its bounding box. */
+  void BuildNode(const size_t & index, const size_t & begin, const size_t & end, const size_t & depth)
+  {
+    NodeType node;
+    node.begin = begin;
+    node.end = end;
+    node.count = end - begin;
+    node.firstChild = 0;
+    node.numberOfChildren = 0;
+
+    double lower[Dimension];
+    double upper[Dimension];
+
+    for (unsigned int dim = 0; dim < Dimension; ++dim) {
+      node.center[dim] = 0;
+      lower[dim] = NumericTraits<double>::max();
+      upper[dim] = NumericTraits<double>::NonpositiveMin();
+    }
+
+    for (size_t n = begin; n < end; ++n) {
+      for (unsigned int dim = 0; dim < Dimension; ++dim) {
+        const double value = m_Points[n * Dimension + dim];
+        node.center[dim] += value;
+        lower[dim] = std::min(lower[dim], value);
+        upper[dim] = std::max(upper[dim], value);
+      }
+    }
+
+    for (unsigned int dim = 0; dim < Dimension; ++dim) {
+      node.center[dim] /= node.count;
+    }
+
+    node.radius = 0;
+    node.moment = 0;
+    std::fill(node.covariance, node.covariance + Dimension * Dimension, 0.0);
+
+    for (size_t n = begin; n < end; ++n) {
+      const double * point = &m_Points[n * Dimension];
+      double distance = 0;
+
+      for (unsigned int i = 0; i < Dimension; ++i) {
+        const double difference = point[i] - node.center[i];
+        distance += difference * difference;
+
+        for (unsigned int j = 0; j < Dimension; ++j) {
+          node.covariance[i * Dimension + j] += difference * (point[j] - node.center[j]);
+        }
+      }
+
+      node.radius = std::max(node.radius, distance);
+      node.moment += distance * std::sqrt(distance);
+    }
+
+    for (unsigned int i = 0; i < Dimension * Dimension; ++i) {
+      node.covariance[i] /= node.count;
+    }
+
+    node.radius = std::sqrt(node.radius);
+    node.moment /= node.count;
+
+    bool split = end - begin > m_LeafSize && depth < MaximalDepth && node.radius > 0;
+
+    size_t counts[NumberOfChildren + 1];
+    std::fill(counts, counts + NumberOfChildren + 1, 0);
+
+    if (split) {
+      // partition the points by the octants
+      for (size_t n = begin; n < end; ++n) {
+        ++counts[this->Octant(&m_Points[n * Dimension], lower, upper) + 1];
+      }
+
+      for (unsigned int child = 0; child < NumberOfChildren; ++child) {
+        counts[child + 1] += counts[child];
+      }
+
+      std::vector<size_t> offsets(counts, counts + NumberOfChildren);
+      for (size_t n = begin; n < end; ++n) {
+        const size_t position = begin + offsets[this->Octant(&m_Points[n * Dimension], lower, upper)]++;
+        std::copy(&m_Points[n * Dimension], &m_Points[n * Dimension] + Dimension, &m_Buffer[position * Dimension]);
+      }
+
+      std::copy(&m_Buffer[begin * Dimension], &m_Buffer[begin * Dimension] + (end - begin) * Dimension, &m_Points[begin * Dimension]);
+
+      // allocate the children contiguously
+      node.firstChild = m_Nodes.size();
+      for (unsigned int child = 0; child < NumberOfChildren; ++child) {
+        if (counts[child + 1] > counts[child]) {
+          ++node.numberOfChildren;
+        }
+      }
+
+      m_Nodes.resize(m_Nodes.size() + node.numberOfChildren);
+    }
+
+    m_Nodes[index] = node;
+
+    if (depth == FrontierDepth || (depth < FrontierDepth && !split)) {
+      m_Frontier.push_back(index);
+    }
+
+    if (split) {
+      size_t child = node.firstChild;
+      for (unsigned int octant = 0; octant < NumberOfChildren; ++octant) {
+        if (counts[octant + 1] > counts[octant]) {
+          this->BuildNode(child++, begin + counts[octant], begin + counts[octant + 1], depth + 1);
+        }
+      }
+    }
+  }
+
+  unsigned int Octant(const double * point, const double * lower, const double * upper) const
+  {
+    unsigned int octant = 0;
+    for (unsigned int dim = 0; dim < Dimension; ++dim) {
+      if (point[dim] > 0.5 * (lower[dim] + upper[dim])) {
+        octant |= 1u << dim;
+      }
+    }
+    return octant;
+  }
+
+  double m_RelativeError = 1.0e-03;
+  size_t m_LeafSize = 16;
+
+  std::vector<double> m_Points;
+  std::vector<double> m_Buffer;
+  std::vector<NodeType> m_Nodes;
+  std::vector<size_t> m_Frontier;
+
+private:
+  GaussianSumTree(const Self &) ITK_DELETE_FUNCTION;
+  void operator=(const Self &) ITK_DELETE_FUNCTION;
+};
+}
+
+#endif
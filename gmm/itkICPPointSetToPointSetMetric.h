@@ -1,9 +1,11 @@
 #ifndef itkICPPointSetToPointSetMetric_h
 #define itkICPPointSetToPointSetMetric_h
 
-#include <itkPointsLocator.h>
+#include <vector>
 
 #include "itkGMMPointSetToPointSetMetricBase.h"
+#include "itkPointSetNormalsEstimator.h"
+#include "itkPointSetDistanceField.h"
 
 namespace itk
 {
@@ -17,7 +19,7 @@ namespace itk
  * Spatial correspondence between both images is established through a
  * Transform.
  */
-template< typename TFixedPointSet, typename TMovingPointSet >
+template< typename TFixedPointSet, typename TMovingPointSet = TFixedPointSet >
 class ICPPointSetToPointSetMetric : public GMMPointSetToPointSetMetricBase < TFixedPointSet, TMovingPointSet >
 {
 public:
@@ -31,16 +33,75 @@ public:
   itkNewMacro(Self);
 
   /** Run-time type information (and related methods). */
-  itkTypeMacro(GMMKCPointSetToPointSetMetric, GMMPointSetToPointSetMetricBase);
+  itkTypeMacro(ICPPointSetToPointSetMetric, GMMPointSetToPointSetMetricBase);
 
   /** Types transferred from the base class */
   typedef typename Superclass::MeasureType               MeasureType;
+  typedef typename Superclass::FixedPointSetType         FixedPointSetType;
+  typedef typename Superclass::FixedPointType            FixedPointType;
   typedef typename Superclass::MovingPointType           MovingPointType;
+  typedef typename Superclass::MovingPointIdentifier     MovingPointIdentifier;
+  typedef typename Superclass::MovingPointsContainer     MovingPointsContainer;
   typedef typename Superclass::LocalDerivativeType       LocalDerivativeType;
-  typedef typename Superclass::LocalDerivativeValueType  LocalDerivativeValueType;
   typedef typename Superclass::FixedPointIterator        FixedPointIterator;
+  typedef typename Superclass::FixedPointsLocatorType    FixedPointsLocatorType;
+  typedef typename FixedPointsLocatorType::PointIdentifier  FixedPointIdentifier;
 
-  typedef itk::PointsLocator<typename FixedPointSetType::PointsContainer>  FixedPointsLocatorType;
+  /** Types of the fixed point set normals */
+  typedef PointSetNormalsEstimator<FixedPointSetType>         NormalsEstimatorType;
+  typedef typename NormalsEstimatorType::NormalType           NormalType;
+  typedef typename NormalsEstimatorType::NormalsContainerType NormalsContainerType;
+
+  /** Get/Set boolean flag to measure distances of the moving points to the tangent planes of
+   * the closest fixed points instead of the distances to the points.  */
+  itkSetMacro(UsePointToPlane, bool);
+  itkGetMacro(UsePointToPlane, bool);
+  itkBooleanMacro(UsePointToPlane);
+
+  /** Get/Set the number of nearest neighbours to estimate normals of the fixed point set.  */
+  itkSetMacro(NumberOfNeighbors, size_t);
+  itkGetMacro(NumberOfNeighbors, size_t);
+
+  /** Get/Set normals of the fixed point set, e.g. computed from mesh cells. If normals are not set,
+   * they are estimated by PCA on initialization and cached for the following initializations.  */
+  itkSetConstObjectMacro(FixedNormals, NormalsContainerType);
+  itkGetConstObjectMacro(FixedNormals, NormalsContainerType);
+
+  /** Get/Set boolean flag to reuse the closest fixed points found for the moving points at the previous
+   * evaluations. The match of a moving point is kept without search while the point stays in the ball,
+   * where the closest point cannot change, i.e. its shift is below the half of the difference between
+   * the distances to the second and the first closest points. Otherwise the closest point is searched
+   * in the ball through the previous match and finally by the full query. The results are exact. */
+  itkSetMacro(UseCorrespondenceCache, bool);
+  itkGetMacro(UseCorrespondenceCache, bool);
+  itkBooleanMacro(UseCorrespondenceCache);
+
+  /** Type of the distance field of the fixed point set */
+  typedef PointSetDistanceField<FixedPointSetType>            DistanceFieldType;
+
+  /** Get/Set boolean flag to evaluate the point-to-point values and derivatives by interpolation of
+   * the distance field of the fixed point set, only the values and the derivatives are approximate.
+   * ComputeCorrespondences uses the closest point of the nearest node of the field as the seed and searches
+   * the ball through it, so the correspondences are exact. The full search is used outside the grid. */
+  itkSetMacro(UseDistanceField, bool);
+  itkGetMacro(UseDistanceField, bool);
+  itkBooleanMacro(UseDistanceField);
+
+  /** Get/Set the spacing and the band width of the distance field grid, see PointSetDistanceField. */
+  itkSetMacro(DistanceFieldSpacing, double);
+  itkGetMacro(DistanceFieldSpacing, double);
+
+  itkSetMacro(DistanceFieldBandWidth, double);
+  itkGetMacro(DistanceFieldBandWidth, double);
+
+  /** Get/Set the distance field. If it is not set or computed for another point set, the field is computed
+   * on initialization. The field can be shared by the metrics with the same fixed point set. */
+  itkSetConstObjectMacro(DistanceField, DistanceFieldType);
+  itkGetConstObjectMacro(DistanceField, DistanceFieldType);
+
+  /** Find the closest fixed points and squared distances to them for the points in parallel. The
+   * points are identified by their positions in the container. */
+  void ComputeCorrespondences(const MovingPointsContainer * points, std::vector<FixedPointIdentifier> & indices, std::vector<double> & distances) const;
 
   /** Calculates the local metric value for a single point.*/
   virtual MeasureType GetLocalNeighborhoodValue(const MovingPointType & point) const ITK_OVERRIDE;
@@ -48,6 +109,11 @@ public:
   /** Calculates the local value/derivative for a single point.*/
   virtual void GetLocalNeighborhoodValueAndDerivative(const MovingPointType &, MeasureType &, LocalDerivativeType &) const ITK_OVERRIDE;
 
+  /** Calculates the local value and value/derivative for the moving point with the identifier using the correspondence cache. */
+  virtual MeasureType GetLocalValue(const MovingPointIdentifier & id, const MovingPointType & point) const ITK_OVERRIDE;
+
+  virtual void GetLocalValueAndDerivative(const MovingPointIdentifier & id, const MovingPointType & point, MeasureType & value, LocalDerivativeType & derivative) const ITK_OVERRIDE;
+
   /** Initialize the Metric by making sure that all the components are present and plugged together correctly.*/
   virtual void Initialize() throw (ExceptionObject)ITK_OVERRIDE;
 
@@ -55,7 +121,36 @@ protected:
   ICPPointSetToPointSetMetric();
   virtual ~ICPPointSetToPointSetMetric() {}
 
-  typename FixedPointsLocatorType::Pointer m_FixedPointsLocator;
+  /** Find the closest fixed point for the moving point with the identifier. */
+  FixedPointIdentifier FindClosestPoint(const MovingPointIdentifier & id, const MovingPointType & point) const;
+
+  /** Evaluate the local value and optionally the derivative by the distance field, returns false if it is not possible. */
+  bool EvaluateDistanceField(const MovingPointType & point, MeasureType & value, LocalDerivativeType * derivative) const;
+
+  /** Compute the local value and optionally the derivative for the pair of the moving and fixed points. */
+  MeasureType ComputeLocalValue(const MovingPointType & point, const FixedPointIdentifier & idx, LocalDerivativeType * derivative) const;
+
+  /** The last exact match of a moving point, the position of the point at the search and the radius of
+   * the ball around the position, where the match is preserved. */
+  struct CorrespondenceType
+  {
+    MovingPointType point;
+    FixedPointIdentifier index;
+    double margin;
+    bool valid;
+  };
+
+  bool m_UsePointToPlane;
+  size_t m_NumberOfNeighbors;
+  typename NormalsContainerType::ConstPointer m_FixedNormals;
+
+  bool m_UseDistanceField;
+  double m_DistanceFieldSpacing;
+  double m_DistanceFieldBandWidth;
+  typename DistanceFieldType::ConstPointer m_DistanceField;
+
+  bool m_UseCorrespondenceCache;
+  mutable std::vector<CorrespondenceType> m_Correspondences;
 
 private:
   ICPPointSetToPointSetMetric(const Self &) ITK_DELETE_FUNCTION;
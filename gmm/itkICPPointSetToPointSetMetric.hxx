@@ -2,6 +2,7 @@
 #define itkICPPointSetToPointSetMetric_hxx
 
 #include "itkICPPointSetToPointSetMetric.h"
+#include "itkTaskScheduler.h"
 
 namespace itk
 {
@@ -11,6 +12,19 @@ namespace itk
 template <typename TFixedPointSet, typename TMovingPointSet>
 ICPPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>::ICPPointSetToPointSetMetric()
 {
+  this->SetUseFixedPointSetKdTree(true);
+  this->SetUseMovingPointSetKdTree(false);
+
+  m_UsePointToPlane = false;
+  m_NumberOfNeighbors = 10;
+  m_FixedNormals = ITK_NULLPTR;
+
+  m_UseDistanceField = false;
+  m_DistanceFieldSpacing = 0;
+  m_DistanceFieldBandWidth = -1;
+  m_DistanceField = ITK_NULLPTR;
+
+  m_UseCorrespondenceCache = true;
 }
 
 /** Initialize the metric */
@@ -21,13 +35,37 @@ ICPPointSetToPointSetMetric< TFixedPointSet, TMovingPointSet >
 {
   Superclass::Initialize();
 
-  typename FixedPointSetType::PointsContainer::ConstPointer fixedPointContainer = this->m_FixedPointSet->GetPoints();
+  this->m_NormalizingValueFactor = 1.0 / this->m_MovingPointSet->GetNumberOfPoints();
 
-  m_FixedPointsLocator = FixedPointsLocatorType::New();
-  m_FixedPointsLocator->SetPoints(const_cast<typename FixedPointSetType::PointsContainer*> (fixedPointContainer.GetPointer()));
-  m_FixedPointsLocator->Initialize();
+  if (m_UsePointToPlane) {
+    if (!m_FixedNormals || m_FixedNormals->Size() != this->m_FixedPointSet->GetNumberOfPoints()) {
+      typename NormalsEstimatorType::Pointer estimator = NormalsEstimatorType::New();
+      estimator->SetPointSet(this->m_FixedPointSet);
+      estimator->SetNumberOfNeighbors(m_NumberOfNeighbors);
+      estimator->Compute();
+      m_FixedNormals = estimator->GetNormals();
+    }
+  }
 
-  this->m_NormalizingValueFactor = 1.0 / this->m_MovingPointSet->GetNumberOfPoints();
+  if (m_UseDistanceField) {
+    if (m_UsePointToPlane) {
+      itkExceptionMacro(<< "The distance field is not supported for the point-to-plane distances");
+    }
+
+    if (!m_DistanceField || m_DistanceField->GetPointSet() != this->m_FixedPointSet.GetPointer()) {
+      typename DistanceFieldType::Pointer field = DistanceFieldType::New();
+      field->SetPointSet(this->m_FixedPointSet);
+      field->SetSpacing(m_DistanceFieldSpacing);
+      field->SetBandWidth(m_DistanceFieldBandWidth);
+      field->Compute();
+      m_DistanceField = field;
+    }
+  }
+
+  // reset the correspondence cache
+  CorrespondenceType correspondence;
+  correspondence.valid = false;
+  m_Correspondences.assign(this->m_MovingPointSet->GetNumberOfPoints(), correspondence);
 }
 
 template<typename TFixedPointSet, typename TMovingPointSet>
@@ -36,11 +74,12 @@ typename ICPPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
 ICPPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
 ::GetLocalNeighborhoodValue(const MovingPointType & point) const
 {
-  // find closest point
-  size_t idx = m_FixedPointsLocator->FindClosestPoint(point);
-  const typename FixedPointSetType::PointType fixedPoint = this->m_FixedPointSet->GetPoint(idx);
+  MeasureType value;
+  if (this->EvaluateDistanceField(point, value, ITK_NULLPTR)) {
+    return value;
+  }
 
-  return point.SquaredEuclideanDistanceTo(fixedPoint);
+  return this->ComputeLocalValue(point, this->FindClosestFixedPoint(point), ITK_NULLPTR);
 }
 
 template<typename TFixedPointSet, typename TMovingPointSet>
@@ -48,17 +87,192 @@ void
 ICPPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
 ::GetLocalNeighborhoodValueAndDerivative(const MovingPointType & point, MeasureType & value, LocalDerivativeType & derivative) const
 {
-  // find closest point
-  size_t idx = m_FixedPointsLocator->FindClosestPoint(point);
-  const typename FixedPointSetType::PointType fixedPoint = this->m_FixedPointSet->GetPoint(idx);
+  if (this->EvaluateDistanceField(point, value, &derivative)) {
+    return;
+  }
+
+  value = this->ComputeLocalValue(point, this->FindClosestFixedPoint(point), &derivative);
+}
 
-  // compute value
-  value = point.SquaredEuclideanDistanceTo(fixedPoint);
+template<typename TFixedPointSet, typename TMovingPointSet>
+typename ICPPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
+::MeasureType
+ICPPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
+::GetLocalValue(const MovingPointIdentifier & id, const MovingPointType & point) const
+{
+  MeasureType value;
+  if (this->EvaluateDistanceField(point, value, ITK_NULLPTR)) {
+    return value;
+  }
+
+  return this->ComputeLocalValue(point, this->FindClosestPoint(id, point), ITK_NULLPTR);
+}
+
+template<typename TFixedPointSet, typename TMovingPointSet>
+void
+ICPPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
+::GetLocalValueAndDerivative(const MovingPointIdentifier & id, const MovingPointType & point, MeasureType & value, LocalDerivativeType & derivative) const
+{
+  if (this->EvaluateDistanceField(point, value, &derivative)) {
+    return;
+  }
+
+  value = this->ComputeLocalValue(point, this->FindClosestPoint(id, point), &derivative);
+}
+
+template<typename TFixedPointSet, typename TMovingPointSet>
+bool
+ICPPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
+::EvaluateDistanceField(const MovingPointType & point, MeasureType & value, LocalDerivativeType * derivative) const
+{
+  if (!m_UseDistanceField) {
+    return false;
+  }
+
+  double gradient[Superclass::PointDimension];
+  if (!m_DistanceField->Evaluate(point, value, derivative ? gradient : ITK_NULLPTR)) {
+    return false;
+  }
+
+  if (derivative) {
+    for (size_t dim = 0; dim < this->PointDimension; ++dim) {
+      (*derivative)[dim] = gradient[dim];
+    }
+  }
+
+  return true;
+}
+
+template<typename TFixedPointSet, typename TMovingPointSet>
+typename ICPPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
+::MeasureType
+ICPPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
+::ComputeLocalValue(const MovingPointType & point, const FixedPointIdentifier & idx, LocalDerivativeType * derivative) const
+{
+  const FixedPointType & fixedPoint = this->m_FixedPointSet->GetPoint(idx);
+
+  if (m_UsePointToPlane) {
+    // compute value and gradient for the distance to the tangent plane
+    const NormalType & normal = m_FixedNormals->ElementAt(idx);
+    double distance = 0;
+
+    for (size_t dim = 0; dim < this->PointDimension; ++dim) {
+      distance += (point[dim] - fixedPoint[dim]) * normal[dim];
+    }
+
+    if (derivative) {
+      for (size_t dim = 0; dim < this->PointDimension; ++dim) {
+        (*derivative)[dim] = 2.0 * distance * normal[dim];
+      }
+    }
+
+    return distance * distance;
+  }
 
   // compute gradient for the current moving point
-  for (size_t dim = 0; dim < this->PointDimension; ++dim) {
-    derivative[dim] = 2.0 * (point[dim] - fixedPoint[dim]);
+  if (derivative) {
+    for (size_t dim = 0; dim < this->PointDimension; ++dim) {
+      (*derivative)[dim] = 2.0 * (point[dim] - fixedPoint[dim]);
+    }
+  }
+
+  return point.SquaredEuclideanDistanceTo(fixedPoint);
+}
+
+template<typename TFixedPointSet, typename TMovingPointSet>
+typename ICPPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
+::FixedPointIdentifier
+ICPPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
+::FindClosestPoint(const MovingPointIdentifier & id, const MovingPointType & point) const
+{
+  if (!m_UseCorrespondenceCache || id >= m_Correspondences.size()) {
+    return this->FindClosestFixedPoint(point);
+  }
+
+  CorrespondenceType & correspondence = m_Correspondences[id];
+  typename FixedPointsLocatorType::NeighborsIdentifierType idx;
+
+  if (correspondence.valid) {
+    // the closest point cannot change inside the ball
+    if (point.EuclideanDistanceTo(correspondence.point) <= correspondence.margin) {
+      return correspondence.index;
+    }
+
+    // all the points closer than the previous match are in the ball through it
+    const double radius = point.EuclideanDistanceTo(this->m_FixedPointSet->GetPoint(correspondence.index));
+    this->SearchFixedPoints(point, radius * (1 + 1.0e-06), idx);
+  }
+
+  // full query, if the ball does not contain two points
+  if (idx.size() < 2) {
+    this->FindClosestFixedPoints(point, 2, idx);
   }
+
+  // find the first and the second closest points
+  FixedPointIdentifier index = idx[0];
+  double first = NumericTraits<double>::max();
+  double second = NumericTraits<double>::max();
+
+  for (size_t n = 0; n < idx.size(); ++n) {
+    const double distance = point.EuclideanDistanceTo(this->m_FixedPointSet->GetPoint(idx[n]));
+
+    if (distance < first) {
+      second = first;
+      first = distance;
+      index = idx[n];
+    }
+    else if (distance < second) {
+      second = distance;
+    }
+  }
+
+  correspondence.point = point;
+  correspondence.index = index;
+  correspondence.margin = 0.5 * (second - first);
+  correspondence.valid = true;
+
+  return index;
+}
+
+template<typename TFixedPointSet, typename TMovingPointSet>
+void
+ICPPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet>
+::ComputeCorrespondences(const MovingPointsContainer * points, std::vector<FixedPointIdentifier> & indices, std::vector<double> & distances) const
+{
+  const size_t numberOfPoints = points->Size();
+
+  indices.resize(numberOfPoints);
+  distances.resize(numberOfPoints);
+
+  TaskScheduler::GetInstance().ParallelFor(0, numberOfPoints, 0, [&](const size_t & first, const size_t & last) {
+    typename FixedPointsLocatorType::NeighborsIdentifierType idx;
+
+    for (size_t n = first; n < last; ++n) {
+      const MovingPointType & point = points->ElementAt(n);
+      FixedPointIdentifier index;
+
+      if (m_UseDistanceField && m_DistanceField->FindClosestPoint(point, index)) {
+        // the point of the nearest node is the seed, all the points closer than it are in the ball through it
+        const double radius = point.EuclideanDistanceTo(this->m_FixedPointSet->GetPoint(index));
+        this->SearchFixedPoints(point, radius * (1 + 1.0e-06), idx);
+
+        double minimum = radius;
+        for (size_t k = 0; k < idx.size(); ++k) {
+          const double distance = point.EuclideanDistanceTo(this->m_FixedPointSet->GetPoint(idx[k]));
+          if (distance < minimum) {
+            minimum = distance;
+            index = idx[k];
+          }
+        }
+
+        indices[n] = index;
+      }
+      else {
+        indices[n] = this->FindClosestPoint(n, point);
+      }
+      distances[n] = point.SquaredEuclideanDistanceTo(this->m_FixedPointSet->GetPoint(indices[n]));
+    }
+  });
 }
 }
 
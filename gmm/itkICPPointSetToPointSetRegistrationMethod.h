@@ -0,0 +1,209 @@
+#ifndef itkICPPointSetToPointSetRegistrationMethod_h
+#define itkICPPointSetToPointSetRegistrationMethod_h
+
+#include "itkProcessObject.h"
+#include "itkDataObjectDecorator.h"
+#include "itkICPPointSetToPointSetMetric.h"
+#include <itkTranslationTransform.h>
+#include <itkVersorRigid3DTransform.h>
+#include <itkSimilarity3DTransform.h>
+#include <vnl/vnl_matrix.h>
+#include <vnl/vnl_vector.h>
+#include <vector>
+#include <string>
+
+namespace itk
+{
+/** \class ICPPointSetToPointSetRegistrationMethod
+ * \brief Iterative closest point registration with the closed-form updates.
+ *
+ * Each iteration finds the closest fixed points for the transformed moving points in parallel
+ * by means of the kd-tree of the ICP metric, rejects the pairs with the largest distances
+ * (trimming) and computes the transform minimizing the sum of squared distances of the
+ * remaining pairs by SVD of the cross-covariance matrix (Umeyama, Horn). Translation,
+ * VersorRigid3D and Similarity3D transforms are supported.
+ *
+ * If point-to-plane distances are used, the transform is updated by the Gauss-Newton step
+ * for the sum of squared distances of the moving points to the tangent planes of the fixed
+ * points, linearized in the small rotation, scaling and translation. The normals of the
+ * fixed points are provided by the metric.
+ */
+template< typename TFixedPointSet, typename TMovingPointSet = TFixedPointSet >
+class ICPPointSetToPointSetRegistrationMethod : public ProcessObject
+{
+public:
+  /** Standard class typedefs. */
+  typedef ICPPointSetToPointSetRegistrationMethod  Self;
+  typedef ProcessObject                            Superclass;
+  typedef SmartPointer< Self >                     Pointer;
+  typedef SmartPointer< const Self >               ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(ICPPointSetToPointSetRegistrationMethod, ProcessObject);
+
+  /**  Type of the Fixed PointSet. */
+  typedef          TFixedPointSet                           FixedPointSetType;
+  typedef typename FixedPointSetType::ConstPointer          FixedPointSetConstPointer;
+  typedef typename FixedPointSetType::PointType             FixedPointType;
+
+  /**  Type of the Moving PointSet. */
+  typedef          TMovingPointSet                          MovingPointSetType;
+  typedef typename MovingPointSetType::ConstPointer         MovingPointSetConstPointer;
+  typedef typename MovingPointSetType::PointType            MovingPointType;
+  typedef typename MovingPointSetType::PointsContainer      MovingPointsContainerType;
+
+  /** The closed-form updates and the linearized rotations are written for three dimensions. */
+  static_assert(FixedPointSetType::PointDimension == 3U, "Invalid dimension. Dimension 3 is supported.");
+
+  /**  Type of the metric. */
+  typedef ICPPointSetToPointSetMetric<FixedPointSetType, MovingPointSetType>  MetricType;
+  typedef typename MetricType::Pointer                                        MetricPointer;
+  typedef typename MetricType::FixedPointIdentifier                           FixedPointIdentifier;
+  typedef typename MetricType::MeasureType                                    MeasureType;
+  typedef typename MetricType::DistanceFieldType                              DistanceFieldType;
+
+  /**  Type of the Transform . */
+  typedef typename MetricType::TransformType     TransformType;
+  typedef typename TransformType::Pointer        TransformPointer;
+  typedef typename TransformType::ParametersType ParametersType;
+
+  /** The transforms with the closed-form updates. */
+  typedef TranslationTransform<double, 3>        TranslationTransformType;
+  typedef VersorRigid3DTransform<double>         VersorRigid3DTransformType;
+  typedef Similarity3DTransform<double>          Similarity3DTransformType;
+
+  /** Type for the output: Using Decorator pattern for enabling
+   *  the Transform to be passed in the data pipeline */
+  typedef  DataObjectDecorator< TransformType >      TransformOutputType;
+  typedef typename TransformOutputType::Pointer      TransformOutputPointer;
+
+  /** Smart Pointer type to a DataObject. */
+  typedef typename DataObject::Pointer DataObjectPointer;
+
+  /** Set/Get the Fixed PointSet. */
+  itkSetConstObjectMacro(FixedPointSet, FixedPointSetType);
+  itkGetConstObjectMacro(FixedPointSet, FixedPointSetType);
+
+  /** Set/Get the Moving PointSet. */
+  itkSetConstObjectMacro(MovingPointSet, MovingPointSetType);
+  itkGetConstObjectMacro(MovingPointSet, MovingPointSetType);
+
+  /** Set/Get the Transform. */
+  itkSetObjectMacro(Transform, TransformType);
+  itkGetModifiableObjectMacro(Transform, TransformType);
+
+  /** Set/Get the Metric, which provides the closest point search. */
+  itkSetObjectMacro(Metric, MetricType);
+  itkGetModifiableObjectMacro(Metric, MetricType);
+
+  /** Set/Get the distance field of the fixed point set. If it is set, the metric seeds the search of the
+   * exact correspondences by the field, see ICPPointSetToPointSetMetric::SetUseDistanceField. */
+  itkSetConstObjectMacro(DistanceField, DistanceFieldType);
+  itkGetConstObjectMacro(DistanceField, DistanceFieldType);
+
+  /** Set/Get the maximal number of iterations. */
+  itkSetMacro(NumberOfIterations, size_t);
+  itkGetMacro(NumberOfIterations, size_t);
+
+  /** Set/Get boolean flag to minimize the point-to-plane distances by the Gauss-Newton steps. */
+  itkSetMacro(UsePointToPlane, bool);
+  itkGetMacro(UsePointToPlane, bool);
+  itkBooleanMacro(UsePointToPlane);
+
+  /** Set/Get the ratio of the closest pairs used to update the transform, the others are rejected. */
+  itkSetClampMacro(TrimmingRatio, double, 0.0, 1.0);
+  itkGetMacro(TrimmingRatio, double);
+
+  /** Set/Get relative tolerances of the RMS distance and the parameters changes to stop iterations. */
+  itkSetMacro(ValueTolerance, double);
+  itkGetMacro(ValueTolerance, double);
+
+  itkSetMacro(ParametersTolerance, double);
+  itkGetMacro(ParametersTolerance, double);
+
+  /** Get the results. */
+  itkGetConstReferenceMacro(InitialTransformParameters, ParametersType);
+  itkGetConstReferenceMacro(FinalTransformParameters, ParametersType);
+  itkGetMacro(InitialValue, MeasureType);
+  itkGetMacro(FinalValue, MeasureType);
+  itkGetMacro(CurrentIteration, size_t);
+  itkGetStringMacro(StopConditionDescription);
+
+  /** Returns the transform resulting from the registration process  */
+  const TransformOutputType * GetOutput() const;
+
+  /** Make a DataObject of the correct type to be used as the specified output. */
+  typedef ProcessObject::DataObjectPointerArraySizeType DataObjectPointerArraySizeType;
+  using Superclass::MakeOutput;
+  virtual DataObjectPointer MakeOutput(DataObjectPointerArraySizeType idx) ITK_OVERRIDE;
+
+protected:
+  ICPPointSetToPointSetRegistrationMethod();
+  virtual ~ICPPointSetToPointSetRegistrationMethod() {};
+
+  /** Method invoked by the pipeline in order to trigger the computation of the registration. */
+  virtual void GenerateData() ITK_OVERRIDE;
+
+  /** Initialize by setting the interconnects between the components. */
+  void Initialize() throw (ExceptionObject);
+
+  /** Find correspondences for the current transform, reject the farthest pairs and return
+   * the RMS distance of the remaining pairs. */
+  MeasureType ComputeCorrespondences();
+
+  /** Compute the closed-form transform for the current pairs of the moving and fixed points. */
+  void ComputeTransform();
+
+  /** Update the transform by the Gauss-Newton step for the point-to-plane distances of the current pairs. */
+  void ComputeLinearizedTransform();
+
+  /** The kinds of the supported transforms. */
+  enum TransformKindType { TranslationKind, RigidKind, SimilarityKind };
+
+  /** Get the kind of the transform by dynamic_cast, the subclasses with more parameters, e.g.
+   * ScaleSkewVersor3DTransform, are rejected. Throws if the transform is not supported. */
+  TransformKindType GetTransformKind() const;
+
+  /** Set the matrix and the offset of the transform, the matrix is ignored by the translation transform. */
+  void UpdateTransform(const vnl_matrix<double> & matrix, const vnl_vector<double> & offset);
+
+  FixedPointSetConstPointer  m_FixedPointSet;
+  MovingPointSetConstPointer m_MovingPointSet;
+
+  MetricPointer m_Metric;
+  TransformPointer m_Transform;
+  typename DistanceFieldType::ConstPointer m_DistanceField;
+
+  typename MovingPointsContainerType::Pointer m_TransformedPoints;
+  std::vector<FixedPointIdentifier> m_Indices;
+  std::vector<double> m_Distances;
+  std::vector<size_t> m_Pairs;
+
+  ParametersType m_InitialTransformParameters;
+  ParametersType m_FinalTransformParameters;
+
+  size_t m_NumberOfIterations;
+  size_t m_CurrentIteration;
+  bool m_UsePointToPlane;
+  double m_TrimmingRatio;
+  double m_ValueTolerance;
+  double m_ParametersTolerance;
+
+  MeasureType m_InitialValue;
+  MeasureType m_FinalValue;
+  std::string m_StopConditionDescription;
+
+private:
+  ICPPointSetToPointSetRegistrationMethod(const Self &) ITK_DELETE_FUNCTION;
+  void operator=(const Self &) ITK_DELETE_FUNCTION;
+};
+} // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkICPPointSetToPointSetRegistrationMethod.hxx"
+#endif
+
+#endif
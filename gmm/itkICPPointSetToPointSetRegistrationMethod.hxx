@@ -0,0 +1,483 @@
+#ifndef itkICPPointSetToPointSetRegistrationMethod_hxx
+#define itkICPPointSetToPointSetRegistrationMethod_hxx
+
+#include <algorithm>
+#include <itkVersor.h>
+#include <vnl/algo/vnl_svd.h>
+#include <vnl/vnl_det.h>
+
+#include "itkICPPointSetToPointSetRegistrationMethod.h"
+#include "itkTaskScheduler.h"
+
+namespace itk
+{
+/**
+ * Constructor
+ */
+template< typename TFixedPointSet, typename TMovingPointSet >
+ICPPointSetToPointSetRegistrationMethod< TFixedPointSet, TMovingPointSet >::ICPPointSetToPointSetRegistrationMethod()
+{
+  this->SetNumberOfRequiredOutputs(1);    // for the transform
+
+  m_FixedPointSet = ITK_NULLPTR;
+  m_MovingPointSet = ITK_NULLPTR;
+  m_Transform = ITK_NULLPTR;
+  m_Metric = MetricType::New();
+  m_DistanceField = ITK_NULLPTR;
+
+  m_NumberOfIterations = 100;
+  m_CurrentIteration = 0;
+  m_UsePointToPlane = false;
+  m_TrimmingRatio = 1;
+  m_ValueTolerance = 1.0e-06;
+  m_ParametersTolerance = 1.0e-06;
+
+  m_InitialValue = NumericTraits<MeasureType>::ZeroValue();
+  m_FinalValue = NumericTraits<MeasureType>::ZeroValue();
+
+  TransformOutputPointer transformDecorator = itkDynamicCastInDebugMode< TransformOutputType * >(this->MakeOutput(0).GetPointer() );
+  this->ProcessObject::SetNthOutput(0, transformDecorator.GetPointer());
+}
+
+/**
+ * Initialize by setting the interconnects between components.
+ */
+template< typename TFixedPointSet, typename TMovingPointSet >
+void
+ICPPointSetToPointSetRegistrationMethod< TFixedPointSet, TMovingPointSet >
+::Initialize() throw (ExceptionObject)
+{
+  if (!m_FixedPointSet) {
+    itkExceptionMacro(<< "FixedPointSet is not present");
+  }
+
+  if (!m_MovingPointSet) {
+    itkExceptionMacro(<< "MovingPointSet is not present");
+  }
+
+  if (!m_Transform) {
+    itkExceptionMacro(<< "Transform is not present");
+  }
+
+  // throws if the closed-form update is not supported for the transform
+  this->GetTransformKind();
+
+  if (!m_Metric) {
+    itkExceptionMacro(<< "Metric is not present");
+  }
+
+  // Connect the transform to the Decorator.
+  TransformOutputType *transformOutput = static_cast<TransformOutputType*>(this->ProcessObject::GetOutput(0));
+  transformOutput->Set(m_Transform.GetPointer());
+
+  m_Metric->SetFixedPointSet(m_FixedPointSet);
+  m_Metric->SetMovingPointSet(m_MovingPointSet);
+  m_Metric->SetTransform(m_Transform);
+  m_Metric->SetUsePointToPlane(m_UsePointToPlane);
+  if (m_DistanceField) {
+    m_Metric->SetDistanceField(m_DistanceField);
+    m_Metric->UseDistanceFieldOn();
+  }
+  m_Metric->Initialize();
+
+  m_TransformedPoints = MovingPointsContainerType::New();
+  m_TransformedPoints->resize(m_MovingPointSet->GetNumberOfPoints());
+
+  m_InitialTransformParameters = m_Transform->GetParameters();
+  m_CurrentIteration = 0;
+  m_StopConditionDescription = "Maximum number of iterations has been reached";
+}
+
+/**
+ *  Get Output
+ */
+template< typename TFixedPointSet, typename TMovingPointSet >
+const typename ICPPointSetToPointSetRegistrationMethod< TFixedPointSet, TMovingPointSet >::TransformOutputType *
+ICPPointSetToPointSetRegistrationMethod< TFixedPointSet, TMovingPointSet >
+::GetOutput() const
+{
+  return static_cast< const TransformOutputType * >( this->ProcessObject::GetOutput(0) );
+}
+
+template< typename TFixedPointSet, typename TMovingPointSet >
+DataObject::Pointer
+ICPPointSetToPointSetRegistrationMethod< TFixedPointSet, TMovingPointSet >
+::MakeOutput(DataObjectPointerArraySizeType output)
+{
+  switch ( output )
+    {
+    case 0:
+      return TransformOutputType::New().GetPointer();
+      break;
+    default:
+      itkExceptionMacro("MakeOutput request for an output number larger than the expected number of outputs");
+      return ITK_NULLPTR;
+    }
+}
+
+/**
+ *
+ */
+template< typename TFixedPointSet, typename TMovingPointSet >
+void
+ICPPointSetToPointSetRegistrationMethod< TFixedPointSet, TMovingPointSet >
+::GenerateData()
+{
+  this->Initialize();
+
+  MeasureType value = this->ComputeCorrespondences();
+  m_InitialValue = value;
+
+  while (m_CurrentIteration < m_NumberOfIterations) {
+    const ParametersType parameters = m_Transform->GetParameters();
+
+    if (m_UsePointToPlane) {
+      this->ComputeLinearizedTransform();
+    }
+    else {
+      this->ComputeTransform();
+    }
+    ++m_CurrentIteration;
+
+    const MeasureType previousValue = value;
+    value = this->ComputeCorrespondences();
+
+    // relative changes of the value and the transform parameters
+    const ParametersType & currentParameters = m_Transform->GetParameters();
+    double difference = 0;
+    double norm = 0;
+    for (size_t par = 0; par < parameters.size(); ++par) {
+      difference += (currentParameters[par] - parameters[par]) * (currentParameters[par] - parameters[par]);
+      norm += parameters[par] * parameters[par];
+    }
+
+    if (std::abs(previousValue - value) <= m_ValueTolerance * previousValue && std::sqrt(difference) <= m_ParametersTolerance * (1.0 + std::sqrt(norm))) {
+      m_StopConditionDescription = "Relative changes of the value and parameters are below tolerances";
+      break;
+    }
+  }
+
+  m_FinalValue = value;
+  m_FinalTransformParameters = m_Transform->GetParameters();
+}
+
+/**
+ * Find the closest points and reject the farthest pairs
+ */
+template< typename TFixedPointSet, typename TMovingPointSet >
+typename ICPPointSetToPointSetRegistrationMethod< TFixedPointSet, TMovingPointSet >::MeasureType
+ICPPointSetToPointSetRegistrationMethod< TFixedPointSet, TMovingPointSet >
+::ComputeCorrespondences()
+{
+  const int numberOfPoints = static_cast<int>(m_MovingPointSet->GetNumberOfPoints());
+
+  TaskScheduler::GetInstance().ParallelFor(0, numberOfPoints, 0, [this](const size_t & first, const size_t & last) {
+    for (size_t n = first; n < last; ++n) {
+      m_TransformedPoints->ElementAt(n) = m_Transform->TransformPoint(m_MovingPointSet->GetPoints()->ElementAt(n));
+    }
+  });
+
+  m_Metric->ComputeCorrespondences(m_TransformedPoints, m_Indices, m_Distances);
+
+  // keep the closest pairs
+  const size_t numberOfPairs = std::max(size_t(1), static_cast<size_t>(m_TrimmingRatio * numberOfPoints));
+
+  m_Pairs.resize(numberOfPoints);
+  for (size_t n = 0; n < m_Pairs.size(); ++n) {
+    m_Pairs[n] = n;
+  }
+
+  if (numberOfPairs < m_Pairs.size()) {
+    const std::vector<double> & distances = m_Distances;
+    std::nth_element(m_Pairs.begin(), m_Pairs.begin() + numberOfPairs, m_Pairs.end(),
+      [&distances](const size_t & a, const size_t & b) { return distances[a] < distances[b]; });
+    m_Pairs.resize(numberOfPairs);
+  }
+
+  double value = 0;
+  if (m_UsePointToPlane) {
+    for (size_t n = 0; n < m_Pairs.size(); ++n) {
+      const MovingPointType & point = m_TransformedPoints->ElementAt(m_Pairs[n]);
+      const FixedPointType & fixedPoint = m_FixedPointSet->GetPoint(m_Indices[m_Pairs[n]]);
+      const typename MetricType::NormalType & normal = m_Metric->GetFixedNormals()->ElementAt(m_Indices[m_Pairs[n]]);
+
+      double distance = 0;
+      for (unsigned int dim = 0; dim < FixedPointSetType::PointDimension; ++dim) {
+        distance += (point[dim] - fixedPoint[dim]) * normal[dim];
+      }
+      value += distance * distance;
+    }
+  }
+  else {
+    for (size_t n = 0; n < m_Pairs.size(); ++n) {
+      value += m_Distances[m_Pairs[n]];
+    }
+  }
+
+  return std::sqrt(value / m_Pairs.size());
+}
+
+/**
+ * Closed-form solution for the current pairs
+ */
+template< typename TFixedPointSet, typename TMovingPointSet >
+void
+ICPPointSetToPointSetRegistrationMethod< TFixedPointSet, TMovingPointSet >
+::ComputeTransform()
+{
+  const unsigned int Dimension = FixedPointSetType::PointDimension;
+  const size_t numberOfPairs = m_Pairs.size();
+
+  // compute centroids
+  vnl_vector<double> movingCenter(Dimension, 0.0);
+  vnl_vector<double> fixedCenter(Dimension, 0.0);
+
+  for (size_t n = 0; n < numberOfPairs; ++n) {
+    const MovingPointType & movingPoint = m_MovingPointSet->GetPoints()->ElementAt(m_Pairs[n]);
+    const FixedPointType & fixedPoint = m_FixedPointSet->GetPoint(m_Indices[m_Pairs[n]]);
+
+    for (unsigned int i = 0; i < Dimension; ++i) {
+      movingCenter[i] += movingPoint[i];
+      fixedCenter[i] += fixedPoint[i];
+    }
+  }
+
+  movingCenter /= numberOfPairs;
+  fixedCenter /= numberOfPairs;
+
+  // compute cross-covariance matrix and variance of the moving points
+  vnl_matrix<double> covariance(Dimension, Dimension, 0.0);
+  double variance = 0;
+
+  for (size_t n = 0; n < numberOfPairs; ++n) {
+    const MovingPointType & movingPoint = m_MovingPointSet->GetPoints()->ElementAt(m_Pairs[n]);
+    const FixedPointType & fixedPoint = m_FixedPointSet->GetPoint(m_Indices[m_Pairs[n]]);
+
+    for (unsigned int i = 0; i < Dimension; ++i) {
+      const double fixedValue = fixedPoint[i] - fixedCenter[i];
+      const double movingValue = movingPoint[i] - movingCenter[i];
+      variance += movingValue * movingValue;
+
+      for (unsigned int j = 0; j < Dimension; ++j) {
+        covariance(i, j) += fixedValue * (movingPoint[j] - movingCenter[j]);
+      }
+    }
+  }
+
+  covariance /= numberOfPairs;
+  variance /= numberOfPairs;
+
+  const TransformKindType kind = this->GetTransformKind();
+
+  if (kind == TranslationKind) {
+    vnl_matrix<double> identity(Dimension, Dimension);
+    identity.set_identity();
+    this->UpdateTransform(identity, fixedCenter - movingCenter);
+    return;
+  }
+
+  // rotation from SVD of the cross-covariance matrix, the reflection is excluded
+  vnl_svd<double> svd(covariance);
+  vnl_matrix<double> correction(Dimension, Dimension);
+  correction.set_identity();
+
+  if (vnl_det(svd.U()) * vnl_det(svd.V()) < 0) {
+    correction(Dimension - 1, Dimension - 1) = -1;
+  }
+
+  const vnl_matrix<double> rotation = svd.U() * correction * svd.V().transpose();
+
+  double scale = 1;
+  if (kind == SimilarityKind) {
+    double trace = 0;
+    for (unsigned int i = 0; i < Dimension; ++i) {
+      trace += svd.W(i) * correction(i, i);
+    }
+    scale = trace / variance;
+  }
+
+  this->UpdateTransform(scale * rotation, fixedCenter - scale * rotation * movingCenter);
+}
+
+/**
+ * Gauss-Newton step for the point-to-plane distances
+ */
+template< typename TFixedPointSet, typename TMovingPointSet >
+void
+ICPPointSetToPointSetRegistrationMethod< TFixedPointSet, TMovingPointSet >
+::ComputeLinearizedTransform()
+{
+  const unsigned int Dimension = FixedPointSetType::PointDimension;
+  const size_t numberOfPairs = m_Pairs.size();
+  const typename MetricType::NormalsContainerType * normals = m_Metric->GetFixedNormals();
+
+  // the unknowns are translation, rotation vector and logarithm of the scale
+  const TransformKindType kind = this->GetTransformKind();
+  unsigned int numberOfUnknowns = Dimension;
+  if (kind == RigidKind) {
+    numberOfUnknowns = 2 * Dimension;
+  }
+  else if (kind == SimilarityKind) {
+    numberOfUnknowns = 2 * Dimension + 1;
+  }
+
+  // linearize about the centroid of the fixed points to improve conditioning
+  vnl_vector<double> center(Dimension, 0.0);
+  for (size_t n = 0; n < numberOfPairs; ++n) {
+    const FixedPointType & fixedPoint = m_FixedPointSet->GetPoint(m_Indices[m_Pairs[n]]);
+    for (unsigned int i = 0; i < Dimension; ++i) {
+      center[i] += fixedPoint[i];
+    }
+  }
+  center /= numberOfPairs;
+
+  // normal equations of the linearized residuals
+  vnl_matrix<double> matrix(numberOfUnknowns, numberOfUnknowns, 0.0);
+  vnl_vector<double> vector(numberOfUnknowns, 0.0);
+  vnl_vector<double> jacobian(numberOfUnknowns);
+
+  for (size_t n = 0; n < numberOfPairs; ++n) {
+    const MovingPointType & movingPoint = m_TransformedPoints->ElementAt(m_Pairs[n]);
+    const FixedPointType & fixedPoint = m_FixedPointSet->GetPoint(m_Indices[m_Pairs[n]]);
+    const typename MetricType::NormalType & normal = normals->ElementAt(m_Indices[m_Pairs[n]]);
+
+    double point[Dimension];
+    double residual = 0;
+
+    for (unsigned int i = 0; i < Dimension; ++i) {
+      point[i] = movingPoint[i] - center[i];
+      residual += (movingPoint[i] - fixedPoint[i]) * normal[i];
+      jacobian[i] = normal[i];
+    }
+
+    if (kind != TranslationKind) {
+      jacobian[3] = point[1] * normal[2] - point[2] * normal[1];
+      jacobian[4] = point[2] * normal[0] - point[0] * normal[2];
+      jacobian[5] = point[0] * normal[1] - point[1] * normal[0];
+    }
+
+    if (kind == SimilarityKind) {
+      jacobian[6] = point[0] * normal[0] + point[1] * normal[1] + point[2] * normal[2];
+    }
+
+    matrix += outer_product(jacobian, jacobian);
+    vector -= residual * jacobian;
+  }
+
+  // the pseudo-inverse keeps the transform unchanged along the degenerate directions, e.g. sliding along a plane
+  vnl_svd<double> svd(matrix);
+  svd.zero_out_relative(1.0e-12);
+  const vnl_vector<double> solution = svd.solve(vector);
+
+  vnl_matrix<double> increment(Dimension, Dimension);
+  increment.set_identity();
+
+  if (numberOfUnknowns > Dimension) {
+    typename Versor<double>::VectorType axis;
+    for (unsigned int i = 0; i < Dimension; ++i) {
+      axis[i] = solution[Dimension + i];
+    }
+
+    const double angle = axis.GetNorm();
+    if (angle > 0) {
+      Versor<double> versor;
+      versor.Set(axis / angle, angle);
+      increment = vnl_matrix<double>(versor.GetMatrix().GetVnlMatrix().data_block(), Dimension, Dimension);
+    }
+  }
+
+  if (numberOfUnknowns > 2 * Dimension) {
+    increment *= std::exp(solution[2 * Dimension]);
+  }
+
+  vnl_vector<double> translation(Dimension);
+  for (unsigned int i = 0; i < Dimension; ++i) {
+    translation[i] = solution[i];
+  }
+
+  // compose the increment x -> A (x - c) + c + t with the current transform
+  vnl_matrix<double> currentMatrix(Dimension, Dimension);
+  currentMatrix.set_identity();
+  vnl_vector<double> currentOffset(Dimension);
+
+  if (kind == TranslationKind) {
+    for (unsigned int i = 0; i < Dimension; ++i) {
+      currentOffset[i] = m_Transform->GetParameters()[i];
+    }
+  }
+  else {
+    // the similarity transform is derived from the versor rigid transform
+    const VersorRigid3DTransformType *transform = dynamic_cast<const VersorRigid3DTransformType*>(m_Transform.GetPointer());
+    currentMatrix = vnl_matrix<double>(transform->GetMatrix().GetVnlMatrix().data_block(), Dimension, Dimension);
+    for (unsigned int i = 0; i < Dimension; ++i) {
+      currentOffset[i] = transform->GetOffset()[i];
+    }
+  }
+
+  this->UpdateTransform(increment * currentMatrix, increment * (currentOffset - center) + center + translation);
+}
+
+/**
+ * Set the matrix and the offset of the supported transforms
+ */
+template< typename TFixedPointSet, typename TMovingPointSet >
+void
+ICPPointSetToPointSetRegistrationMethod< TFixedPointSet, TMovingPointSet >
+::UpdateTransform(const vnl_matrix<double> & matrix, const vnl_vector<double> & offset)
+{
+  const unsigned int Dimension = FixedPointSetType::PointDimension;
+
+  if (this->GetTransformKind() == TranslationKind) {
+    typename TranslationTransformType::OutputVectorType translation;
+    for (unsigned int i = 0; i < Dimension; ++i) {
+      translation[i] = offset[i];
+    }
+
+    dynamic_cast<TranslationTransformType*>(m_Transform.GetPointer())->SetOffset(translation);
+    return;
+  }
+
+  typename VersorRigid3DTransformType::MatrixType transformMatrix;
+  typename VersorRigid3DTransformType::OutputVectorType transformOffset;
+
+  for (unsigned int i = 0; i < Dimension; ++i) {
+    transformOffset[i] = offset[i];
+    for (unsigned int j = 0; j < Dimension; ++j) {
+      transformMatrix(i, j) = matrix(i, j);
+    }
+  }
+
+  // the similarity transform is derived from the versor rigid transform
+  VersorRigid3DTransformType *transform = dynamic_cast<VersorRigid3DTransformType*>(m_Transform.GetPointer());
+  transform->SetMatrix(transformMatrix);
+  transform->SetOffset(transformOffset);
+}
+
+/**
+ * Get the kind of the transform with the closed-form update
+ */
+template< typename TFixedPointSet, typename TMovingPointSet >
+typename ICPPointSetToPointSetRegistrationMethod< TFixedPointSet, TMovingPointSet >::TransformKindType
+ICPPointSetToPointSetRegistrationMethod< TFixedPointSet, TMovingPointSet >
+::GetTransformKind() const
+{
+  const TransformType * transform = m_Transform.GetPointer();
+  const unsigned int numberOfParameters = transform->GetNumberOfParameters();
+
+  if (dynamic_cast<const TranslationTransformType *>(transform) && numberOfParameters == 3) {
+    return TranslationKind;
+  }
+
+  // the similarity transform is derived from the versor rigid transform, so it is checked first
+  if (dynamic_cast<const Similarity3DTransformType *>(transform) && numberOfParameters == 7) {
+    return SimilarityKind;
+  }
+
+  if (dynamic_cast<const VersorRigid3DTransformType *>(transform) && numberOfParameters == 6) {
+    return RigidKind;
+  }
+
+  itkExceptionMacro(<< "Closed-form update is not supported for the transform " << transform->GetNameOfClass());
+}
+} // end namespace itk
+#endif
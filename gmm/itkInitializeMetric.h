@@ -38,21 +38,54 @@ namespace itk
     // Get metric
     itkGetObjectMacro(Metric, MetricType);
 
+    // Set/Get single precision evaluation of kernels
+    itkSetMacro(UseSinglePrecision, bool);
+    itkGetMacro(UseSinglePrecision, bool);
+    itkBooleanMacro(UseSinglePrecision);
+
     void Initialize()
+    {
+      if (m_UseSinglePrecision) {
+        this->template CreateMetric<float>();
+      }
+      else {
+        this->template CreateMetric<double>();
+      }
+
+      if (m_Metric == nullptr) {
+        itkExceptionMacro(<< "metric has not been initialized.");
+      }
+    }
+
+    void PrintReport() const
+    {
+      std::cout << "class name " << this->GetNameOfClass() << std::endl;
+      std::cout << "metric     " << m_Metric->GetNameOfClass() << std::endl;
+      std::cout << "precision  " << (m_UseSinglePrecision ? "single" : "double") << std::endl;
+      std::cout << std::endl;
+    }
+
+  protected:
+    Metric m_TypeOfMetric;
+    typename MetricType::Pointer m_Metric;
+    bool m_UseSinglePrecision = false;
+
+    template <typename TInternalComputationValueType>
+    void CreateMetric()
     {
       switch (m_TypeOfMetric) {
       case Metric::GMML2Rigid: {
-        typedef itk::GMML2RigidPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet> GMML2RigidMetricType;
+        typedef itk::GMML2RigidPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType> GMML2RigidMetricType;
         m_Metric = GMML2RigidMetricType::New();
         break;
       }
       case Metric::GMML2:{
-        typedef itk::GMML2PointSetToPointSetMetric<TFixedPointSet, TMovingPointSet> GMML2MetricType;
+        typedef itk::GMML2PointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType> GMML2MetricType;
         m_Metric = GMML2MetricType::New();
         break;
       }
       case Metric::GMMKC: {
-        typedef itk::GMMKCPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet> GMMKCMetricType;
+        typedef itk::GMMKCPointSetToPointSetMetric<TFixedPointSet, TMovingPointSet, TInternalComputationValueType> GMMKCMetricType;
         m_Metric = GMMKCMetricType::New();
         break;
       }
@@ -61,23 +94,8 @@ namespace itk
         return;
       }
       }
-
-      if (m_Metric == nullptr) {
-        itkExceptionMacro(<< "metric has not been initialized.");
-      }
-    }
-
-    void PrintReport() const
-    {
-      std::cout << "class name " << this->GetNameOfClass() << std::endl;
-      std::cout << "metric     " << m_Metric->GetNameOfClass() << std::endl;
-      std::cout << std::endl;
     }
 
-  protected:
-    Metric m_TypeOfMetric;
-    typename MetricType::Pointer m_Metric;
-
     InitializeMetric() 
     {
       m_Metric = nullptr;
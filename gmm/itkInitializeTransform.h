@@ -5,6 +5,7 @@
 #include <itkVersorRigid3DTransform.h>
 #include <itkSimilarity3DTransform.h>
 #include <itkScaleSkewVersor3DTransform.h>
+#include "itkControlPointsKernelTransform.h"
 
 namespace itk
 {
@@ -27,7 +28,9 @@ namespace itk
       Translation,
       Versor3D,
       Similarity,
-      ScaleSkewVersor3D
+      ScaleSkewVersor3D,
+      ThinPlateSpline,
+      GaussianRBF
     };
 
     /** typedefs */
@@ -41,6 +44,8 @@ namespace itk
     typedef itk::Array<double> ParametersType;
     typedef itk::Array<unsigned int> ModeBoundsType;
     typedef itk::Array<double> BoundsType;
+    typedef itk::ControlPointsKernelTransform<TParametersValueType, PointDimension> KernelTransformType;
+    typedef typename KernelTransformType::PointsType ControlPointsType;
 
     // Get transform
     itkGetObjectMacro(Transform, TransformType);
@@ -62,6 +67,20 @@ namespace itk
     itkSetMacro(SkewScale, double);
     itkGetMacro(SkewScale, double);
 
+    itkSetMacro(KernelScale, double);
+    itkGetMacro(KernelScale, double);
+
+    // Set/Get the control points, the width of the Gaussian radial basis functions and the weight of the
+    // bending energy of the deformable transforms
+    void SetControlPoints(const ControlPointsType & points) { m_ControlPoints = points; }
+    const ControlPointsType & GetControlPoints() const { return m_ControlPoints; }
+
+    itkSetMacro(GaussianRBFScale, double);
+    itkGetMacro(GaussianRBFScale, double);
+
+    itkSetMacro(Regularization, double);
+    itkGetMacro(Regularization, double);
+
     // Get scales and bounds
     itkGetMacro(Scales, ParametersType);
     itkGetMacro(ModeBounds, ModeBoundsType);
@@ -212,6 +231,43 @@ namespace itk
 
         break;
       }
+
+      case Transform::ThinPlateSpline:
+      case Transform::GaussianRBF: {
+        // ControlPointsKernelTransform, the affine part is initialized by the translation
+        typename KernelTransformType::Pointer transform = KernelTransformType::New();
+        transform->SetKernel(m_TypeOfTransform == Transform::ThinPlateSpline ? KernelTransformType::Kernel::ThinPlateSpline : KernelTransformType::Kernel::GaussianRBF);
+        transform->SetGaussianRBFScale(m_GaussianRBFScale);
+        transform->SetRegularization(m_Regularization);
+        transform->SetControlPoints(m_ControlPoints);
+        transform->SetTranslation(m_Translation);
+
+        m_Transform = transform;
+        this->Allocate();
+
+        // define scales, the rows of the coefficients are the translation, the linear part and the kernels
+        m_NumberOfTranslationComponents = PointDimension;
+        m_NumberOfScalingComponents = PointDimension * PointDimension;
+
+        size_t count = 0;
+
+        for (size_t i = 0; i < m_NumberOfTranslationComponents; ++i, ++count) {
+          m_Scales[count] = m_TranslationScale;
+          m_ModeBounds[count] = 0;
+        }
+
+        for (size_t i = 0; i < m_NumberOfScalingComponents; ++i, ++count) {
+          m_Scales[count] = m_ScalingScale;
+          m_ModeBounds[count] = 0;
+        }
+
+        for (; count < m_NumberOfParameters; ++count) {
+          m_Scales[count] = m_KernelScale;
+          m_ModeBounds[count] = 0;
+        }
+
+        break;
+      }
       }
     }
 
@@ -254,6 +310,11 @@ namespace itk
     double m_RotationScale = 0.1;
     double m_ScalingScale = 0.1;
     double m_SkewScale = 0.1;
+    double m_KernelScale = 1;
+
+    ControlPointsType m_ControlPoints;
+    double m_GaussianRBFScale = 1;
+    double m_Regularization = 0;
 
     size_t m_NumberOfComponents = 0;
     size_t m_NumberOfTranslationComponents = 0;
@@ -0,0 +1,176 @@
+#ifndef itkMortonOrderPointSet_h
+#define itkMortonOrderPointSet_h
+
+#include <itkPointSet.h>
+#include <itkNumericTraits.h>
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace itk
+{
+/** \class MortonOrderPointSet
+ * \brief Reorders the points along the Morton (Z-order) curve.
+ *
+ * The coordinates are quantized in the bounding box of the points and the bits of the quantized
+ * coordinates are interleaved into the code, the points are sorted by the codes. The consecutive points
+ * of the output are close in space, so the loops over the points query the close regions of the trees
+ * one after another. The output point n is the input point with the identifier GetPermutation()[n],
+ * the point data are reordered together with the points.
+ */
+template< typename TPointSet >
+class MortonOrderPointSet : public Object
+{
+public:
+  /** Standard class typedefs. */
+  typedef MortonOrderPointSet< TPointSet >  Self;
+  typedef Object                            Superclass;
+  typedef SmartPointer< Self >              Pointer;
+  typedef SmartPointer< const Self >        ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(MortonOrderPointSet, Object);
+
+  /** Extract the dimension of the point set. */
+  itkStaticConstMacro(Dimension, unsigned int, TPointSet::PointDimension);
+
+  /** Standard types and pointers within this class. */
+  typedef TPointSet PointSetType;
+  typedef typename PointSetType::Pointer                        PointSetPointer;
+  typedef typename PointSetType::ConstPointer                   PointSetConstPointer;
+  typedef typename PointSetType::PointType                      PointType;
+  typedef typename PointSetType::PointIdentifier                PointIdentifier;
+  typedef typename PointSetType::PointsContainer                PointsContainer;
+  typedef typename PointSetType::PointDataContainer             PointDataContainer;
+  typedef typename PointSetType::PointsContainerConstIterator   IteratorType;
+  typedef std::vector<PointIdentifier>                          PermutationType;
+
+  /** Set the input point set. */
+  virtual void SetPointSet(const PointSetType *points)
+  {
+    if ( m_PointSet != points )
+    {
+      m_PointSet = points;
+      this->Modified();
+      m_Valid = false;
+    }
+  }
+
+  /** Get output point set.*/
+  PointSetPointer GetOutput() const
+  {
+    if (!m_Valid) {
+      itkExceptionMacro(<< "GetOutput() invoked, but the order has not been computed. Call Compute() first.");
+    }
+    return m_OutputPointSet;
+  }
+
+  /** Get the identifiers of the input points in the order of the output points.*/
+  const PermutationType & GetPermutation() const
+  {
+    if (!m_Valid) {
+      itkExceptionMacro(<< "GetPermutation() invoked, but the order has not been computed. Call Compute() first.");
+    }
+    return m_Permutation;
+  }
+
+  void Compute()
+  {
+    const size_t numberOfPoints = m_PointSet->GetNumberOfPoints();
+
+    // the bounding box of the points
+    PointType lower;
+    PointType upper;
+    lower.Fill(NumericTraits<typename PointType::ValueType>::max());
+    upper.Fill(NumericTraits<typename PointType::ValueType>::NonpositiveMin());
+
+    for (IteratorType it = m_PointSet->GetPoints()->Begin(); it != m_PointSet->GetPoints()->End(); ++it) {
+      for (unsigned int dim = 0; dim < Dimension; ++dim) {
+        lower[dim] = std::min(lower[dim], it.Value()[dim]);
+        upper[dim] = std::max(upper[dim], it.Value()[dim]);
+      }
+    }
+
+    // the codes of the quantized coordinates, the ties are ordered by the identifiers
+    const unsigned int bits = 63 / Dimension;
+    const double cells = static_cast<double>((uint64_t(1) << bits) - 1);
+
+    std::vector< std::pair<uint64_t, PointIdentifier> > codes;
+    codes.reserve(numberOfPoints);
+
+    for (IteratorType it = m_PointSet->GetPoints()->Begin(); it != m_PointSet->GetPoints()->End(); ++it) {
+      uint64_t cell[Dimension];
+      for (unsigned int dim = 0; dim < Dimension; ++dim) {
+        const double extent = upper[dim] - lower[dim];
+        cell[dim] = extent > 0 ? static_cast<uint64_t>((it.Value()[dim] - lower[dim]) / extent * cells) : 0;
+      }
+
+      uint64_t code = 0;
+      for (unsigned int bit = 0; bit < bits; ++bit) {
+        for (unsigned int dim = 0; dim < Dimension; ++dim) {
+          code |= ((cell[dim] >> bit) & 1) << (bit * Dimension + dim);
+        }
+      }
+
+      codes.push_back(std::make_pair(code, it.Index()));
+    }
+
+    std::sort(codes.begin(), codes.end());
+
+    // reorder the points and the point data
+    typename PointsContainer::Pointer points = PointsContainer::New();
+    points->resize(numberOfPoints);
+    m_Permutation.resize(numberOfPoints);
+
+    const PointDataContainer * data = m_PointSet->GetPointData();
+    typename PointDataContainer::Pointer outputData;
+    if (data && data->Size() == numberOfPoints) {
+      outputData = PointDataContainer::New();
+      outputData->resize(numberOfPoints);
+    }
+
+    for (size_t n = 0; n < numberOfPoints; ++n) {
+      m_Permutation[n] = codes[n].second;
+      points->SetElement(n, m_PointSet->GetPoint(codes[n].second));
+
+      if (outputData) {
+        outputData->SetElement(n, data->ElementAt(codes[n].second));
+      }
+    }
+
+    m_OutputPointSet = PointSetType::New();
+    m_OutputPointSet->SetPoints(points);
+    if (outputData) {
+      m_OutputPointSet->SetPointData(outputData);
+    }
+
+    m_Valid = true;
+  }
+
+protected:
+  MortonOrderPointSet() {}
+  virtual ~MortonOrderPointSet() {};
+
+  virtual void PrintSelf(std::ostream & os, itk::Indent indent) const ITK_OVERRIDE
+  {
+    Superclass::PrintSelf(os, indent);
+    os << indent << "PointSet: " << m_PointSet.GetPointer() << std::endl;
+    os << indent << "Output PointSet: " << m_OutputPointSet.GetPointer() << std::endl;
+  }
+
+  PointSetConstPointer m_PointSet;
+  PointSetPointer m_OutputPointSet;
+  PermutationType m_Permutation;
+  bool m_Valid = false;
+
+private:
+  MortonOrderPointSet(const Self &) ITK_DELETE_FUNCTION;
+  void operator=(const Self &) ITK_DELETE_FUNCTION;
+};
+}
+
+#endif
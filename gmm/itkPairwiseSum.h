@@ -0,0 +1,85 @@
+#ifndef itkPairwiseSum_h
+#define itkPairwiseSum_h
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace itk
+{
+/** \class PairwiseSum
+ * \brief Sums the sequence of the arrays of the fixed length by the pairwise summation.
+ *
+ * The terms are added in the order of the sequence, the partial sums of 2^k consecutive terms are kept on
+ * the stack and the sums of the same size are merged as in the binary counter. The order of the floating
+ * point operations depends only on the number of the terms, so the sum is reproducible bit for bit if the
+ * terms are, e.g. when the terms are the partial sums of the fixed blocks of points computed by any number
+ * of threads. The rounding error grows as the logarithm of the number of the terms.
+ */
+class PairwiseSum
+{
+public:
+  /** Length of the summed arrays. */
+  explicit PairwiseSum(const size_t & length = 1) : m_Length(length) {}
+
+  /** Remove the terms, the length is kept. */
+  void Clear()
+  {
+    m_Stack.clear();
+  }
+
+  /** Add the next term of the sequence. */
+  void Add(const double * values)
+  {
+    m_Stack.push_back(std::make_pair(size_t(1), std::vector<double>(values, values + m_Length)));
+
+    while (m_Stack.size() > 1 && m_Stack[m_Stack.size() - 2].first == m_Stack.back().first) {
+      std::pair< size_t, std::vector<double> > & lower = m_Stack[m_Stack.size() - 2];
+
+      for (size_t n = 0; n < m_Length; ++n) {
+        lower.second[n] += m_Stack.back().second[n];
+      }
+
+      lower.first *= 2;
+      m_Stack.pop_back();
+    }
+  }
+
+  /** Get the sum of the terms, the partial sums are added from the smallest one. */
+  void GetSum(double * sum) const
+  {
+    std::fill(sum, sum + m_Length, 0.0);
+
+    for (size_t k = m_Stack.size(); k > 0; --k) {
+      for (size_t n = 0; n < m_Length; ++n) {
+        sum[n] += m_Stack[k - 1].second[n];
+      }
+    }
+  }
+
+  /** Pairwise sum of the values, the values are split into the halves down to the blocks of the fixed size. */
+  template <typename TValue>
+  static double Sum(const TValue * values, const size_t & count)
+  {
+    const size_t blockSize = 64;
+
+    if (count <= blockSize) {
+      double sum = 0;
+      for (size_t n = 0; n < count; ++n) {
+        sum += values[n];
+      }
+      return sum;
+    }
+
+    const size_t half = count / 2;
+    return Sum(values, half) + Sum(values + half, count - half);
+  }
+
+private:
+  size_t m_Length;
+  std::vector< std::pair< size_t, std::vector<double> > > m_Stack;
+};
+}
+
+#endif
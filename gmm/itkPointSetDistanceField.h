@@ -0,0 +1,297 @@
+#ifndef itkPointSetDistanceField_h
+#define itkPointSetDistanceField_h
+
+#include <itkPointSet.h>
+#include <itkPointsLocator.h>
+#include <itkFixedArray.h>
+#include "itkTaskScheduler.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace itk
+{
+/** \class PointSetDistanceField
+ * \brief Squared distance to the closest point of a point set sampled on a regular grid.
+ *
+ * The grid covers the bounding box of the points extended by the band width. Each node stores the
+ * squared distance to the closest point and the vector from the closest point to the node, so the
+ * squared distance and its gradient at any point inside the grid are evaluated by trilinear
+ * interpolation without search. The nodes also store the identifiers of their closest points, which
+ * approximate the closest points of the other points of the grid. The field is computed once in parallel
+ * and can be shared by the metrics evaluated against the same point set.
+ */
+template< typename TPointSet >
+class PointSetDistanceField : public Object
+{
+public:
+  /** Standard class typedefs. */
+  typedef PointSetDistanceField< TPointSet >           Self;
+  typedef Object                                       Superclass;
+  typedef SmartPointer< Self >                         Pointer;
+  typedef SmartPointer< const Self >                   ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(PointSetDistanceField, Object);
+
+  /** Extract the dimension of the point set. */
+  itkStaticConstMacro(Dimension, unsigned int, TPointSet::PointDimension);
+
+  /** Standard types and pointers within this class. */
+  typedef TPointSet PointSetType;
+  typedef typename PointSetType::ConstPointer                   PointSetConstPointer;
+  typedef typename PointSetType::PointType                      PointType;
+  typedef typename PointSetType::PointIdentifier                PointIdentifier;
+  typedef typename PointSetType::PointsContainer                PointsContainer;
+  typedef itk::PointsLocator<PointsContainer>                   PointsLocatorType;
+  typedef FixedArray<double, Dimension>                         OriginType;
+  typedef FixedArray<size_t, Dimension>                         SizeType;
+
+  /** Get/Set the spacing of the grid. If it is not positive, the diagonal of the bounding box over 128 is used. */
+  itkSetMacro(Spacing, double);
+  itkGetConstMacro(Spacing, double);
+
+  /** Get/Set the width of the band around the bounding box of the points covered by the grid. If it is
+   * negative, the tenth of the diagonal of the bounding box is used. */
+  itkSetMacro(BandWidth, double);
+  itkGetConstMacro(BandWidth, double);
+
+  /** Get/Set the maximal number of nodes of the grid. */
+  itkSetMacro(MaximalNumberOfNodes, size_t);
+  itkGetConstMacro(MaximalNumberOfNodes, size_t);
+
+  /** Get the geometry of the grid. */
+  itkGetConstReferenceMacro(Origin, OriginType);
+  itkGetConstReferenceMacro(Size, SizeType);
+
+  /** Set the input point set. */
+  virtual void SetPointSet(const PointSetType *points)
+  {
+    if ( m_PointSet != points )
+    {
+      m_PointSet = points;
+      this->Modified();
+      m_Valid = false;
+    }
+  }
+
+  /** Get the input point set. */
+  const PointSetType * GetPointSet() const
+  {
+    return m_PointSet.GetPointer();
+  }
+
+  /** Compute the field at the nodes of the grid in parallel. */
+  void Compute()
+  {
+    if (!m_PointSet || m_PointSet->GetNumberOfPoints() == 0) {
+      itkExceptionMacro(<< "PointSet is not present or empty");
+    }
+
+    const PointsContainer * points = m_PointSet->GetPoints();
+
+    // bounding box of the points
+    OriginType lower;
+    OriginType upper;
+    lower.Fill(NumericTraits<double>::max());
+    upper.Fill(NumericTraits<double>::NonpositiveMin());
+
+    for (typename PointsContainer::ConstIterator it = points->Begin(); it != points->End(); ++it) {
+      for (unsigned int dim = 0; dim < Dimension; ++dim) {
+        lower[dim] = std::min(lower[dim], static_cast<double>(it.Value()[dim]));
+        upper[dim] = std::max(upper[dim], static_cast<double>(it.Value()[dim]));
+      }
+    }
+
+    double diagonal = 0;
+    for (unsigned int dim = 0; dim < Dimension; ++dim) {
+      diagonal += (upper[dim] - lower[dim]) * (upper[dim] - lower[dim]);
+    }
+    diagonal = std::sqrt(diagonal);
+
+    m_CurrentSpacing = m_Spacing > 0 ? m_Spacing : diagonal / 128;
+    m_CurrentBandWidth = m_BandWidth >= 0 ? m_BandWidth : 0.1 * diagonal;
+
+    if (!(m_CurrentSpacing > 0)) {
+      itkExceptionMacro(<< "The spacing of the grid is not positive");
+    }
+
+    // geometry of the grid
+    size_t numberOfNodes = 1;
+    for (unsigned int dim = 0; dim < Dimension; ++dim) {
+      m_Origin[dim] = lower[dim] - m_CurrentBandWidth;
+      m_Size[dim] = static_cast<size_t>(std::ceil((upper[dim] - lower[dim] + 2 * m_CurrentBandWidth) / m_CurrentSpacing)) + 1;
+      m_Size[dim] = std::max(m_Size[dim], size_t(2));
+      numberOfNodes *= m_Size[dim];
+
+      if (numberOfNodes > m_MaximalNumberOfNodes) {
+        itkExceptionMacro(<< "The number of nodes of the grid exceeds " << m_MaximalNumberOfNodes << ", increase the spacing");
+      }
+    }
+
+    m_Values.resize(numberOfNodes);
+    m_Vectors.resize(numberOfNodes * Dimension);
+    m_Identifiers.resize(numberOfNodes);
+
+    typename PointsLocatorType::Pointer locator = PointsLocatorType::New();
+    locator->SetPoints(const_cast<PointsContainer*>(points));
+    locator->Initialize();
+
+    TaskScheduler::GetInstance().ParallelFor(0, numberOfNodes, 0, [&](const size_t & first, const size_t & last) {
+      for (size_t n = first; n < last; ++n) {
+        PointType node;
+        size_t index = n;
+
+        for (unsigned int dim = 0; dim < Dimension; ++dim) {
+          node[dim] = m_Origin[dim] + (index % m_Size[dim]) * m_CurrentSpacing;
+          index /= m_Size[dim];
+        }
+
+        m_Identifiers[n] = locator->FindClosestPoint(node);
+        const PointType & point = points->ElementAt(m_Identifiers[n]);
+        double value = 0;
+
+        for (unsigned int dim = 0; dim < Dimension; ++dim) {
+          const double difference = node[dim] - point[dim];
+          m_Vectors[n * Dimension + dim] = static_cast<float>(difference);
+          value += difference * difference;
+        }
+
+        m_Values[n] = static_cast<float>(value);
+      }
+    });
+
+    m_Valid = true;
+  }
+
+  /** Evaluate the squared distance and optionally its gradient by trilinear interpolation.
+   * Returns false if the point is outside the grid. */
+  template< typename TPoint >
+  bool Evaluate(const TPoint & point, double & value, double * gradient) const
+  {
+    if (!m_Valid) {
+      itkExceptionMacro(<< "Evaluate() invoked, but the field has not been computed. Call Compute() first.");
+    }
+
+    size_t base[Dimension];
+    double weight[Dimension];
+
+    for (unsigned int dim = 0; dim < Dimension; ++dim) {
+      const double coordinate = (point[dim] - m_Origin[dim]) / m_CurrentSpacing;
+
+      if (!(coordinate >= 0 && coordinate <= m_Size[dim] - 1)) {
+        return false;
+      }
+
+      base[dim] = std::min(static_cast<size_t>(coordinate), m_Size[dim] - 2);
+      weight[dim] = coordinate - base[dim];
+    }
+
+    value = 0;
+    double vector[Dimension];
+    for (unsigned int dim = 0; dim < Dimension; ++dim) {
+      vector[dim] = 0;
+    }
+
+    // loop over the corners of the cell
+    for (unsigned int corner = 0; corner < (1u << Dimension); ++corner) {
+      size_t offset = 0;
+      size_t stride = 1;
+      double cornerWeight = 1;
+
+      for (unsigned int dim = 0; dim < Dimension; ++dim) {
+        const unsigned int shift = (corner >> dim) & 1;
+        offset += (base[dim] + shift) * stride;
+        stride *= m_Size[dim];
+        cornerWeight *= shift ? weight[dim] : 1 - weight[dim];
+      }
+
+      value += cornerWeight * m_Values[offset];
+
+      for (unsigned int dim = 0; dim < Dimension; ++dim) {
+        vector[dim] += cornerWeight * m_Vectors[offset * Dimension + dim];
+      }
+    }
+
+    if (gradient) {
+      for (unsigned int dim = 0; dim < Dimension; ++dim) {
+        gradient[dim] = 2.0 * vector[dim];
+      }
+    }
+
+    return true;
+  }
+
+  /** Get the closest point of the node nearest to the point, the distance to it exceeds the distance to the
+   * closest point at most by the diagonal of the cell. Returns false if the point is outside the grid. */
+  template< typename TPoint >
+  bool FindClosestPoint(const TPoint & point, PointIdentifier & id) const
+  {
+    if (!m_Valid) {
+      itkExceptionMacro(<< "FindClosestPoint() invoked, but the field has not been computed. Call Compute() first.");
+    }
+
+    size_t offset = 0;
+    size_t stride = 1;
+
+    for (unsigned int dim = 0; dim < Dimension; ++dim) {
+      const double coordinate = (point[dim] - m_Origin[dim]) / m_CurrentSpacing;
+
+      if (!(coordinate >= 0 && coordinate <= m_Size[dim] - 1)) {
+        return false;
+      }
+
+      offset += std::min(static_cast<size_t>(coordinate + 0.5), m_Size[dim] - 1) * stride;
+      stride *= m_Size[dim];
+    }
+
+    id = m_Identifiers[offset];
+    return true;
+  }
+
+  void PrintReport(std::ostream& os) const
+  {
+    os << "distance field" << std::endl;
+    os << "spacing " << m_CurrentSpacing << std::endl;
+    os << "band    " << m_CurrentBandWidth << std::endl;
+    os << "origin  " << m_Origin << std::endl;
+    os << "size    " << m_Size << std::endl;
+    os << std::endl;
+  }
+
+protected:
+  PointSetDistanceField() {}
+  virtual ~PointSetDistanceField() {};
+
+  virtual void PrintSelf(std::ostream & os, itk::Indent indent) const ITK_OVERRIDE
+  {
+    Superclass::PrintSelf(os, indent);
+    os << indent << "PointSet: " << m_PointSet.GetPointer() << std::endl;
+    os << indent << "Spacing: " << m_Spacing << std::endl;
+    os << indent << "BandWidth: " << m_BandWidth << std::endl;
+  }
+
+  PointSetConstPointer m_PointSet;
+  double m_Spacing = 0;
+  double m_BandWidth = -1;
+  size_t m_MaximalNumberOfNodes = size_t(1) << 25;
+
+  double m_CurrentSpacing = 0;
+  double m_CurrentBandWidth = 0;
+  OriginType m_Origin;
+  SizeType m_Size;
+  std::vector<float> m_Values;
+  std::vector<float> m_Vectors;
+  std::vector<PointIdentifier> m_Identifiers;
+  bool m_Valid = false;
+
+private:
+  PointSetDistanceField(const Self &) ITK_DELETE_FUNCTION;
+  void operator=(const Self &) ITK_DELETE_FUNCTION;
+};
+}
+
+#endif
@@ -0,0 +1,248 @@
+#ifndef itkPointSetNormalsEstimator_h
+#define itkPointSetNormalsEstimator_h
+
+#include <itkPointSet.h>
+#include <itkPointsLocator.h>
+#include <itkVectorContainer.h>
+#include <itkVector.h>
+#include <vnl/algo/vnl_symmetric_eigensystem.h>
+#include "itkTaskScheduler.h"
+#include <algorithm>
+#include <vector>
+
+namespace itk
+{
+/** \class PointSetNormalsEstimator
+ * \brief Estimates unit normals at the points of a point set.
+ *
+ * Compute() takes the normal at each point as the eigenvector with the smallest eigenvalue
+ * of the covariance matrix of the k nearest neighbours (PCA). ComputeFromCells() averages
+ * the area weighted normals of the polygonal cells of a mesh sharing each point and falls
+ * back to PCA for the points without cells. The sign of the normals is arbitrary.
+ */
+template< typename TPointSet >
+class PointSetNormalsEstimator : public Object
+{
+public:
+  /** Standard class typedefs. */
+  typedef PointSetNormalsEstimator< TPointSet >        Self;
+  typedef Object                                       Superclass;
+  typedef SmartPointer< Self >                         Pointer;
+  typedef SmartPointer< const Self >                   ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(PointSetNormalsEstimator, Object);
+
+  /** Extract the dimension of the point set. */
+  itkStaticConstMacro(Dimension, unsigned int, TPointSet::PointDimension);
+
+  /** Standard types and pointers within this class. */
+  typedef TPointSet PointSetType;
+  typedef typename PointSetType::ConstPointer                   PointSetConstPointer;
+  typedef typename PointSetType::PointType                      PointType;
+  typedef typename PointSetType::PointIdentifier                PointIdentifier;
+  typedef typename PointSetType::PointsContainer                PointsContainer;
+  typedef itk::PointsLocator<PointsContainer>                   PointsLocatorType;
+
+  /** Type of the normals. */
+  typedef Vector<double, Dimension>                             NormalType;
+  typedef VectorContainer<PointIdentifier, NormalType>          NormalsContainerType;
+
+  /** Get/Set the number of nearest neighbours to estimate normals by PCA. */
+  itkSetMacro(NumberOfNeighbors, size_t);
+  itkGetMacro(NumberOfNeighbors, size_t);
+
+  /** Set the input point set. */
+  virtual void SetPointSet(const PointSetType *points)
+  {
+    if ( m_PointSet != points )
+    {
+      m_PointSet = points;
+      this->Modified();
+      m_Normals = ITK_NULLPTR;
+    }
+  }
+
+  /** Get normals.*/
+  const NormalsContainerType * GetNormals() const
+  {
+    if (!m_Normals) {
+      itkExceptionMacro(<< "GetNormals() invoked, but the normals have not been computed. Call Compute() first.");
+    }
+    return m_Normals.GetPointer();
+  }
+
+  /** Estimate normals at all points by PCA of the nearest neighbours. */
+  void Compute()
+  {
+    this->Allocate();
+
+    std::vector<PointIdentifier> ids(m_PointSet->GetNumberOfPoints());
+    for (size_t n = 0; n < ids.size(); ++n) {
+      ids[n] = n;
+    }
+
+    this->ComputeByPCA(ids);
+  }
+
+  /** Estimate normals from the cells of the mesh, which shares the points with the point set. */
+  template< typename TMesh >
+  void ComputeFromCells(const TMesh * mesh)
+  {
+    this->Allocate();
+
+    if (mesh->GetNumberOfPoints() != m_PointSet->GetNumberOfPoints()) {
+      itkExceptionMacro(<< "The mesh and the point set have different numbers of points");
+    }
+
+    if (Dimension != 3) {
+      itkExceptionMacro(<< "Normals of the cells are supported for 3D meshes only");
+    }
+
+    if (mesh->GetNumberOfCells() > 0) {
+      typedef typename TMesh::CellsContainer::ConstIterator CellIterator;
+
+      for (CellIterator it = mesh->GetCells()->Begin(); it != mesh->GetCells()->End(); ++it) {
+        const typename TMesh::CellType * cell = it.Value();
+        const size_t numberOfCellPoints = cell->GetNumberOfPoints();
+
+        if (numberOfCellPoints < 3) {
+          continue;
+        }
+
+        // area weighted normal of the polygon by the triangle fan
+        typename TMesh::CellType::PointIdConstIterator ids = cell->PointIdsBegin();
+        const PointType & origin = m_PointSet->GetPoint(ids[0]);
+        NormalType normal;
+        normal.Fill(0);
+
+        for (size_t k = 1; k + 1 < numberOfCellPoints; ++k) {
+          const PointType & point1 = m_PointSet->GetPoint(ids[k]);
+          const PointType & point2 = m_PointSet->GetPoint(ids[k + 1]);
+          double a[Dimension];
+          double b[Dimension];
+
+          for (unsigned int dim = 0; dim < Dimension; ++dim) {
+            a[dim] = point1[dim] - origin[dim];
+            b[dim] = point2[dim] - origin[dim];
+          }
+
+          normal[0] += a[1] * b[2] - a[2] * b[1];
+          normal[1] += a[2] * b[0] - a[0] * b[2];
+          normal[2] += a[0] * b[1] - a[1] * b[0];
+        }
+
+        for (size_t k = 0; k < numberOfCellPoints; ++k) {
+          m_Normals->ElementAt(ids[k]) += normal;
+        }
+      }
+    }
+
+    // normalize, the points without cells are processed by PCA
+    std::vector<PointIdentifier> ids;
+
+    for (size_t n = 0; n < m_Normals->Size(); ++n) {
+      NormalType & normal = m_Normals->ElementAt(n);
+      const double norm = normal.GetNorm();
+
+      if (norm > 0) {
+        normal /= norm;
+      }
+      else {
+        ids.push_back(n);
+      }
+    }
+
+    this->ComputeByPCA(ids);
+  }
+
+protected:
+  PointSetNormalsEstimator() {}
+  virtual ~PointSetNormalsEstimator() {};
+
+  virtual void PrintSelf(std::ostream & os, itk::Indent indent) const ITK_OVERRIDE
+  {
+    Superclass::PrintSelf(os, indent);
+    os << indent << "PointSet: " << m_PointSet.GetPointer() << std::endl;
+    os << indent << "NumberOfNeighbors: " << m_NumberOfNeighbors << std::endl;
+  }
+
+  void Allocate()
+  {
+    if (!m_PointSet) {
+      itkExceptionMacro(<< "PointSet is not present");
+    }
+
+    NormalType zero;
+    zero.Fill(0);
+
+    m_Normals = NormalsContainerType::New();
+    m_Normals->resize(m_PointSet->GetNumberOfPoints(), zero);
+  }
+
+  /** Estimate normals at the points with the identifiers in parallel. */
+  void ComputeByPCA(const std::vector<PointIdentifier> & ids)
+  {
+    if (ids.empty()) {
+      return;
+    }
+
+    const PointsContainer * points = m_PointSet->GetPoints();
+
+    typename PointsLocatorType::Pointer locator = PointsLocatorType::New();
+    locator->SetPoints(const_cast<PointsContainer*>(points));
+    locator->Initialize();
+
+    const size_t numberOfNeighbors = std::min(std::max(m_NumberOfNeighbors, size_t(Dimension)), static_cast<size_t>(points->Size()));
+
+    TaskScheduler::GetInstance().ParallelFor(0, ids.size(), 0, [&](const size_t & first, const size_t & last)
+    {
+      for (size_t n = first; n < last; ++n)
+      {
+        typename PointsLocatorType::NeighborsIdentifierType idx;
+        locator->FindClosestNPoints(points->ElementAt(ids[n]), numberOfNeighbors, idx);
+
+        // covariance matrix of the neighbours
+        vnl_vector<double> center(Dimension, 0.0);
+        for (size_t i = 0; i < idx.size(); ++i) {
+          for (unsigned int dim = 0; dim < Dimension; ++dim) {
+            center[dim] += points->ElementAt(idx[i])[dim];
+          }
+        }
+        center /= idx.size();
+
+        vnl_matrix<double> covariance(Dimension, Dimension, 0.0);
+        vnl_vector<double> difference(Dimension);
+        for (size_t i = 0; i < idx.size(); ++i) {
+          for (unsigned int dim = 0; dim < Dimension; ++dim) {
+            difference[dim] = points->ElementAt(idx[i])[dim] - center[dim];
+          }
+          covariance += outer_product(difference, difference);
+        }
+
+        // the eigenvalues are sorted in increasing order
+        vnl_symmetric_eigensystem<double> eigensystem(covariance);
+        const vnl_vector<double> eigenvector = eigensystem.get_eigenvector(0);
+
+        NormalType & normal = m_Normals->ElementAt(ids[n]);
+        for (unsigned int dim = 0; dim < Dimension; ++dim) {
+          normal[dim] = eigenvector[dim];
+        }
+      }
+    });
+  }
+
+  PointSetConstPointer m_PointSet;
+  typename NormalsContainerType::Pointer m_Normals;
+  size_t m_NumberOfNeighbors = 10;
+
+private:
+  PointSetNormalsEstimator(const Self &) ITK_DELETE_FUNCTION;
+  void operator=(const Self &) ITK_DELETE_FUNCTION;
+};
+}
+
+#endif
@@ -3,6 +3,12 @@
 
 #include <itkPointSet.h>
 #include <itkNumericTraits.h>
+#include "itkPointsKdTreeIndex.h"
+#include "itkPairwiseSum.h"
+#include "itkTaskScheduler.h"
+#include <itkArray.h>
+#include <algorithm>
+#include <vector>
 
 namespace itk
 {
@@ -34,6 +40,21 @@ public:
   typedef typename PointSetType::PointType                      PointType;
   typedef typename PointSetType::PointsContainer::ConstPointer  PointsContainerConstPointer;
   typedef typename PointSetType::PointsContainerConstIterator   IteratorType;
+  typedef typename PointSetType::PointsContainer                PointsContainer;
+  typedef itk::PointsKdTreeIndex<PointsContainer>               PointsIndexType;
+  typedef itk::Array<double>                                    ScalePyramidType;
+
+  /** Get/Set the number of nearest neighbours to estimate spacing statistics. */
+  itkSetMacro(NumberOfNeighbors, size_t);
+  itkGetMacro(NumberOfNeighbors, size_t);
+
+  /** Get/Set the level of quantile of the distance to the k-th neighbour. */
+  itkSetMacro(LevelOfQuantile, double);
+  itkGetMacro(LevelOfQuantile, double);
+
+  /** Get/Set the maximal ratio of scales at the neighbouring levels of the proposed pyramid. */
+  itkSetMacro(ScaleFactor, double);
+  itkGetMacro(ScaleFactor, double);
 
   /** Set the input image. */
   virtual void SetPointSet(const PointSetType *points)
@@ -64,6 +85,42 @@ public:
     return m_Center;
   }
 
+  /** Get spacing, i.e. the mean distance to the nearest neighbour.*/
+  ScalarType GetSpacing() const
+  {
+    if (!m_Valid) {
+      itkExceptionMacro(<< "GetSpacing() invoked, but the properties have not been computed. Call Compute() first.");
+    }
+    return m_Spacing;
+  }
+
+  /** Get quantile of the distance to the k-th nearest neighbour.*/
+  ScalarType GetNeighborhoodSpacing() const
+  {
+    if (!m_Valid) {
+      itkExceptionMacro(<< "GetNeighborhoodSpacing() invoked, but the properties have not been computed. Call Compute() first.");
+    }
+    return m_NeighborhoodSpacing;
+  }
+
+  /** Get the proposed scale pyramid, from the coarse scale (the half of the RMS radius) to the spacing.*/
+  ScalePyramidType GetScalePyramid() const
+  {
+    if (!m_Valid) {
+      itkExceptionMacro(<< "GetScalePyramid() invoked, but the properties have not been computed. Call Compute() first.");
+    }
+    return m_ScalePyramid;
+  }
+
+  /** Get the proposed truncation radius in units of the finest scale.*/
+  ScalarType GetRadius() const
+  {
+    if (!m_Valid) {
+      itkExceptionMacro(<< "GetRadius() invoked, but the properties have not been computed. Call Compute() first.");
+    }
+    return m_Radius;
+  }
+
   void Compute()
   {
     m_NumberOfPoints = m_PointSet->GetNumberOfPoints();
@@ -101,14 +158,46 @@ public:
     }
 
     m_Scale = sqrt(m_Scale / m_NumberOfPoints);
+
+    // compute spacing
+    this->ComputeSpacing();
+
+    // propose the scale pyramid with the minimal number of levels
+    const double coarseScale = 0.5 * m_Scale;
+    const double fineScale = std::min(m_Spacing, coarseScale);
+    size_t numberOfLevels = 1;
+
+    if (fineScale > 0 && coarseScale > fineScale) {
+      numberOfLevels += static_cast<size_t>(std::ceil(std::log(coarseScale / fineScale) / std::log(1.0 / m_ScaleFactor)));
+    }
+
+    m_ScalePyramid.set_size(numberOfLevels);
+
+    for (size_t level = 0; level < numberOfLevels; ++level) {
+      const double ratio = numberOfLevels > 1 ? (double)level / (numberOfLevels - 1) : 0;
+      m_ScalePyramid[level] = coarseScale * std::pow(fineScale / coarseScale, ratio);
+    }
+
+    // propose the truncation radius, the kernel weight at the cutoff is below 1e-03 and
+    // the k-th neighbours of most points are inside the cutoff at the finest scale
+    m_Radius = std::sqrt(std::log(1.0e+03));
+
+    if (fineScale > 0) {
+      m_Radius = std::max(m_Radius, m_NeighborhoodSpacing / fineScale);
+    }
+
     m_Valid = true;
   }
 
   void PrintReport(std::ostream& os)
   {
-    os << "points " << m_PointSet->GetNumberOfPoints() << std::endl;
-    os << "center " << m_Center << std::endl;
-    os << "scale  " << m_Scale << std::endl;
+    os << "points  " << m_PointSet->GetNumberOfPoints() << std::endl;
+    os << "center  " << m_Center << std::endl;
+    os << "scale   " << m_Scale << std::endl;
+    os << "spacing " << m_Spacing << std::endl;
+    os << "k-NN    " << m_NeighborhoodSpacing << ", k = " << m_NumberOfNeighbors << ", level = " << m_LevelOfQuantile << std::endl;
+    os << "pyramid " << m_ScalePyramid << std::endl;
+    os << "radius  " << m_Radius << std::endl;
     os << std::endl;
   }
 
@@ -122,12 +211,81 @@ protected:
     os << indent << "PointSet: " << m_PointSet.GetPointer() << std::endl;
   }
 
+  /** Compute statistics of the distances to the nearest neighbours. */
+  void ComputeSpacing()
+  {
+    m_Spacing = itk::NumericTraits< ScalarType >::ZeroValue();
+    m_NeighborhoodSpacing = itk::NumericTraits< ScalarType >::ZeroValue();
+
+    if (m_NumberOfPoints < 2) {
+      return;
+    }
+
+    PointsContainerConstPointer points = m_PointSet->GetPoints();
+
+    // the kd-tree is built in parallel, so it does not dominate the properties of the large point sets
+    typename PointsIndexType::Pointer tree = PointsIndexType::New();
+    tree->SetHashPoints(false);
+    tree->Build(points);
+
+    const size_t numberOfNeighbors = std::max(size_t(1), std::min(m_NumberOfNeighbors, m_NumberOfPoints - 1));
+
+    // the distances are summed in the fixed order, so the spacing does not depend on the number of threads
+    std::vector<ScalarType> neighborhoodSpacing(m_NumberOfPoints);
+    std::vector<ScalarType> spacing(m_NumberOfPoints, itk::NumericTraits< ScalarType >::ZeroValue());
+
+    TaskScheduler::GetInstance().ParallelFor(0, m_NumberOfPoints, 0, [&](const size_t & first, const size_t & last)
+    {
+      for (size_t n = first; n < last; ++n)
+      {
+        const PointType & point = points->ElementAt(n);
+
+        typename PointsIndexType::NeighborsIdentifierType idx;
+        tree->FindClosestNPoints(point, numberOfNeighbors + 1, idx);
+
+        std::vector<ScalarType> distances;
+        distances.reserve(idx.size());
+
+        for (size_t i = 0; i < idx.size(); ++i) 
+        {
+          if (idx[i] != static_cast<typename PointsIndexType::PointIdentifier>(n)) 
+          {
+            distances.push_back(point.EuclideanDistanceTo(points->ElementAt(idx[i])));
+          }
+        }
+
+        if (distances.empty()) 
+        {
+          continue;
+        }
+
+        std::sort(distances.begin(), distances.end());
+        spacing[n] = distances.front();
+        neighborhoodSpacing[n] = distances[std::min(numberOfNeighbors, distances.size()) - 1];
+      }
+    });
+
+    m_Spacing = PairwiseSum::Sum(spacing.data(), spacing.size()) / m_NumberOfPoints;
+
+    const size_t quantile = std::min(m_NumberOfPoints - 1, static_cast<size_t>(m_LevelOfQuantile * m_NumberOfPoints));
+    std::nth_element(neighborhoodSpacing.begin(), neighborhoodSpacing.begin() + quantile, neighborhoodSpacing.end());
+    m_NeighborhoodSpacing = neighborhoodSpacing[quantile];
+  }
+
   size_t m_NumberOfPoints;
   PointSetConstPointer m_PointSet;
   PointType m_Center;
   ScalarType m_Scale;
+  ScalarType m_Spacing;
+  ScalarType m_NeighborhoodSpacing;
+  ScalarType m_Radius;
+  ScalePyramidType m_ScalePyramid;
   bool m_Valid = false;
 
+  size_t m_NumberOfNeighbors = 6;
+  double m_LevelOfQuantile = 0.95;
+  double m_ScaleFactor = 0.25;
+
 private:
   PointSetPropertiesCalculator(const Self &) ITK_DELETE_FUNCTION;
   void operator=(const Self &) ITK_DELETE_FUNCTION;
@@ -6,6 +6,11 @@
 #include <itkHistogram.h>
 #include <itkPointsLocator.h>
 
+#include "itkPointSetDistanceField.h"
+#include "itkPointsKdTreeIndex.h"
+#include "itkPairwiseSum.h"
+#include "itkTaskScheduler.h"
+
 namespace itk
 {
   template< typename TFixedPointSet, typename TMovingPointSet = TFixedPointSet >
@@ -35,6 +40,8 @@ namespace itk
     typedef itk::Statistics::ListSample<typename MovingPointSetType::PointType> ListSampleType;
     typedef typename itk::PointsLocator<typename FixedPointSetType::PointsContainer> FixedPointsLocatorType;
     typedef typename itk::PointsLocator<typename MovingPointSetType::PointsContainer> MovingPointsLocatorType;
+    typedef itk::PointSetDistanceField<FixedPointSetType> FixedDistanceFieldType;
+    typedef itk::PointsKdTreeIndex<typename FixedPointSetType::PointsContainer> FixedPointsIndexType;
 
     /** Get/Set the Fixed Point Set.  */
     itkSetConstObjectMacro(FixedPointSet, FixedPointSetType);
@@ -44,6 +51,17 @@ namespace itk
     itkSetConstObjectMacro(MovingPointSet, MovingPointSetType);
     itkGetConstObjectMacro(MovingPointSet, MovingPointSetType);
 
+    /** Get/Set the distance field of the fixed point set. If it is set, the distances from the moving points
+     * to the fixed point set are interpolated without search, e.g. for many moving point sets registered
+     * to the same template. The search is used for the points outside the grid of the field. */
+    itkSetConstObjectMacro(FixedDistanceField, FixedDistanceFieldType);
+    itkGetConstObjectMacro(FixedDistanceField, FixedDistanceFieldType);
+
+    /** Get/Set the prebuilt index of the fixed point set. It replaces the kd-tree built from the fixed
+     * points if it matches them. */
+    itkSetConstObjectMacro(FixedPointsIndex, FixedPointsIndexType);
+    itkGetConstObjectMacro(FixedPointsIndex, FixedPointsIndexType);
+
     /*Get/Set values to compute quantile. */
     itkSetMacro(LevelOfQuantile, double);
     itkGetMacro(LevelOfQuantile, double);
@@ -72,10 +90,15 @@ namespace itk
     void Compute()
     {
       std::vector<MeasureType> movingToFixedMetrics;
-      this->ComputeMetrics<MovingPointSetType, FixedPointSetType>(movingToFixedMetrics, m_MovingPointSet, m_FixedPointSet);
+      this->ComputeMetrics<MovingPointSetType, FixedPointSetType>(movingToFixedMetrics, m_MovingPointSet, m_FixedPointSet, ITK_NULLPTR, ITK_NULLPTR);
+
+      const FixedPointsIndexType * index = ITK_NULLPTR;
+      if (m_FixedPointsIndex && m_FixedPointsIndex->Matches(m_FixedPointSet->GetPoints())) {
+        index = m_FixedPointsIndex.GetPointer();
+      }
 
       std::vector<MeasureType> fixedToMovingMetrics;
-      this->ComputeMetrics<FixedPointSetType, MovingPointSetType>(fixedToMovingMetrics, m_FixedPointSet, m_MovingPointSet);
+      this->ComputeMetrics<FixedPointSetType, MovingPointSetType>(fixedToMovingMetrics, m_FixedPointSet, m_MovingPointSet, m_FixedDistanceField.GetPointer(), index);
 
       m_MeanValue = 0.5 * (movingToFixedMetrics[0] + fixedToMovingMetrics[0]);
       m_RMSEValue = 0.5 * (movingToFixedMetrics[1] + fixedToMovingMetrics[1]);
@@ -94,6 +117,8 @@ namespace itk
 
     FixedPointSetConstPointer m_FixedPointSet;
     MovingPointSetConstPointer m_MovingPointSet;
+    typename FixedDistanceFieldType::ConstPointer m_FixedDistanceField;
+    typename FixedPointsIndexType::ConstPointer m_FixedPointsIndex;
 
     size_t m_BucketSize = 16;
     size_t m_HistogramSize = 1000;
@@ -105,39 +130,72 @@ namespace itk
     MeasureType m_MaximalValue;
 
     template <typename FixedPointSetType, typename MovingPointSetType>
-    void ComputeMetrics(std::vector<MeasureType> & metrics, typename FixedPointSetType::ConstPointer fixedPointSet, typename MovingPointSetType::ConstPointer movingPointSet)
+    void ComputeMetrics(std::vector<MeasureType> & metrics, typename FixedPointSetType::ConstPointer fixedPointSet, typename MovingPointSetType::ConstPointer movingPointSet, const FixedDistanceFieldType * field, const FixedPointsIndexType * index)
     {
       typename FixedPointSetType::PointsContainer::ConstPointer fixedContainer = fixedPointSet->GetPoints();
       typename MovingPointSetType::PointsContainer::ConstPointer movingContainer = movingPointSet->GetPoints();
 
-      typedef itk::PointsLocator<typename FixedPointSetType::PointsContainer> PointsLocatorType;
-      typename PointsLocatorType::Pointer pLocator = PointsLocatorType::New();
-      pLocator->SetPoints(const_cast<typename FixedPointSetType::PointsContainer*> (fixedContainer.GetPointer()));
-      pLocator->Initialize();
+      // the kd-tree is built on demand, if neither the distance field covers the points nor the index is set
+      typename FixedPointsIndexType::Pointer tree;
 
       typedef itk::Vector<MeasureType, 1> VectorType;
       typedef itk::Statistics::ListSample<VectorType> ListSampleType;
       ListSampleType::Pointer measures = ListSampleType::New();
 
-      MeasureType mean = itk::NumericTraits<MeasureType>::Zero;
-      MeasureType rmse = itk::NumericTraits<MeasureType>::Zero;
-      MeasureType maximal = itk::NumericTraits<MeasureType>::Zero;
+      const size_t numberOfPoints = movingPointSet->GetNumberOfPoints();
+      std::vector<MeasureType> distances(numberOfPoints);
+      std::vector<unsigned char> evaluated(numberOfPoints, 0);
+
+      // the distance field is evaluated first, so the tree is built only if some point is not covered by it
+      bool covered = true;
+
+      if (field) {
+        TaskScheduler::GetInstance().ParallelFor(0, numberOfPoints, 0, [&](const size_t & first, const size_t & last) {
+          for (size_t n = first; n < last; ++n) {
+            MeasureType distance;
+            if (field->Evaluate(movingContainer->ElementAt(n), distance, ITK_NULLPTR)) {
+              distances[n] = std::sqrt(std::max(distance, 0.0));
+              evaluated[n] = 1;
+            }
+          }
+        });
+
+        covered = std::find(evaluated.begin(), evaluated.end(), 0) == evaluated.end();
+      }
+      else {
+        covered = numberOfPoints == 0;
+      }
+
+      if (!covered && !index) {
+        tree = FixedPointsIndexType::New();
+        tree->SetHashPoints(false);
+        tree->Build(fixedContainer);
+        index = tree.GetPointer();
+      }
 
-      for (typename MovingPointSetType::PointsContainerConstIterator moving = movingContainer->Begin(); moving != movingContainer->End(); ++moving) {
-        typename FixedPointSetType::PointType movingPoint = moving.Value();
+      if (!covered) {
+        TaskScheduler::GetInstance().ParallelFor(0, numberOfPoints, 0, [&](const size_t & first, const size_t & last) {
+          for (size_t n = first; n < last; ++n) {
+            if (!evaluated[n]) {
+              const typename FixedPointSetType::PointType movingPoint = movingContainer->ElementAt(n);
+              distances[n] = movingPoint.EuclideanDistanceTo(fixedPointSet->GetPoint(index->FindClosestPoint(movingPoint)));
+            }
+          }
+        });
+      }
 
-        size_t idx = pLocator->FindClosestPoint(movingPoint);
-        MeasureType distance = movingPoint.EuclideanDistanceTo(fixedPointSet->GetPoint(idx));
+      // the sums are pairwise in the order of the points, so they do not depend on the number of threads
+      std::vector<MeasureType> squares(numberOfPoints);
+      MeasureType maximal = itk::NumericTraits<MeasureType>::Zero;
 
-        measures->PushBack(distance);
-        mean += distance;
-        rmse += distance * distance;
-        maximal = std::max(maximal, distance);
+      for (size_t n = 0; n < numberOfPoints; ++n) {
+        measures->PushBack(distances[n]);
+        squares[n] = distances[n] * distances[n];
+        maximal = std::max(maximal, distances[n]);
       }
 
-      size_t numberOfPoints = movingPointSet->GetNumberOfPoints();
-      mean = mean / numberOfPoints;
-      rmse = std::sqrt(rmse / numberOfPoints);
+      const MeasureType mean = PairwiseSum::Sum(distances.data(), distances.size()) / numberOfPoints;
+      const MeasureType rmse = std::sqrt(PairwiseSum::Sum(squares.data(), squares.size()) / numberOfPoints);
 
       // compute quantile
       typedef typename itk::Statistics::Histogram<MeasureType, itk::Statistics::DenseFrequencyContainer2> HistogramType;
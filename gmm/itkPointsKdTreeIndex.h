@@ -0,0 +1,566 @@
+#ifndef itkPointsKdTreeIndex_h
+#define itkPointsKdTreeIndex_h
+
+#include <itkObject.h>
+#include <itkObjectFactory.h>
+#include <itkNumericTraits.h>
+#include "itkTaskScheduler.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#define GMM_INDEX_USE_MMAP 0
+#else
+#define GMM_INDEX_USE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace itk
+{
+/** \class PointsKdTreeIndex
+ * \brief Flat kd-tree of the points, which can be saved to a file and memory mapped.
+ *
+ * The tree is stored implicitly: the points are reordered so that each node is the median of its
+ * range of the array and splits the rest of the range by the coordinate with the largest extent.
+ * The ranges with at most LeafSize points are the leaves. The coordinates are stored as the structure
+ * of arrays, one array per dimension, together with the original identifiers and the splitting
+ * dimensions, so the file has the same layout as the memory and is opened by mmap without parsing.
+ *
+ * The index is keyed by the hash of the coordinates, Matches() checks that the index was built for
+ * the points. The queries return the original identifiers, as itk::PointsLocator does.
+ *
+ * The subtrees larger than ParallelBuildSize points are built by the tasks of the TaskScheduler, so the index
+ * replaces itk::PointsLocator for the large point sets, whose serial build dominates the startup.
+ */
+template< typename TPointsContainer >
+class PointsKdTreeIndex : public Object
+{
+public:
+  /** Standard class typedefs. */
+  typedef PointsKdTreeIndex                Self;
+  typedef Object                           Superclass;
+  typedef SmartPointer< Self >             Pointer;
+  typedef SmartPointer< const Self >       ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(PointsKdTreeIndex, Object);
+
+  /** Extract the dimension of the points. */
+  itkStaticConstMacro(Dimension, unsigned int, TPointsContainer::Element::PointDimension);
+
+  typedef TPointsContainer                                PointsContainerType;
+  typedef typename PointsContainerType::ElementIdentifier PointIdentifier;
+  typedef std::vector<PointIdentifier>                    NeighborsIdentifierType;
+
+  /** Get/Set the maximal number of points in the leaves, it is used by Build(). */
+  itkSetMacro(LeafSize, size_t);
+  itkGetConstMacro(LeafSize, size_t);
+
+  /** Get/Set the minimal number of points in the subtrees built in parallel. */
+  itkSetMacro(ParallelBuildSize, size_t);
+  itkGetConstMacro(ParallelBuildSize, size_t);
+
+  /** Get/Set boolean flag to hash the points in Build(). The hash is needed only to match the saved
+   * index with the points, the indices built for the queries in place skip it. */
+  itkSetMacro(HashPoints, bool);
+  itkGetConstMacro(HashPoints, bool);
+  itkBooleanMacro(HashPoints);
+
+  /** Get the number of points and the hash of the points of the index. */
+  size_t GetNumberOfPoints() const
+  {
+    return m_Header ? m_Header->numberOfPoints : 0;
+  }
+
+  uint64_t GetHash() const
+  {
+    return m_Header ? m_Header->hash : 0;
+  }
+
+  /** Get true if the index is memory mapped from the file. */
+  bool IsMapped() const
+  {
+    return m_MappedData != ITK_NULLPTR;
+  }
+
+  /** Compute the FNV-1a hash of the number of points and the coordinates in double precision. */
+  static uint64_t ComputeHash(const PointsContainerType * points)
+  {
+    uint64_t hash = 14695981039346656037ULL;
+    const uint64_t numberOfPoints = points->Size();
+    hash = Hash(hash, &numberOfPoints, sizeof(numberOfPoints));
+
+    for (typename PointsContainerType::ConstIterator it = points->Begin(); it != points->End(); ++it) {
+      for (unsigned int dim = 0; dim < Dimension; ++dim) {
+        // the negative zero is hashed as zero
+        const double value = it.Value()[dim] + 0.0;
+        hash = Hash(hash, &value, sizeof(value));
+      }
+    }
+
+    return hash;
+  }
+
+  /** Check that the index was built for the points. The container and its modification time are kept
+   * after the first check or the build, so the following checks of the same unmodified points, e.g. by
+   * each level of the registration and by each request to the resident model, do not hash the points. */
+  bool Matches(const PointsContainerType * points) const
+  {
+    if (!m_Header || m_Header->numberOfPoints != points->Size()) {
+      return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_MatchedMutex);
+
+    if (points == m_MatchedPoints && points->GetMTime() == m_MatchedTime) {
+      return true;
+    }
+
+    if (m_Header->hash != ComputeHash(points)) {
+      return false;
+    }
+
+    m_MatchedPoints = points;
+    m_MatchedTime = points->GetMTime();
+    return true;
+  }
+
+  /** Build the index for the points. */
+  void Build(const PointsContainerType * points)
+  {
+    this->Release();
+
+    const size_t numberOfPoints = points->Size();
+    HeaderType header;
+    this->InitializeHeader(header, numberOfPoints, std::max(m_LeafSize, size_t(1)));
+    header.hash = m_HashPoints ? ComputeHash(points) : 0;
+
+    m_Buffer.assign(header.fileSize, 0);
+    std::memcpy(&m_Buffer[0], &header, sizeof(HeaderType));
+    this->SetPointers(&m_Buffer[0]);
+
+    double * coordinates = reinterpret_cast<double *>(&m_Buffer[header.coordinatesOffset]);
+    uint64_t * identifiers = reinterpret_cast<uint64_t *>(&m_Buffer[header.identifiersOffset]);
+    uint8_t * splits = reinterpret_cast<uint8_t *>(&m_Buffer[header.splitsOffset]);
+
+    // the points are sorted as the array of structures during the build
+    std::vector<double> values(numberOfPoints * Dimension);
+    std::vector<size_t> order(numberOfPoints);
+    std::vector<uint64_t> ids(numberOfPoints);
+
+    size_t n = 0;
+    for (typename PointsContainerType::ConstIterator it = points->Begin(); it != points->End(); ++it, ++n) {
+      for (unsigned int dim = 0; dim < Dimension; ++dim) {
+        values[n * Dimension + dim] = it.Value()[dim];
+      }
+      ids[n] = it.Index();
+      order[n] = n;
+    }
+
+    const size_t parallelSize = std::max(m_ParallelBuildSize, header.leafSize + 1);
+
+    this->BuildNode(values, order, splits, 0, numberOfPoints, header.leafSize, parallelSize);
+
+    TaskScheduler::GetInstance().ParallelFor(0, numberOfPoints, 0, [&](const size_t & first, const size_t & last) {
+      for (size_t k = first; k < last; ++k) {
+        for (unsigned int dim = 0; dim < Dimension; ++dim) {
+          coordinates[dim * numberOfPoints + k] = values[order[k] * Dimension + dim];
+        }
+        identifiers[k] = ids[order[k]];
+      }
+    });
+
+    // the index matches the points it is built for
+    m_MatchedPoints = points;
+    m_MatchedTime = points->GetMTime();
+
+    this->Modified();
+  }
+
+  /** Write the index to the file. */
+  void Write(const std::string & fileName) const
+  {
+    if (!m_Header) {
+      itkExceptionMacro(<< "The index is empty, call Build() or Read() first");
+    }
+
+    std::ofstream file(fileName.c_str(), std::ios::binary);
+    file.write(reinterpret_cast<const char *>(m_Header), m_Header->fileSize);
+
+    if (!file) {
+      itkExceptionMacro(<< "Failed to write the index to " << fileName);
+    }
+  }
+
+  /** Read the index from the file, the file is memory mapped if it is supported. */
+  void Read(const std::string & fileName)
+  {
+    this->Release();
+
+#if GMM_INDEX_USE_MMAP
+    const int descriptor = open(fileName.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+      itkExceptionMacro(<< "Failed to open the index " << fileName);
+    }
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || static_cast<size_t>(status.st_size) < sizeof(HeaderType)) {
+      close(descriptor);
+      itkExceptionMacro(<< "The file " << fileName << " is not an index");
+    }
+
+    void * data = mmap(ITK_NULLPTR, status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+
+    if (data == MAP_FAILED) {
+      itkExceptionMacro(<< "Failed to map the index " << fileName);
+    }
+
+    m_MappedData = data;
+    m_MappedSize = status.st_size;
+    const char * buffer = static_cast<const char *>(data);
+    const size_t fileSize = status.st_size;
+#else
+    std::ifstream file(fileName.c_str(), std::ios::binary | std::ios::ate);
+    if (!file) {
+      itkExceptionMacro(<< "Failed to open the index " << fileName);
+    }
+
+    const size_t fileSize = static_cast<size_t>(file.tellg());
+    m_Buffer.resize(std::max(fileSize, sizeof(HeaderType)));
+    file.seekg(0);
+    file.read(&m_Buffer[0], fileSize);
+    const char * buffer = &m_Buffer[0];
+#endif
+
+    HeaderType expected;
+    const HeaderType * header = reinterpret_cast<const HeaderType *>(buffer);
+    this->InitializeHeader(expected, header->numberOfPoints, header->leafSize);
+
+    if (std::memcmp(header->magic, expected.magic, sizeof(expected.magic)) != 0 || header->version != expected.version ||
+        header->dimension != Dimension || header->leafSize == 0 || header->fileSize != expected.fileSize || fileSize < expected.fileSize) {
+      this->Release();
+      itkExceptionMacro(<< "The file " << fileName << " is not a valid index of " << Dimension << "D points");
+    }
+
+    this->SetPointers(buffer);
+    this->Modified();
+  }
+
+  /** Find the closest point. */
+  template< typename TPoint >
+  PointIdentifier FindClosestPoint(const TPoint & point) const
+  {
+    NeighborsIdentifierType result;
+    this->FindClosestNPoints(point, 1, result);
+
+    if (result.empty()) {
+      itkExceptionMacro(<< "The index is empty");
+    }
+
+    return result[0];
+  }
+
+  /** Find the N closest points, they are sorted by the distance. */
+  template< typename TPoint >
+  void FindClosestNPoints(const TPoint & point, const size_t & numberOfNeighbors, NeighborsIdentifierType & result) const
+  {
+    result.clear();
+
+    if (!m_Header || numberOfNeighbors == 0) {
+      return;
+    }
+
+    double x[Dimension];
+    for (unsigned int dim = 0; dim < Dimension; ++dim) {
+      x[dim] = point[dim];
+    }
+
+    HeapType heap;
+    this->FindClosestNode(x, std::min(numberOfNeighbors, this->GetNumberOfPoints()), 0, this->GetNumberOfPoints(), heap);
+
+    result.resize(heap.size());
+    for (size_t n = result.size(); n > 0; --n) {
+      result[n - 1] = static_cast<PointIdentifier>(m_Identifiers[heap.top().second]);
+      heap.pop();
+    }
+  }
+
+  /** Find the points in the ball of the radius. */
+  template< typename TPoint >
+  void Search(const TPoint & point, const double & radius, NeighborsIdentifierType & result) const
+  {
+    result.clear();
+
+    if (!m_Header) {
+      return;
+    }
+
+    double x[Dimension];
+    for (unsigned int dim = 0; dim < Dimension; ++dim) {
+      x[dim] = point[dim];
+    }
+
+    this->SearchNode(x, radius * radius, 0, this->GetNumberOfPoints(), result);
+  }
+
+protected:
+  PointsKdTreeIndex() {}
+  virtual ~PointsKdTreeIndex()
+  {
+    this->Release();
+  }
+
+  virtual void PrintSelf(std::ostream & os, itk::Indent indent) const ITK_OVERRIDE
+  {
+    Superclass::PrintSelf(os, indent);
+    os << indent << "LeafSize: " << m_LeafSize << std::endl;
+    os << indent << "ParallelBuildSize: " << m_ParallelBuildSize << std::endl;
+    os << indent << "NumberOfPoints: " << this->GetNumberOfPoints() << std::endl;
+    os << indent << "Hash: " << this->GetHash() << std::endl;
+    os << indent << "Mapped: " << this->IsMapped() << std::endl;
+  }
+
+  /** The header of the file, the arrays follow at the offsets aligned to the cache lines. */
+  struct HeaderType
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t dimension;
+    uint64_t numberOfPoints;
+    uint64_t leafSize;
+    uint64_t hash;
+    uint64_t coordinatesOffset;
+    uint64_t identifiersOffset;
+    uint64_t splitsOffset;
+    uint64_t fileSize;
+  };
+
+  typedef std::pair<double, size_t>  NeighborType;
+  typedef std::priority_queue<NeighborType> HeapType;
+
+  static uint64_t Hash(uint64_t hash, const void * data, const size_t & size)
+  {
+    const unsigned char * bytes = static_cast<const unsigned char *>(data);
+    for (size_t n = 0; n < size; ++n) {
+      hash ^= bytes[n];
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  static uint64_t Align(const uint64_t & offset)
+  {
+    return (offset + 63) / 64 * 64;
+  }
+
+  void InitializeHeader(HeaderType & header, const uint64_t & numberOfPoints, const uint64_t & leafSize) const
+  {
+    std::memset(&header, 0, sizeof(HeaderType));
+    std::memcpy(header.magic, "GMMKDIDX", sizeof(header.magic));
+    header.version = 1;
+    header.dimension = Dimension;
+    header.numberOfPoints = numberOfPoints;
+    header.leafSize = leafSize;
+    header.coordinatesOffset = Align(sizeof(HeaderType));
+    header.identifiersOffset = Align(header.coordinatesOffset + numberOfPoints * Dimension * sizeof(double));
+    header.splitsOffset = Align(header.identifiersOffset + numberOfPoints * sizeof(uint64_t));
+    header.fileSize = Align(header.splitsOffset + numberOfPoints * sizeof(uint8_t));
+  }
+
+  void SetPointers(const char * buffer)
+  {
+    m_Header = reinterpret_cast<const HeaderType *>(buffer);
+    m_Coordinates = reinterpret_cast<const double *>(buffer + m_Header->coordinatesOffset);
+    m_Identifiers = reinterpret_cast<const uint64_t *>(buffer + m_Header->identifiersOffset);
+    m_Splits = reinterpret_cast<const uint8_t *>(buffer + m_Header->splitsOffset);
+  }
+
+  void Release()
+  {
+#if GMM_INDEX_USE_MMAP
+    if (m_MappedData) {
+      munmap(m_MappedData, m_MappedSize);
+    }
+#endif
+    m_MappedData = ITK_NULLPTR;
+    m_MappedSize = 0;
+    m_Header = ITK_NULLPTR;
+    m_Coordinates = ITK_NULLPTR;
+    m_Identifiers = ITK_NULLPTR;
+    m_Splits = ITK_NULLPTR;
+    std::vector<char>().swap(m_Buffer);
+
+    std::lock_guard<std::mutex> lock(m_MatchedMutex);
+    m_MatchedPoints = ITK_NULLPTR;
+    m_MatchedTime = 0;
+  }
+
+  /** Split the range at the median by the dimension with the largest extent. The two halves are
+   * disjoint ranges of the order, so the large ones are split by the concurrent tasks. */
+  static void BuildNode(const std::vector<double> & points, std::vector<size_t> & order, uint8_t * splits, const size_t & begin, const size_t & end, const size_t & leafSize, const size_t & parallelSize)
+  {
+    if (end - begin <= leafSize) {
+      return;
+    }
+
+    double lower[Dimension];
+    double upper[Dimension];
+    for (unsigned int dim = 0; dim < Dimension; ++dim) {
+      lower[dim] = NumericTraits<double>::max();
+      upper[dim] = NumericTraits<double>::NonpositiveMin();
+    }
+
+    for (size_t n = begin; n < end; ++n) {
+      for (unsigned int dim = 0; dim < Dimension; ++dim) {
+        lower[dim] = std::min(lower[dim], points[order[n] * Dimension + dim]);
+        upper[dim] = std::max(upper[dim], points[order[n] * Dimension + dim]);
+      }
+    }
+
+    unsigned int split = 0;
+    for (unsigned int dim = 1; dim < Dimension; ++dim) {
+      if (upper[dim] - lower[dim] > upper[split] - lower[split]) {
+        split = dim;
+      }
+    }
+
+    const size_t middle = begin + (end - begin) / 2;
+    std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+                     [&points, split](const size_t & a, const size_t & b) { return points[a * Dimension + split] < points[b * Dimension + split]; });
+
+    splits[middle] = static_cast<uint8_t>(split);
+
+    if (end - begin >= parallelSize) {
+      TaskScheduler::TaskGroup group;
+      group.Run([&points, &order, splits, begin, middle, leafSize, parallelSize]() { BuildNode(points, order, splits, begin, middle, leafSize, parallelSize); });
+
+      BuildNode(points, order, splits, middle + 1, end, leafSize, parallelSize);
+
+      group.Wait();
+    }
+    else {
+      BuildNode(points, order, splits, begin, middle, leafSize, parallelSize);
+      BuildNode(points, order, splits, middle + 1, end, leafSize, parallelSize);
+    }
+  }
+
+  double SquaredDistance(const double * x, const size_t & n) const
+  {
+    const size_t numberOfPoints = m_Header->numberOfPoints;
+    double distance = 0;
+    for (unsigned int dim = 0; dim < Dimension; ++dim) {
+      const double difference = x[dim] - m_Coordinates[dim * numberOfPoints + n];
+      distance += difference * difference;
+    }
+    return distance;
+  }
+
+  void AddNeighbor(const double * x, const size_t & n, const size_t & numberOfNeighbors, HeapType & heap) const
+  {
+    const double distance = this->SquaredDistance(x, n);
+
+    if (heap.size() < numberOfNeighbors) {
+      heap.push(NeighborType(distance, n));
+    }
+    else if (distance < heap.top().first) {
+      heap.pop();
+      heap.push(NeighborType(distance, n));
+    }
+  }
+
+  void FindClosestNode(const double * x, const size_t & numberOfNeighbors, const size_t & begin, const size_t & end, HeapType & heap) const
+  {
+    if (end - begin <= m_Header->leafSize) {
+      for (size_t n = begin; n < end; ++n) {
+        this->AddNeighbor(x, n, numberOfNeighbors, heap);
+      }
+      return;
+    }
+
+    const size_t middle = begin + (end - begin) / 2;
+    const unsigned int split = m_Splits[middle];
+    const double difference = x[split] - m_Coordinates[split * m_Header->numberOfPoints + middle];
+
+    this->AddNeighbor(x, middle, numberOfNeighbors, heap);
+
+    if (difference < 0) {
+      this->FindClosestNode(x, numberOfNeighbors, begin, middle, heap);
+      if (heap.size() < numberOfNeighbors || difference * difference < heap.top().first) {
+        this->FindClosestNode(x, numberOfNeighbors, middle + 1, end, heap);
+      }
+    }
+    else {
+      this->FindClosestNode(x, numberOfNeighbors, middle + 1, end, heap);
+      if (heap.size() < numberOfNeighbors || difference * difference < heap.top().first) {
+        this->FindClosestNode(x, numberOfNeighbors, begin, middle, heap);
+      }
+    }
+  }
+
+  void SearchNode(const double * x, const double & radius2, const size_t & begin, const size_t & end, NeighborsIdentifierType & result) const
+  {
+    if (end - begin <= m_Header->leafSize) {
+      for (size_t n = begin; n < end; ++n) {
+        if (this->SquaredDistance(x, n) <= radius2) {
+          result.push_back(static_cast<PointIdentifier>(m_Identifiers[n]));
+        }
+      }
+      return;
+    }
+
+    const size_t middle = begin + (end - begin) / 2;
+    const unsigned int split = m_Splits[middle];
+    const double difference = x[split] - m_Coordinates[split * m_Header->numberOfPoints + middle];
+
+    if (this->SquaredDistance(x, middle) <= radius2) {
+      result.push_back(static_cast<PointIdentifier>(m_Identifiers[middle]));
+    }
+
+    if (difference <= 0 || difference * difference <= radius2) {
+      this->SearchNode(x, radius2, begin, middle, result);
+    }
+
+    if (difference >= 0 || difference * difference <= radius2) {
+      this->SearchNode(x, radius2, middle + 1, end, result);
+    }
+  }
+
+  size_t m_LeafSize = 8;
+  size_t m_ParallelBuildSize = 65536;
+  bool m_HashPoints = true;
+
+  std::vector<char> m_Buffer;
+  void * m_MappedData = ITK_NULLPTR;
+  size_t m_MappedSize = 0;
+
+  const HeaderType * m_Header = ITK_NULLPTR;
+  const double * m_Coordinates = ITK_NULLPTR;
+  const uint64_t * m_Identifiers = ITK_NULLPTR;
+  const uint8_t * m_Splits = ITK_NULLPTR;
+
+  // the points which are checked to match the index
+  mutable std::mutex m_MatchedMutex;
+  mutable const PointsContainerType * m_MatchedPoints = ITK_NULLPTR;
+  mutable ModifiedTimeType m_MatchedTime = 0;
+
+private:
+  PointsKdTreeIndex(const Self &) ITK_DELETE_FUNCTION;
+  void operator=(const Self &) ITK_DELETE_FUNCTION;
+};
+}
+
+#endif
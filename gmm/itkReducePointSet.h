@@ -0,0 +1,223 @@
+#ifndef itkReducePointSet_h
+#define itkReducePointSet_h
+
+#include <itkPointSet.h>
+#include <itkNumericTraits.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace itk
+{
+/** \class ReducePointSet
+ * \brief Reduces the point set to the weighted centroids of the points in the voxels of the grid.
+ *
+ * The points in each voxel of the size VoxelSize are merged into their centroid, the weight of the
+ * centroid is the number of the merged points and it is written to the point data of the output. If
+ * UseInputWeights is on, the point data of the input are used as the weights of the input points, so the
+ * reduced point sets can be reduced again, otherwise the point data are ignored. The sum of the weights is preserved, so the Gaussian kernel
+ * sums over the output approximate the sums over the input with the error of the order of the squared
+ * ratio of the voxel size to the scale of the kernel. The output points are ordered by the voxels, an
+ * exception is thrown if the number of the voxels in the bounding box of the points exceeds 64 bits.
+ */
+template< typename TPointSet >
+class ReducePointSet : public Object
+{
+public:
+  /** Standard class typedefs. */
+  typedef ReducePointSet< TPointSet >       Self;
+  typedef Object                            Superclass;
+  typedef SmartPointer< Self >              Pointer;
+  typedef SmartPointer< const Self >        ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(ReducePointSet, Object);
+
+  /** Extract the dimension of the point set. */
+  itkStaticConstMacro(Dimension, unsigned int, TPointSet::PointDimension);
+
+  /** Standard types and pointers within this class. */
+  typedef TPointSet PointSetType;
+  typedef typename PointSetType::Pointer                        PointSetPointer;
+  typedef typename PointSetType::ConstPointer                   PointSetConstPointer;
+  typedef typename PointSetType::PointType                      PointType;
+  typedef typename PointSetType::PixelType                      PixelType;
+  typedef typename PointSetType::PointIdentifier                PointIdentifier;
+  typedef typename PointSetType::PointsContainer                PointsContainer;
+  typedef typename PointSetType::PointDataContainer             PointDataContainer;
+  typedef typename PointSetType::PointsContainerConstIterator   IteratorType;
+
+  /** Set the input point set. */
+  virtual void SetPointSet(const PointSetType *points)
+  {
+    if ( m_PointSet != points )
+    {
+      m_PointSet = points;
+      this->Modified();
+      m_Valid = false;
+    }
+  }
+
+  /** Get/Set the size of the voxels. */
+  itkSetMacro(VoxelSize, double);
+  itkGetMacro(VoxelSize, double);
+
+  /** Use the point data of the input as the weights of the points, they must match the points. */
+  itkSetMacro(UseInputWeights, bool);
+  itkGetMacro(UseInputWeights, bool);
+  itkBooleanMacro(UseInputWeights);
+
+  /** Get output point set, the weights of the points are in the point data.*/
+  PointSetPointer GetOutput() const
+  {
+    if (!m_Valid) {
+      itkExceptionMacro(<< "GetOutput() invoked, but the point set has not been reduced. Call Compute() first.");
+    }
+    return m_OutputPointSet;
+  }
+
+  /** Get the sum of the weights of the points.*/
+  double GetTotalWeight() const
+  {
+    if (!m_Valid) {
+      itkExceptionMacro(<< "GetTotalWeight() invoked, but the point set has not been reduced. Call Compute() first.");
+    }
+    return m_TotalWeight;
+  }
+
+  void Compute()
+  {
+    if (m_VoxelSize <= 0) {
+      itkExceptionMacro(<< "The voxel size must be positive");
+    }
+
+    const size_t numberOfPoints = m_PointSet->GetNumberOfPoints();
+
+    const PointDataContainer * data = m_PointSet->GetPointData();
+    const bool weighted = m_UseInputWeights && data && data->Size() == numberOfPoints;
+
+    if (m_UseInputWeights && !weighted) {
+      itkExceptionMacro(<< "The point data of the input do not match the points, they cannot be used as the weights");
+    }
+
+    // the grid is aligned to the lower corner of the bounding box of the points
+    PointType lower;
+    PointType upper;
+    lower.Fill(NumericTraits<typename PointType::ValueType>::max());
+    upper.Fill(NumericTraits<typename PointType::ValueType>::NonpositiveMin());
+
+    for (IteratorType it = m_PointSet->GetPoints()->Begin(); it != m_PointSet->GetPoints()->End(); ++it) {
+      for (unsigned int dim = 0; dim < Dimension; ++dim) {
+        lower[dim] = std::min(lower[dim], it.Value()[dim]);
+        upper[dim] = std::max(upper[dim], it.Value()[dim]);
+      }
+    }
+
+    // the keys must index all the voxels of the grid, else the distant voxels would be merged
+    const uint64_t maximum = std::numeric_limits<uint64_t>::max();
+    uint64_t cells[Dimension];
+    uint64_t numberOfCells = 1;
+
+    for (unsigned int dim = 0; dim < Dimension; ++dim) {
+      const double extent = numberOfPoints > 0 ? std::floor((upper[dim] - lower[dim]) / m_VoxelSize) + 1 : 1;
+
+      if (!(extent < static_cast<double>(maximum)) || static_cast<uint64_t>(extent) > maximum / numberOfCells) {
+        itkExceptionMacro(<< "The number of the voxels of the size " << m_VoxelSize << " in the bounding box of the points exceeds 64 bits");
+      }
+
+      cells[dim] = static_cast<uint64_t>(extent);
+      numberOfCells *= cells[dim];
+    }
+
+    // the keys of the voxels, the points are grouped by sorting the keys
+    std::vector< std::pair<uint64_t, PointIdentifier> > keys;
+    keys.reserve(numberOfPoints);
+
+    for (IteratorType it = m_PointSet->GetPoints()->Begin(); it != m_PointSet->GetPoints()->End(); ++it) {
+      uint64_t key = 0;
+      for (int dim = Dimension - 1; dim >= 0; --dim) {
+        key = key * cells[dim] + this->GetCell(it.Value(), lower, dim);
+      }
+
+      keys.push_back(std::make_pair(key, it.Index()));
+    }
+
+    std::sort(keys.begin(), keys.end());
+
+    // merge the points of each voxel into the weighted centroid
+    typename PointsContainer::Pointer points = PointsContainer::New();
+    typename PointDataContainer::Pointer weights = PointDataContainer::New();
+    m_TotalWeight = 0;
+
+    for (size_t begin = 0; begin < keys.size();) {
+      double centroid[Dimension] = {};
+      double weight = 0;
+      size_t end = begin;
+
+      for (; end < keys.size() && keys[end].first == keys[begin].first; ++end) {
+        const PointType & point = m_PointSet->GetPoint(keys[end].second);
+        const double pointWeight = weighted ? data->ElementAt(keys[end].second) : 1.0;
+
+        for (unsigned int dim = 0; dim < Dimension; ++dim) {
+          centroid[dim] += pointWeight * point[dim];
+        }
+        weight += pointWeight;
+      }
+
+      PointType point;
+      for (unsigned int dim = 0; dim < Dimension; ++dim) {
+        point[dim] = weight > 0 ? centroid[dim] / weight : m_PointSet->GetPoint(keys[begin].second)[dim];
+      }
+
+      points->push_back(point);
+      weights->push_back(static_cast<PixelType>(weight));
+      m_TotalWeight += weight;
+
+      begin = end;
+    }
+
+    m_OutputPointSet = PointSetType::New();
+    m_OutputPointSet->SetPoints(points);
+    m_OutputPointSet->SetPointData(weights);
+
+    m_Valid = true;
+  }
+
+protected:
+  ReducePointSet() {}
+  virtual ~ReducePointSet() {};
+
+  virtual void PrintSelf(std::ostream & os, itk::Indent indent) const ITK_OVERRIDE
+  {
+    Superclass::PrintSelf(os, indent);
+    os << indent << "PointSet: " << m_PointSet.GetPointer() << std::endl;
+    os << indent << "Output PointSet: " << m_OutputPointSet.GetPointer() << std::endl;
+    os << indent << "Voxel size: " << m_VoxelSize << std::endl;
+    os << indent << "Use input weights: " << m_UseInputWeights << std::endl;
+  }
+
+  uint64_t GetCell(const PointType & point, const PointType & lower, const unsigned int & dim) const
+  {
+    return static_cast<uint64_t>(std::floor((point[dim] - lower[dim]) / m_VoxelSize));
+  }
+
+  PointSetConstPointer m_PointSet;
+  PointSetPointer m_OutputPointSet;
+  double m_VoxelSize = 1;
+  double m_TotalWeight = 0;
+  bool m_UseInputWeights = false;
+  bool m_Valid = false;
+
+private:
+  ReducePointSet(const Self &) ITK_DELETE_FUNCTION;
+  void operator=(const Self &) ITK_DELETE_FUNCTION;
+};
+}
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef itkStochasticGradientDescentOptimizer_h
+#define itkStochasticGradientDescentOptimizer_h
+
+#include <itkSingleValuedNonLinearOptimizer.h>
+#include <cmath>
+#include <sstream>
+#include <string>
+
+namespace itk
+{
+/** \class StochasticGradientDescentOptimizer
+ * \brief Gradient descent with the decaying gain for noisy metrics.
+ *
+ * The parameters are updated as x(k+1) = x(k) - a / (k + 1 + A)^alpha * g(k) / s^2, where g is the
+ * derivative of the cost function and s are the scales of the parameters. The gain sequence satisfies
+ * the Robbins-Monro conditions for the exponents in (0.5, 1], so the iterations converge if the
+ * derivative is an unbiased estimate, e.g. evaluated over the random subsets of the points.
+ *
+ * If the learning rate a is not positive, it is estimated from the derivative at the initial position,
+ * so that the length of the first step in the scaled parameters equals the MaximalStepLength. The
+ * optimizer does not stop on the value changes, which are noisy, only after the number of iterations
+ * or if the metric aborts the evaluation.
+ */
+class StochasticGradientDescentOptimizer : public SingleValuedNonLinearOptimizer
+{
+public:
+  /** Standard class typedefs. */
+  typedef StochasticGradientDescentOptimizer  Self;
+  typedef SingleValuedNonLinearOptimizer      Superclass;
+  typedef SmartPointer< Self >                Pointer;
+  typedef SmartPointer< const Self >          ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(StochasticGradientDescentOptimizer, SingleValuedNonLinearOptimizer);
+
+  /** Get/Set the number of iterations. */
+  itkSetMacro(NumberOfIterations, SizeValueType);
+  itkGetConstMacro(NumberOfIterations, SizeValueType);
+
+  /** Get/Set the learning rate, if it is not positive the rate is estimated at each start. */
+  itkSetMacro(LearningRate, double);
+  itkGetConstMacro(LearningRate, double);
+
+  /** Get the learning rate used by the last optimization. */
+  itkGetConstMacro(CurrentLearningRate, double);
+
+  /** Get/Set the length of the first step in the scaled parameters to estimate the learning rate. */
+  itkSetMacro(MaximalStepLength, double);
+  itkGetConstMacro(MaximalStepLength, double);
+
+  /** Get/Set the offset A and the exponent alpha of the decay of the gain. */
+  itkSetMacro(DecayOffset, double);
+  itkGetConstMacro(DecayOffset, double);
+
+  itkSetClampMacro(DecayExponent, double, 0.0, 1.0);
+  itkGetConstMacro(DecayExponent, double);
+
+  /** Get the current state. */
+  itkGetConstMacro(CurrentIteration, SizeValueType);
+  itkGetConstMacro(Value, MeasureType);
+  itkGetConstReferenceMacro(Gradient, DerivativeType);
+
+  /** Start optimization. */
+  virtual void StartOptimization() ITK_OVERRIDE
+  {
+    if (!m_CostFunction) {
+      itkExceptionMacro(<< "CostFunction is not present");
+    }
+
+    const ParametersType & initialPosition = this->GetInitialPosition();
+    const unsigned int numberOfParameters = initialPosition.size();
+
+    if (numberOfParameters == 0) {
+      itkExceptionMacro(<< "The initial position is not set");
+    }
+
+    ScalesType scales(numberOfParameters);
+    scales.Fill(1.0);
+
+    if (this->GetScales().size() == numberOfParameters) {
+      scales = this->GetScales();
+    }
+
+    m_CurrentLearningRate = m_LearningRate;
+
+    m_CurrentIteration = 0;
+    m_StopConditionDescription.str("");
+    this->SetCurrentPosition(initialPosition);
+    ParametersType position = initialPosition;
+
+    this->InvokeEvent(StartEvent());
+
+    for (m_CurrentIteration = 0; m_CurrentIteration < m_NumberOfIterations; ++m_CurrentIteration) {
+      m_CostFunction->GetValueAndDerivative(position, m_Value, m_Gradient);
+
+      const double gain = std::pow(m_CurrentIteration + 1 + m_DecayOffset, -m_DecayExponent);
+
+      // the step in the scaled parameters is gain times the scaled derivative
+      if (!(m_CurrentLearningRate > 0)) {
+        double norm = 0;
+        for (unsigned int par = 0; par < numberOfParameters; ++par) {
+          norm += (m_Gradient[par] / scales[par]) * (m_Gradient[par] / scales[par]);
+        }
+        norm = std::sqrt(norm);
+
+        if (!(norm > 0)) {
+          m_StopConditionDescription << "Zero derivative at the initial position";
+          break;
+        }
+
+        m_CurrentLearningRate = m_MaximalStepLength / (gain * norm);
+      }
+
+      for (unsigned int par = 0; par < numberOfParameters; ++par) {
+        position[par] -= m_CurrentLearningRate * gain * m_Gradient[par] / (scales[par] * scales[par]);
+      }
+
+      this->SetCurrentPosition(position);
+      this->InvokeEvent(IterationEvent());
+    }
+
+    if (m_CurrentIteration == m_NumberOfIterations) {
+      m_StopConditionDescription << "Maximum number of iterations (" << m_NumberOfIterations << ") exceeded";
+    }
+
+    this->InvokeEvent(EndEvent());
+  }
+
+  /** Get the reason for termination. */
+  virtual const std::string GetStopConditionDescription() const ITK_OVERRIDE
+  {
+    return m_StopConditionDescription.str();
+  }
+
+protected:
+  StochasticGradientDescentOptimizer() {}
+  virtual ~StochasticGradientDescentOptimizer() {}
+
+  virtual void PrintSelf(std::ostream & os, Indent indent) const ITK_OVERRIDE
+  {
+    Superclass::PrintSelf(os, indent);
+    os << indent << "NumberOfIterations: " << m_NumberOfIterations << std::endl;
+    os << indent << "LearningRate: " << m_LearningRate << std::endl;
+    os << indent << "MaximalStepLength: " << m_MaximalStepLength << std::endl;
+    os << indent << "DecayOffset: " << m_DecayOffset << std::endl;
+    os << indent << "DecayExponent: " << m_DecayExponent << std::endl;
+  }
+
+  SizeValueType m_NumberOfIterations = 100;
+  SizeValueType m_CurrentIteration = 0;
+  double m_LearningRate = 0;
+  double m_CurrentLearningRate = 0;
+  double m_MaximalStepLength = 1;
+  double m_DecayOffset = 10;
+  double m_DecayExponent = 0.602;
+
+  MeasureType m_Value = 0;
+  DerivativeType m_Gradient;
+  std::ostringstream m_StopConditionDescription;
+
+private:
+  StochasticGradientDescentOptimizer(const Self &) ITK_DELETE_FUNCTION;
+  void operator=(const Self &) ITK_DELETE_FUNCTION;
+};
+}
+
+#endif
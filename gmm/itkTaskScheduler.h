@@ -0,0 +1,337 @@
+#ifndef itkTaskScheduler_h
+#define itkTaskScheduler_h
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace itk
+{
+/** \class TaskScheduler
+ * \brief Work-stealing scheduler of the tasks shared by the metrics, the preprocessing and the batch jobs.
+ *
+ * The scheduler runs NumberOfThreads - 1 workers, the thread which waits for the tasks is the last one.
+ * Each worker has its own deque of the tasks, the tasks submitted by a worker are pushed to the back of its
+ * deque and are taken back from the back, the idle workers steal the tasks from the fronts of the other
+ * deques. The tasks submitted by the other threads are queued in the shared deque. The thread which waits
+ * for a group of the tasks runs the queued tasks of that group until the group is finished, so the nested
+ * parallel loops, e.g. the metric evaluated in a batch job, are split into the tasks of the same workers and
+ * the machine is not oversubscribed. The waiting thread does not take the tasks of the other groups, so a
+ * loop inside one batch job never waits for another whole job. The library submits its work to the scheduler
+ * returned by GetInstance().
+ */
+class TaskScheduler
+{
+public:
+  typedef std::function<void()> TaskType;
+
+  /** \class TaskGroup
+   * \brief The tasks which are waited for together.
+   */
+  class TaskGroup
+  {
+  public:
+    explicit TaskGroup(TaskScheduler & scheduler = TaskScheduler::GetInstance()) : m_Scheduler(scheduler), m_Pending(0), m_Queued(0) {}
+
+    ~TaskGroup()
+    {
+      this->Join();
+    }
+
+    /** Submit the task of the group. */
+    void Run(const TaskType & task)
+    {
+      ++m_Pending;
+      m_Scheduler.Submit(task, this);
+    }
+
+    /** Run the queued tasks of the group until they are finished, the first exception thrown by the tasks is rethrown. */
+    void Wait()
+    {
+      this->Join();
+
+      if (m_Exception) {
+        std::exception_ptr exception = m_Exception;
+        m_Exception = nullptr;
+        std::rethrow_exception(exception);
+      }
+    }
+
+  private:
+    friend class TaskScheduler;
+
+    void Join()
+    {
+      const size_t queue = m_Scheduler.GetQueueIndex();
+
+      while (m_Pending > 0) {
+        if (m_Scheduler.RunNextTask(queue, this)) {
+          continue;
+        }
+
+        // the rest of the tasks of the group are running on the other threads
+        std::unique_lock<std::mutex> lock(m_Scheduler.m_Mutex);
+        m_Scheduler.m_Condition.wait(lock, [this]() { return m_Pending == 0 || m_Queued > 0; });
+      }
+    }
+
+    TaskGroup(const TaskGroup &) = delete;
+    void operator=(const TaskGroup &) = delete;
+
+    TaskScheduler & m_Scheduler;
+    std::atomic<size_t> m_Pending;
+    std::atomic<size_t> m_Queued;
+    std::exception_ptr m_Exception;
+    std::mutex m_ExceptionMutex;
+  };
+
+  /** The scheduler shared by the library, it runs the threads of all cores until SetNumberOfThreads is called. */
+  static TaskScheduler & GetInstance()
+  {
+    static TaskScheduler scheduler;
+    return scheduler;
+  }
+
+  explicit TaskScheduler(const size_t & numberOfThreads = 0)
+  {
+    this->Start(numberOfThreads);
+  }
+
+  ~TaskScheduler()
+  {
+    this->Stop();
+  }
+
+  /** Set the number of the threads including the waiting one, zero is the number of the cores. The workers are
+   *  restarted, so the number must not be changed while the tasks are running. */
+  void SetNumberOfThreads(const size_t & numberOfThreads)
+  {
+    this->Stop();
+    this->Start(numberOfThreads);
+  }
+
+  size_t GetNumberOfThreads() const
+  {
+    return m_NumberOfWorkers + 1;
+  }
+
+  /** Call function(first, last) for the consecutive ranges of the indices [begin, end), the ranges are
+   *  run as the tasks and the calling thread takes part. If the grain size is zero, the range is split into
+   *  the several ranges per thread. */
+  template <typename TFunction>
+  void ParallelFor(const size_t & begin, const size_t & end, const size_t & grain, const TFunction & function)
+  {
+    if (end <= begin) {
+      return;
+    }
+
+    const size_t count = end - begin;
+    const size_t size = grain > 0 ? grain : std::max(count / (8 * this->GetNumberOfThreads()), size_t(1));
+
+    if (count <= size || m_NumberOfWorkers == 0) {
+      function(begin, end);
+      return;
+    }
+
+    TaskGroup group(*this);
+
+    for (size_t first = begin; first < end; first += size) {
+      const size_t last = std::min(first + size, end);
+      group.Run([&function, first, last]() { function(first, last); });
+    }
+
+    group.Wait();
+  }
+
+private:
+  struct Task
+  {
+    TaskType function;
+    TaskGroup * group;
+  };
+
+  struct Queue
+  {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  TaskScheduler(const TaskScheduler &) = delete;
+  void operator=(const TaskScheduler &) = delete;
+
+  /** The scheduler and the worker of the current thread. */
+  static const TaskScheduler *& CurrentScheduler()
+  {
+    static thread_local const TaskScheduler * scheduler = nullptr;
+    return scheduler;
+  }
+
+  static size_t & CurrentWorker()
+  {
+    static thread_local size_t worker = 0;
+    return worker;
+  }
+
+  /** The deque of the worker or the shared deque, which is the last one. */
+  size_t GetQueueIndex() const
+  {
+    return CurrentScheduler() == this ? CurrentWorker() : m_NumberOfWorkers;
+  }
+
+  void Start(const size_t & numberOfThreads)
+  {
+    const size_t threads = numberOfThreads > 0 ? numberOfThreads : std::max(std::thread::hardware_concurrency(), 1u);
+
+    m_Stop = false;
+    m_NumberOfQueuedTasks = 0;
+
+    // the queues and the number of the workers are fixed before the workers start, the running workers
+    // read them without the locks
+    m_NumberOfWorkers = threads - 1;
+
+    m_Queues.clear();
+    for (size_t n = 0; n < threads; ++n) {
+      m_Queues.push_back(std::unique_ptr<Queue>(new Queue));
+    }
+
+    m_Workers.reserve(m_NumberOfWorkers);
+    for (size_t n = 0; n < m_NumberOfWorkers; ++n) {
+      m_Workers.push_back(std::thread(&TaskScheduler::RunWorker, this, n));
+    }
+  }
+
+  void Stop()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      m_Stop = true;
+    }
+    m_Condition.notify_all();
+
+    for (size_t n = 0; n < m_Workers.size(); ++n) {
+      m_Workers[n].join();
+    }
+    m_Workers.clear();
+  }
+
+  void RunWorker(const size_t & worker)
+  {
+    CurrentScheduler() = this;
+    CurrentWorker() = worker;
+
+    while (true) {
+      if (this->RunNextTask(worker, nullptr)) {
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(m_Mutex);
+      m_Condition.wait(lock, [this]() { return m_Stop || m_NumberOfQueuedTasks > 0; });
+
+      if (m_Stop) {
+        return;
+      }
+    }
+  }
+
+  void Submit(const TaskType & function, TaskGroup * group)
+  {
+    // the counters are increased first, so they are not less than the numbers of the tasks in the deques
+    ++m_NumberOfQueuedTasks;
+    ++group->m_Queued;
+
+    Queue & queue = *m_Queues[this->GetQueueIndex()];
+    {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.tasks.push_back(Task{function, group});
+    }
+
+    // the idle workers and the thread joining the group are woken
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+    }
+    m_Condition.notify_all();
+  }
+
+  /** Take the task from the back of the own deque or steal the task from the front of another deque. If the
+   *  group is given, only the tasks of the group are taken. */
+  bool TakeTask(const size_t & own, const TaskGroup * group, Task & task)
+  {
+    for (size_t k = 0; k < m_Queues.size(); ++k) {
+      Queue & queue = *m_Queues[(own + k) % m_Queues.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+
+      if (k == 0 && own < m_NumberOfWorkers) {
+        for (size_t n = queue.tasks.size(); n > 0; --n) {
+          if (!group || queue.tasks[n - 1].group == group) {
+            task = std::move(queue.tasks[n - 1]);
+            queue.tasks.erase(queue.tasks.begin() + (n - 1));
+            return true;
+          }
+        }
+      }
+      else {
+        for (size_t n = 0; n < queue.tasks.size(); ++n) {
+          if (!group || queue.tasks[n].group == group) {
+            task = std::move(queue.tasks[n]);
+            queue.tasks.erase(queue.tasks.begin() + n);
+            return true;
+          }
+        }
+      }
+    }
+
+    return false;
+  }
+
+  /** Run the next task, of any group or of the given one. */
+  bool RunNextTask(const size_t & own, TaskGroup * group)
+  {
+    Task task;
+
+    if (!this->TakeTask(own, group, task)) {
+      return false;
+    }
+
+    --m_NumberOfQueuedTasks;
+    --task.group->m_Queued;
+
+    try {
+      task.function();
+    }
+    catch (...) {
+      std::lock_guard<std::mutex> lock(task.group->m_ExceptionMutex);
+      if (!task.group->m_Exception) {
+        task.group->m_Exception = std::current_exception();
+      }
+    }
+
+    // the group may be destroyed by its waiting thread as soon as the last task is finished
+    if (--task.group->m_Pending == 0) {
+      {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+      }
+      m_Condition.notify_all();
+    }
+
+    return true;
+  }
+
+  std::vector< std::unique_ptr<Queue> > m_Queues;
+  std::vector<std::thread> m_Workers;
+  size_t m_NumberOfWorkers = 0;
+  std::atomic<long> m_NumberOfQueuedTasks;
+  std::mutex m_Mutex;
+  std::condition_variable m_Condition;
+  bool m_Stop = false;
+};
+}
+
+#endif
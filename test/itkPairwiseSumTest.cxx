@@ -0,0 +1,114 @@
+#include "itkPairwiseSum.h"
+#include "itkTaskScheduler.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// the sums of the partial sums of the fixed blocks, which are computed by the tasks, are compared bit for bit
+// for the different numbers of the threads, the sizes of the tasks and the chunks of the blocks
+
+const size_t Length = 4;
+const size_t BlockSize = 100;
+
+// the partial sums of the blocks are computed by the tasks and added in the chunks, as in the metric
+void ComputeSum(const std::vector<double> & values, const size_t & grain, const size_t & chunkSize, double * sum)
+{
+  const size_t numberOfBlocks = (values.size() / Length + BlockSize - 1) / BlockSize;
+  std::vector<double> partials(chunkSize * Length);
+  itk::PairwiseSum pairwiseSum(Length);
+
+  for (size_t chunk = 0; chunk < numberOfBlocks; chunk += chunkSize) {
+    const size_t count = std::min(chunkSize, numberOfBlocks - chunk);
+
+    itk::TaskScheduler::GetInstance().ParallelFor(0, count, grain, [&values, &partials, chunk](const size_t & first, const size_t & last) {
+      for (size_t block = first; block < last; ++block) {
+        double * partial = &partials[block * Length];
+        std::fill(partial, partial + Length, 0.0);
+
+        const size_t end = std::min((chunk + block + 1) * BlockSize, values.size() / Length);
+        for (size_t n = (chunk + block) * BlockSize; n < end; ++n) {
+          for (size_t k = 0; k < Length; ++k) {
+            partial[k] += values[n * Length + k];
+          }
+        }
+      }
+    });
+
+    for (size_t block = 0; block < count; ++block) {
+      pairwiseSum.Add(&partials[block * Length]);
+    }
+  }
+
+  pairwiseSum.GetSum(sum);
+}
+
+int main(int, char**) {
+
+  // the terms of the different magnitudes and signs, so the sums depend on the order of the additions
+  std::mt19937 generator(1);
+  std::uniform_real_distribution<double> uniform(-1, 1);
+  std::uniform_int_distribution<int> exponent(-20, 20);
+
+  const size_t numberOfTerms = 123457;
+  std::vector<double> values(numberOfTerms * Length);
+  for (size_t n = 0; n < values.size(); ++n) {
+    values[n] = std::ldexp(uniform(generator), exponent(generator));
+  }
+
+  double expected[Length];
+  bool first = true;
+
+  const size_t threads[] = {1, 2, 3, 8};
+  const size_t grains[] = {0, 1, 5};
+  const size_t chunkSizes[] = {1, 7, 64, 5000};
+
+  for (size_t numberOfThreads : threads) {
+    itk::TaskScheduler::GetInstance().SetNumberOfThreads(numberOfThreads);
+
+    for (size_t grain : grains) {
+      for (size_t chunkSize : chunkSizes) {
+        double sum[Length];
+        ComputeSum(values, grain, chunkSize, sum);
+
+        if (first) {
+          std::copy(sum, sum + Length, expected);
+          first = false;
+          continue;
+        }
+
+        for (size_t k = 0; k < Length; ++k) {
+          if (sum[k] != expected[k]) {
+            std::cerr << "the sum " << k << " for " << numberOfThreads << " threads, the grain " << grain << " and the chunk " << chunkSize
+                      << " differs by " << sum[k] - expected[k] << std::endl;
+            return EXIT_FAILURE;
+          }
+        }
+      }
+    }
+  }
+
+  // the sums and the pairwise sums of the arrays are accurate
+  for (size_t k = 0; k < Length; ++k) {
+    std::vector<double> column(numberOfTerms);
+    long double reference = 0;
+    double magnitude = 0;
+    for (size_t n = 0; n < numberOfTerms; ++n) {
+      column[n] = values[n * Length + k];
+      reference += column[n];
+      magnitude += std::abs(column[n]);
+    }
+
+    const double sum = itk::PairwiseSum::Sum(column.data(), column.size());
+
+    if (std::abs(expected[k] - static_cast<double>(reference)) > 1.0e-12 * magnitude ||
+        std::abs(sum - static_cast<double>(reference)) > 1.0e-12 * magnitude) {
+      std::cerr << "the sum " << k << " is " << expected[k] << " and " << sum << " instead of " << static_cast<double>(reference) << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
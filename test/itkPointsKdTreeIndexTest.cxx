@@ -0,0 +1,159 @@
+#include <itkPointSet.h>
+
+#include "itkPointsKdTreeIndex.h"
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <utility>
+#include <vector>
+
+// the queries of the kd-tree index, built and read from the file, are compared with the brute force search
+
+const unsigned int Dimension = 3;
+typedef itk::PointSet<float, Dimension> PointSetType;
+typedef PointSetType::PointsContainer PointsContainerType;
+typedef PointSetType::PointType PointType;
+typedef itk::PointsKdTreeIndex<PointsContainerType> PointsIndexType;
+
+double SquaredDistance(const PointType & x, const PointType & y)
+{
+  double distance = 0;
+  for (unsigned int dim = 0; dim < Dimension; ++dim) {
+    const double difference = static_cast<double>(x[dim]) - static_cast<double>(y[dim]);
+    distance += difference * difference;
+  }
+  return distance;
+}
+
+bool CheckQueries(const PointsIndexType * index, const PointsContainerType * points, std::mt19937 & generator)
+{
+  std::uniform_real_distribution<double> uniform(-1.2, 1.2);
+  const size_t numberOfNeighbors = 7;
+  const double radius = 0.2;
+
+  for (size_t query = 0; query < 200; ++query) {
+    PointType point;
+    for (unsigned int dim = 0; dim < Dimension; ++dim) {
+      point[dim] = uniform(generator);
+    }
+
+    std::vector< std::pair<double, PointsIndexType::PointIdentifier> > distances;
+    for (PointsContainerType::ConstIterator it = points->Begin(); it != points->End(); ++it) {
+      distances.push_back(std::make_pair(SquaredDistance(point, it.Value()), it.Index()));
+    }
+    std::sort(distances.begin(), distances.end());
+
+    // the distances are compared, so the ties are allowed in any order
+    const PointsIndexType::PointIdentifier closest = index->FindClosestPoint(point);
+    if (SquaredDistance(point, points->ElementAt(closest)) != distances[0].first) {
+      std::cerr << "query " << query << ": wrong closest point " << closest << std::endl;
+      return false;
+    }
+
+    PointsIndexType::NeighborsIdentifierType neighbors;
+    index->FindClosestNPoints(point, numberOfNeighbors, neighbors);
+    if (neighbors.size() != numberOfNeighbors) {
+      std::cerr << "query " << query << ": " << neighbors.size() << " closest points instead of " << numberOfNeighbors << std::endl;
+      return false;
+    }
+
+    std::vector<double> neighborDistances;
+    for (size_t n = 0; n < neighbors.size(); ++n) {
+      neighborDistances.push_back(SquaredDistance(point, points->ElementAt(neighbors[n])));
+    }
+    std::sort(neighborDistances.begin(), neighborDistances.end());
+
+    for (size_t n = 0; n < numberOfNeighbors; ++n) {
+      if (neighborDistances[n] != distances[n].first) {
+        std::cerr << "query " << query << ": wrong closest point " << n << std::endl;
+        return false;
+      }
+    }
+
+    index->Search(point, radius, neighbors);
+    std::sort(neighbors.begin(), neighbors.end());
+
+    std::vector<PointsIndexType::PointIdentifier> expected;
+    for (size_t n = 0; n < distances.size() && distances[n].first <= radius * radius; ++n) {
+      expected.push_back(distances[n].second);
+    }
+    std::sort(expected.begin(), expected.end());
+
+    if (neighbors != expected) {
+      std::cerr << "query " << query << ": " << neighbors.size() << " points in the radius instead of " << expected.size() << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+int main(int argc, char** argv) {
+
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <index file>" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::mt19937 generator(1);
+  std::uniform_real_distribution<double> uniform(-1, 1);
+
+  PointsContainerType::Pointer points = PointsContainerType::New();
+  for (PointsContainerType::ElementIdentifier n = 0; n < 20000; ++n) {
+    PointType point;
+    for (unsigned int dim = 0; dim < Dimension; ++dim) {
+      point[dim] = uniform(generator);
+    }
+    points->InsertElement(n, point);
+  }
+
+  // the small subtrees are built by the tasks
+  PointsIndexType::Pointer index = PointsIndexType::New();
+  index->SetLeafSize(4);
+  index->SetParallelBuildSize(256);
+  index->Build(points);
+
+  if (!CheckQueries(index, points, generator)) {
+    std::cerr << "the built index does not match the brute force search" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  try {
+    index->Write(argv[1]);
+  }
+  catch (itk::ExceptionObject & excep) {
+    std::cerr << excep << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  PointsIndexType::Pointer read = PointsIndexType::New();
+  try {
+    read->Read(argv[1]);
+  }
+  catch (itk::ExceptionObject & excep) {
+    std::cerr << excep << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (!read->Matches(points) || read->GetNumberOfPoints() != points->Size()) {
+    std::cerr << "the read index does not match the points" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (!CheckQueries(read, points, generator)) {
+    std::cerr << "the read index does not match the brute force search" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // the match is kept for the unmodified points only
+  points->ElementAt(0)[0] += 1;
+  points->Modified();
+
+  if (read->Matches(points) || index->Matches(points)) {
+    std::cerr << "the index matches the modified points" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
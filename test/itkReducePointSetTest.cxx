@@ -0,0 +1,218 @@
+#include <itkPointSet.h>
+
+#include "itkReducePointSet.h"
+
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// the points are reduced to the weighted centroids of the voxels, the weights and the centroids are
+// compared with the ones computed by the cells of the points
+
+const unsigned int Dimension = 3;
+typedef itk::PointSet<float, Dimension> PointSetType;
+typedef PointSetType::PointsContainer PointsContainerType;
+typedef PointSetType::PointDataContainer PointDataContainerType;
+typedef PointSetType::PointType PointType;
+typedef itk::ReducePointSet<PointSetType> ReduceType;
+
+const double Tolerance = 1.0e-4;
+
+bool CheckPointSet(const PointSetType * pointSet, const std::vector<PointType> & centroids, const std::vector<double> & weights)
+{
+  if (pointSet->GetNumberOfPoints() != centroids.size() || pointSet->GetPointData()->Size() != weights.size()) {
+    std::cerr << pointSet->GetNumberOfPoints() << " reduced points instead of " << centroids.size() << std::endl;
+    return false;
+  }
+
+  // the centroids are matched by the position, the output is ordered by the voxels
+  std::vector<bool> matched(centroids.size(), false);
+
+  for (size_t n = 0; n < pointSet->GetNumberOfPoints(); ++n) {
+    const PointType point = pointSet->GetPoint(n);
+    bool found = false;
+
+    for (size_t k = 0; k < centroids.size() && !found; ++k) {
+      double distance = 0;
+      for (unsigned int dim = 0; dim < Dimension; ++dim) {
+        distance = std::max(distance, std::abs(static_cast<double>(point[dim]) - centroids[k][dim]));
+      }
+
+      if (!matched[k] && distance < Tolerance) {
+        if (std::abs(pointSet->GetPointData()->ElementAt(n) - weights[k]) > Tolerance) {
+          std::cerr << "the weight of the centroid " << k << " is " << pointSet->GetPointData()->ElementAt(n) << " instead of " << weights[k] << std::endl;
+          return false;
+        }
+
+        matched[k] = true;
+        found = true;
+      }
+    }
+
+    if (!found) {
+      std::cerr << "the reduced point " << n << " is not a centroid" << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+int main(int, char**) {
+
+  std::mt19937 generator(1);
+  std::uniform_real_distribution<double> uniform(0.05, 0.95);
+
+  // the clusters of the points in the voxels of the unit size, the point at the origin aligns the grid
+  const int cells[][Dimension] = { {0, 0, 0}, {1, 0, 0}, {0, 2, 1}, {3, 3, 3}, {2, 0, 3} };
+  const size_t numberOfCells = sizeof(cells) / sizeof(cells[0]);
+
+  PointsContainerType::Pointer points = PointsContainerType::New();
+  PointDataContainerType::Pointer data = PointDataContainerType::New();
+  std::vector<PointType> centroids(numberOfCells);
+  std::vector<double> weights(numberOfCells, 0);
+  std::vector<PointType> weightedCentroids(numberOfCells);
+  std::vector<double> pointWeights(numberOfCells, 0);
+
+  PointsContainerType::ElementIdentifier id = 0;
+
+  for (size_t k = 0; k < numberOfCells; ++k) {
+    const size_t numberOfPoints = k == 0 ? 1 : 10 * k;
+    double sum[Dimension] = {};
+    double weightedSum[Dimension] = {};
+
+    for (size_t n = 0; n < numberOfPoints; ++n) {
+      PointType point;
+      for (unsigned int dim = 0; dim < Dimension; ++dim) {
+        point[dim] = k == 0 ? 0 : cells[k][dim] + uniform(generator);
+        sum[dim] += point[dim];
+      }
+
+      // the weights of the second reduction
+      const float weight = static_cast<float>(1 + n % 3);
+      for (unsigned int dim = 0; dim < Dimension; ++dim) {
+        weightedSum[dim] += weight * point[dim];
+      }
+
+      points->InsertElement(id, point);
+      data->InsertElement(id, weight);
+      ++id;
+
+      weights[k] += 1;
+      pointWeights[k] += weight;
+    }
+
+    for (unsigned int dim = 0; dim < Dimension; ++dim) {
+      centroids[k][dim] = sum[dim] / weights[k];
+      weightedCentroids[k][dim] = weightedSum[dim] / pointWeights[k];
+    }
+  }
+
+  // the point data are not the weights, they are ignored by default
+  PointSetType::Pointer pointSet = PointSetType::New();
+  pointSet->SetPoints(points);
+  pointSet->SetPointData(data);
+
+  ReduceType::Pointer reduce = ReduceType::New();
+  reduce->SetPointSet(pointSet);
+  reduce->SetVoxelSize(1);
+
+  try {
+    reduce->Compute();
+  }
+  catch (itk::ExceptionObject & excep) {
+    std::cerr << excep << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (!CheckPointSet(reduce->GetOutput(), centroids, weights)) {
+    std::cerr << "the reduction of the points is wrong" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (reduce->GetTotalWeight() != points->Size()) {
+    std::cerr << "the total weight is " << reduce->GetTotalWeight() << " instead of " << points->Size() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // the point data are the weights of the input points
+  reduce->UseInputWeightsOn();
+
+  try {
+    reduce->Compute();
+  }
+  catch (itk::ExceptionObject & excep) {
+    std::cerr << excep << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (!CheckPointSet(reduce->GetOutput(), weightedCentroids, pointWeights)) {
+    std::cerr << "the reduction of the weighted points is wrong" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // the reduced point set is reduced again to the single voxel, the total weight and the centroid are preserved
+  PointSetType::Pointer reduced = reduce->GetOutput();
+  const double totalWeight = reduce->GetTotalWeight();
+
+  double weightedSum[Dimension] = {};
+  for (size_t k = 0; k < numberOfCells; ++k) {
+    for (unsigned int dim = 0; dim < Dimension; ++dim) {
+      weightedSum[dim] += pointWeights[k] * weightedCentroids[k][dim];
+    }
+  }
+
+  std::vector<PointType> centroid(1);
+  for (unsigned int dim = 0; dim < Dimension; ++dim) {
+    centroid[0][dim] = weightedSum[dim] / totalWeight;
+  }
+
+  ReduceType::Pointer reduceAgain = ReduceType::New();
+  reduceAgain->SetPointSet(reduced);
+  reduceAgain->SetVoxelSize(10);
+  reduceAgain->UseInputWeightsOn();
+
+  try {
+    reduceAgain->Compute();
+  }
+  catch (itk::ExceptionObject & excep) {
+    std::cerr << excep << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (!CheckPointSet(reduceAgain->GetOutput(), centroid, std::vector<double>(1, totalWeight))) {
+    std::cerr << "the reduction of the reduced points is wrong" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // the keys of the voxels over the large extent would exceed 64 bits
+  PointsContainerType::Pointer distantPoints = PointsContainerType::New();
+  PointType distantPoint;
+  distantPoint.Fill(0);
+  distantPoints->InsertElement(0, distantPoint);
+  distantPoint.Fill(1.0e6);
+  distantPoints->InsertElement(1, distantPoint);
+
+  PointSetType::Pointer distantPointSet = PointSetType::New();
+  distantPointSet->SetPoints(distantPoints);
+
+  ReduceType::Pointer reduceDistant = ReduceType::New();
+  reduceDistant->SetPointSet(distantPointSet);
+  reduceDistant->SetVoxelSize(1.0e-2);
+
+  bool thrown = false;
+  try {
+    reduceDistant->Compute();
+  }
+  catch (itk::ExceptionObject &) {
+    thrown = true;
+  }
+
+  if (!thrown) {
+    std::cerr << "the overflow of the keys of the voxels is not detected" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,130 @@
+#include "itkTaskScheduler.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// the nested loops of the batch jobs and the groups waited for by the concurrent threads are finished
+// and joined for the different numbers of the threads, a thread waiting for its loop does not take another job
+
+thread_local size_t NumberOfRunningJobs = 0;
+
+int main(int, char**) {
+
+  itk::TaskScheduler & scheduler = itk::TaskScheduler::GetInstance();
+
+  const size_t threads[] = {1, 2, 4, 16};
+
+  for (size_t numberOfThreads : threads) {
+    scheduler.SetNumberOfThreads(numberOfThreads);
+
+    if (scheduler.GetNumberOfThreads() != numberOfThreads) {
+      std::cerr << scheduler.GetNumberOfThreads() << " threads instead of " << numberOfThreads << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    // the batch of the jobs, each job runs the nested parallel loops
+    const size_t numberOfJobs = 64;
+    const size_t numberOfLoops = 10;
+    const size_t count = 1000;
+    std::atomic<size_t> total(0);
+    std::atomic<size_t> maximalNumberOfRunningJobs(0);
+
+    {
+      itk::TaskScheduler::TaskGroup jobs(scheduler);
+
+      for (size_t job = 0; job < numberOfJobs; ++job) {
+        jobs.Run([&scheduler, &total, &maximalNumberOfRunningJobs, count]() {
+          ++NumberOfRunningJobs;
+          if (NumberOfRunningJobs > maximalNumberOfRunningJobs) {
+            maximalNumberOfRunningJobs = NumberOfRunningJobs;
+          }
+
+          for (size_t loop = 0; loop < numberOfLoops; ++loop) {
+            scheduler.ParallelFor(0, count, 0, [&scheduler, &total](const size_t & first, const size_t & last) {
+              scheduler.ParallelFor(first, last, 1, [&total](const size_t & begin, const size_t & end) { total += end - begin; });
+            });
+          }
+
+          --NumberOfRunningJobs;
+        });
+      }
+
+      jobs.Wait();
+    }
+
+    if (total != numberOfJobs * numberOfLoops * count) {
+      std::cerr << numberOfThreads << " threads: the nested loops counted " << total << " instead of " << numberOfJobs * numberOfLoops * count << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    if (maximalNumberOfRunningJobs != 1) {
+      std::cerr << numberOfThreads << " threads: " << maximalNumberOfRunningJobs << " jobs were run by one thread at once" << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    // the groups waited for by the concurrent threads, which are not the workers
+    const size_t numberOfClients = 4;
+    std::vector<size_t> counts(numberOfClients, 0);
+    std::vector<std::thread> clients;
+
+    for (size_t client = 0; client < numberOfClients; ++client) {
+      clients.push_back(std::thread([&scheduler, &counts, client, count]() {
+        itk::TaskScheduler::TaskGroup group(scheduler);
+        std::atomic<size_t> sum(0);
+
+        for (size_t task = 0; task < 20; ++task) {
+          group.Run([&scheduler, &sum, count]() {
+            scheduler.ParallelFor(0, count, 0, [&sum](const size_t & first, const size_t & last) { sum += last - first; });
+          });
+        }
+
+        group.Wait();
+        counts[client] = sum;
+      }));
+    }
+
+    for (size_t client = 0; client < numberOfClients; ++client) {
+      clients[client].join();
+    }
+
+    for (size_t client = 0; client < numberOfClients; ++client) {
+      if (counts[client] != 20 * count) {
+        std::cerr << numberOfThreads << " threads: the group of the client " << client << " counted " << counts[client] << " instead of " << 20 * count << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+
+    // the exception of a task is rethrown by the waiting thread, the rest of the tasks are finished
+    std::atomic<size_t> finished(0);
+    bool caught = false;
+
+    try {
+      itk::TaskScheduler::TaskGroup group(scheduler);
+
+      for (size_t task = 0; task < 100; ++task) {
+        group.Run([&finished, task]() {
+          if (task == 37) {
+            throw std::runtime_error("task failed");
+          }
+          ++finished;
+        });
+      }
+
+      group.Wait();
+    }
+    catch (std::runtime_error &) {
+      caught = true;
+    }
+
+    if (!caught || finished != 99) {
+      std::cerr << numberOfThreads << " threads: the exception of the task is not rethrown after the other tasks" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -3,6 +3,8 @@
 #define itkIOutils_h
 
 #include <iostream>
+#include <fstream>
+#include <vector>
 #include <itkMeshFileReader.h>
 #include <itkMeshFileWriter.h>
 
@@ -50,4 +52,37 @@ bool writeMesh(const TMesh* mesh, const std::string& fileName)
   return true;
 }
 
+//! Reads points from a text file, one point per line
+template <typename TPoint>
+bool readPoints(std::vector<TPoint> & points, const std::string& fileName)
+{
+  std::ifstream file(fileName.c_str());
+  if (!file) {
+    std::cerr << "Unable to read points from file '" << fileName << "'" << std::endl;
+    return false;
+  }
+
+  points.clear();
+  TPoint point;
+
+  while (true) {
+    for (unsigned int dim = 0; dim < TPoint::PointDimension; ++dim) {
+      file >> point[dim];
+    }
+
+    if (!file) {
+      break;
+    }
+
+    points.push_back(point);
+  }
+
+  if (!file.eof()) {
+    std::cerr << "Unable to parse points from file '" << fileName << "'" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
 #endif